@@ -0,0 +1,67 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include "blockcache.h"
+#include "hash.h"
+#include "utilstrencodings.h"
+
+static CSharedPayloadRef MakePayload(size_t nSize, char ch)
+{
+	return std::make_shared<const CSharedPayload>(CSerializeData(nSize, ch));
+}
+
+static uint256 MakeHash(int n)
+{
+	return Hash(BEGIN(n), END(n));
+}
+
+TEST_CASE("blockcache_payload_checksum")
+{
+	CSharedPayloadRef payload = MakePayload(100, 'x');
+	uint256 hash = Hash(payload->vch.begin(), payload->vch.end());
+	unsigned int nChecksum = 0;
+	memcpy(&nChecksum, &hash, sizeof(nChecksum));
+	REQUIRE(payload->nChecksum == nChecksum);
+}
+
+TEST_CASE("blockcache_lru")
+{
+	CBlockPayloadCache cache(300);
+
+	for (int i = 0; i < 3; i++)
+		cache.Insert(MakeHash(i), MakePayload(100, 'a' + i));
+	REQUIRE(cache.GetCount() == 3);
+	REQUIRE(cache.GetBytes() == 300);
+
+	// using block 0 makes block 1 the least recently used
+	CSharedPayloadRef payload = cache.Get(MakeHash(0));
+	REQUIRE(payload);
+	REQUIRE(payload->vch[0] == 'a');
+
+	cache.Insert(MakeHash(3), MakePayload(100, 'd'));
+	REQUIRE(cache.GetCount() == 3);
+	REQUIRE(cache.GetBytes() == 300);
+	REQUIRE(!cache.Get(MakeHash(1)));
+	REQUIRE(cache.Get(MakeHash(0)));
+	REQUIRE(cache.Get(MakeHash(2)));
+	REQUIRE(cache.Get(MakeHash(3)));
+	REQUIRE(cache.GetHits() == 4);
+	REQUIRE(cache.GetMisses() == 1);
+
+	// a block larger than the whole cache is not kept
+	cache.Insert(MakeHash(4), MakePayload(301, 'e'));
+	REQUIRE(!cache.Get(MakeHash(4)));
+	REQUIRE(cache.GetCount() == 3);
+
+	// an evicted block stays valid for whoever still holds it
+	cache.SetMaxBytes(100);
+	REQUIRE(cache.GetCount() == 1);
+	REQUIRE(cache.GetBytes() == 100);
+	REQUIRE(payload->vch.size() == 100);
+	REQUIRE(payload->vch[99] == 'a');
+
+	cache.Clear();
+	REQUIRE(cache.GetCount() == 0);
+	REQUIRE(cache.GetBytes() == 0);
+}
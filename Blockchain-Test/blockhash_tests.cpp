@@ -0,0 +1,115 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include "arith_uint256.h"
+#include "powhashqueue.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+
+#include <string.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+static CBlockHeader RandomHeader()
+{
+	CBlockHeader header;
+	header.nVersion = CBlockHeader::CURRENT_VERSION;
+	header.hashPrevBlock = GetRandHash();
+	header.hashMerkleRoot = GetRandHash();
+	header.hashClaimTrie = GetRandHash();
+	header.nTime = 1269211443;
+	header.nBits = 0x207fffff;
+	header.nNonce = GetRandHash();
+	return header;
+}
+
+static void HashHeaders(const std::vector<CBlockHeader>* pheaders, std::vector<uint256>* phashes)
+{
+	for (size_t i = 0; i < pheaders->size(); i++)
+		(*phashes)[i] = (*pheaders)[i].GetHash();
+}
+
+TEST_CASE("block_header_hash_memoization")
+{
+	CBlockHeader header = RandomHeader();
+
+	// The direct serializer must match the stream serializer byte for byte
+	CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+	ss << header;
+	unsigned char buf[CBlockHeader::HEADER_SIZE];
+	header.SerializeHeader(buf);
+	REQUIRE(ss.size() == CBlockHeader::HEADER_SIZE);
+	REQUIRE(memcmp(&ss[0], buf, CBlockHeader::HEADER_SIZE) == 0);
+
+	uint256 hash = header.GetHash();
+	REQUIRE(hash == header.ComputeHash());
+	REQUIRE(hash == header.GetHash());
+
+	// Copies carry the memoized hash along
+	CBlock block(header);
+	REQUIRE(block.GetBlockHeader().GetHash() == hash);
+
+	// Changing any consensus field invalidates it
+	header.nNonce = ArithToUint256(UintToArith256(header.nNonce) + 1);
+	REQUIRE(header.GetHash() != hash);
+	REQUIRE(header.GetHash() == header.ComputeHash());
+	block.nTime++;
+	REQUIRE(block.GetHash() != hash);
+	REQUIRE(block.GetHash() == block.ComputeHash());
+}
+
+TEST_CASE("block_header_hash_concurrent")
+{
+	// Every thread hashes the same headers, some of them first, some finding the memo
+	std::vector<CBlockHeader> headers;
+	for (int i = 0; i < 8; i++)
+		headers.push_back(RandomHeader());
+
+	const int nThreads = 4;
+	std::vector<std::vector<uint256> > vHashes(nThreads, std::vector<uint256>(headers.size()));
+	boost::thread_group threadGroup;
+	for (int i = 0; i < nThreads; i++)
+		threadGroup.create_thread(boost::bind(&HashHeaders, &headers, &vHashes[i]));
+	threadGroup.join_all();
+
+	for (size_t i = 0; i < headers.size(); i++) {
+		uint256 hash = headers[i].ComputeHash();
+		REQUIRE(headers[i].GetHash() == hash);
+		for (int n = 0; n < nThreads; n++)
+			REQUIRE(vHashes[n][i] == hash);
+	}
+}
+
+TEST_CASE("pow_hash_queue")
+{
+	CPowHashQueue queue;
+	boost::thread_group threadGroup;
+	for (int i = 0; i < 3; i++)
+		threadGroup.create_thread(boost::bind(&CPowHashQueue::Thread, &queue));
+
+	std::vector<CBlockHeader> headers(16);
+	for (CBlockHeader& header : headers) {
+		header.hashPrevBlock = GetRandHash();
+		header.nTime = 1269211443;
+		header.nBits = 0x207fffff;
+		header.nNonce = GetRandHash();
+	}
+
+	// Twice, to check the queue is reusable once a batch is done
+	for (int round = 0; round < 2; round++) {
+		queue.Hash(headers.data(), headers.size());
+		for (const CBlockHeader& header : headers)
+			REQUIRE(header.GetHash() == header.ComputeHash());
+		for (CBlockHeader& header : headers)
+			header.nTime++;
+	}
+	queue.Hash(headers.data(), 0);
+
+	threadGroup.interrupt_all();
+	threadGroup.join_all();
+}
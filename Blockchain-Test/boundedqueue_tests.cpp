@@ -0,0 +1,63 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include "boundedqueue.h"
+
+#include <boost/thread/thread.hpp>
+
+TEST_CASE("boundedqueue_fifo")
+{
+	CBoundedQueue<int> queue(4);
+	for (int i = 0; i < 3; i++)
+		REQUIRE(queue.Push(i));
+	REQUIRE(queue.Size() == 3);
+
+	int n = -1;
+	for (int i = 0; i < 3; i++) {
+		REQUIRE(queue.Pop(n));
+		REQUIRE(n == i);
+	}
+	REQUIRE(queue.Size() == 0);
+}
+
+TEST_CASE("boundedqueue_close_drains")
+{
+	CBoundedQueue<std::vector<int> > queue(2);
+	std::vector<int> v(3, 7);
+	REQUIRE(queue.Push(v));
+	queue.Close();
+
+	// nothing is accepted once closed, and the item is left with the caller
+	std::vector<int> w(2, 8);
+	REQUIRE(!queue.Push(w));
+	REQUIRE(w.size() == 2);
+
+	// but what was queued before is still handed out
+	std::vector<int> out;
+	REQUIRE(queue.Pop(out));
+	REQUIRE(out == std::vector<int>(3, 7));
+	REQUIRE(!queue.Pop(out));
+}
+
+TEST_CASE("boundedqueue_producer_consumer")
+{
+	CBoundedQueue<int> queue(2);
+	const int nItems = 1000;
+	boost::thread producer([&] {
+		for (int i = 0; i < nItems; i++) {
+			int n = i;
+			queue.Push(n);
+		}
+		queue.Close();
+	});
+
+	int nExpected = 0;
+	int n;
+	while (queue.Pop(n)) {
+		REQUIRE(queue.Size() <= 2);
+		REQUIRE(n == nExpected++);
+	}
+	producer.join();
+	REQUIRE(nExpected == nItems);
+}
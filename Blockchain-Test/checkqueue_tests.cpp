@@ -0,0 +1,174 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include "checkqueue.h"
+#include "utiltime.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+namespace
+{
+	//! Counts how often each id is verified; ids listed as bad fail
+	struct CCountingCheck
+	{
+		static std::vector<std::atomic<int>>* pvRuns;
+		static unsigned int nBad;
+
+		unsigned int nId;
+		unsigned int nWork;
+
+		CCountingCheck() : nId(0), nWork(0) {}
+		CCountingCheck(unsigned int nIdIn, unsigned int nWorkIn = 0) : nId(nIdIn), nWork(nWorkIn) {}
+
+		ScriptError Verify()
+		{
+			// Stand-in for a signature check of nWork rounds
+			volatile uint32_t x = nId;
+			for (unsigned int i = 0; i < nWork; i++)
+				x = x * 1103515245 + 12345;
+			if (pvRuns != NULL)
+				(*pvRuns)[nId]++;
+			return nId == nBad ? SCRIPT_ERR_UNKNOWN_ERROR : SCRIPT_ERR_OK;
+		}
+
+		void swap(CCountingCheck& check)
+		{
+			std::swap(nId, check.nId);
+			std::swap(nWork, check.nWork);
+		}
+	};
+
+	std::vector<std::atomic<int>>* CCountingCheck::pvRuns = NULL;
+	unsigned int CCountingCheck::nBad = (unsigned int)-1;
+
+	typedef CCheckQueue<CCountingCheck> CCountingQueue;
+
+	//! Worker threads for a queue, interrupted and joined on destruction
+	class CQueueThreads
+	{
+		boost::thread_group threadGroup;
+
+	public:
+		CQueueThreads(CCountingQueue& queue, int nThreads)
+		{
+			for (int i = 0; i < nThreads; i++)
+				threadGroup.create_thread(boost::bind(&CCountingQueue::Thread, &queue));
+		}
+
+		~CQueueThreads()
+		{
+			threadGroup.interrupt_all();
+			threadGroup.join_all();
+		}
+	};
+
+	//! Add checks [nBegin, nEnd) in batches of nBatch
+	void AddChecks(CCheckQueueControl<CCountingCheck>& control, unsigned int nBegin, unsigned int nEnd, unsigned int nBatch, unsigned int nWork = 0)
+	{
+		std::vector<CCountingCheck> vChecks;
+		for (unsigned int i = nBegin; i < nEnd; i++) {
+			vChecks.push_back(CCountingCheck(i, nWork));
+			if (vChecks.size() == nBatch || i + 1 == nEnd) {
+				control.Add(vChecks);
+				vChecks.clear();
+			}
+		}
+	}
+}
+
+TEST_CASE("checkqueue_runs_every_check_once")
+{
+	const unsigned int nChecks = 100000;
+	std::vector<std::atomic<int>> vRuns(nChecks);
+	CCountingCheck::pvRuns = &vRuns;
+	CCountingCheck::nBad = (unsigned int)-1;
+
+	CCountingQueue queue(128);
+	CQueueThreads threads(queue, 3);
+	unsigned int anBatches[] = {1, 7, 1000, nChecks};
+	for (unsigned int nBatch : anBatches) {
+		for (std::atomic<int>& n : vRuns)
+			n = 0;
+		{
+			CCheckQueueControl<CCountingCheck> control(&queue);
+			AddChecks(control, 0, nChecks, nBatch);
+			REQUIRE(control.Wait());
+		}
+		unsigned int nWrong = 0;
+		for (std::atomic<int>& n : vRuns)
+			if (n != 1)
+				nWrong++;
+		REQUIRE(nWrong == 0);
+		REQUIRE(queue.IsIdle());
+	}
+	CCountingCheck::pvRuns = NULL;
+}
+
+TEST_CASE("checkqueue_reports_failure")
+{
+	CCountingCheck::pvRuns = NULL;
+	CCountingQueue queue(16);
+	CQueueThreads threads(queue, 3);
+	for (unsigned int nBad = 0; nBad < 2000; nBad += 97) {
+		CCountingCheck::nBad = nBad;
+		CCheckQueueControl<CCountingCheck> control(&queue);
+		AddChecks(control, 0, 2000, 50);
+		REQUIRE(!control.Wait());
+		// the failure doesn't stick to the next round
+		REQUIRE(queue.IsIdle());
+	}
+	CCountingCheck::nBad = (unsigned int)-1;
+	CCheckQueueControl<CCountingCheck> control(&queue);
+	AddChecks(control, 0, 2000, 50);
+	REQUIRE(control.Wait());
+}
+
+TEST_CASE("checkqueue_without_workers")
+{
+	// -par=1: the master runs everything in Wait()
+	std::vector<std::atomic<int>> vRuns(5000);
+	CCountingCheck::pvRuns = &vRuns;
+	CCountingCheck::nBad = (unsigned int)-1;
+	CCountingQueue queue(128);
+	for (int nRound = 1; nRound <= 3; nRound++) {
+		CCheckQueueControl<CCountingCheck> control(&queue);
+		AddChecks(control, 0, 5000, 300);
+		REQUIRE(control.Wait());
+		for (std::atomic<int>& n : vRuns)
+			REQUIRE(n == nRound);
+	}
+	CCountingCheck::pvRuns = NULL;
+}
+
+// Run with: unit_test "[bench]"
+TEST_CASE("checkqueue_bench", "[.][bench]")
+{
+	CCountingCheck::pvRuns = NULL;
+	CCountingCheck::nBad = (unsigned int)-1;
+	const unsigned int nChecks = 20000;
+	const int nRounds = 20;
+	int anThreads[] = {0, 1, 3, 7, 15};
+	unsigned int anWork[] = {0, 100, 2000, 20000};
+	for (unsigned int nWork : anWork) {
+		for (int nThreads : anThreads) {
+			CCountingQueue queue(128);
+			CQueueThreads threads(queue, nThreads);
+			int64_t nStart = GetTimeMicros();
+			for (int i = 0; i < nRounds; i++) {
+				// A block's worth of checks, added per transaction as ConnectBlock does
+				CCheckQueueControl<CCountingCheck> control(&queue);
+				AddChecks(control, 0, nChecks, 2, nWork);
+				REQUIRE(control.Wait());
+			}
+			int64_t nTime = GetTimeMicros() - nStart;
+			printf("work %5u, %2d workers: %8.1f ns per check, %8.1f us per round\n",
+				nWork, nThreads, nTime * 1000.0 / (nChecks * nRounds), (double)nTime / nRounds);
+		}
+	}
+}
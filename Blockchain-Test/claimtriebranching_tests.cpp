@@ -3126,4 +3126,45 @@ TEST_CASE("get_claim_by_id_test_3")
 	REQUIRE(pclaimTrie->getClaimById(claimId2, claimName, claimValue));
 	REQUIRE(claimName == name);
 	REQUIRE(claimValue.claimId == claimId2);
-}
\ No newline at end of file
+}
+
+/*
+	block template
+		a child paying for its parent brings the parent in ahead of a
+		transaction paying more than the parent alone
+*/
+TEST_CASE("block_template_package_test")
+{
+	ClaimTrieChainFixture fixture;
+	// no priority area, so the template goes by fee rate alone
+	mapArgs["-blockprioritysize"] = "0";
+
+	CMutableTransaction parent = BuildTransaction(fixture.GetCoinbase());
+	parent.vout[0].scriptPubKey = CScript() << OP_TRUE;
+	fixture.CommitTx(parent);
+	CMutableTransaction child = BuildTransaction(parent);
+	child.vout[0].scriptPubKey = CScript() << OP_TRUE;
+	fixture.CommitTx(child);
+	CMutableTransaction other = BuildTransaction(fixture.GetCoinbase());
+	other.vout[0].scriptPubKey = CScript() << OP_TRUE;
+	fixture.CommitTx(other);
+
+	// other pays more per byte than parent alone, less than parent and child together
+	mempool.PrioritiseTransaction(child.GetHash(), child.GetHash().ToString(), 0.0, 100000);
+	mempool.PrioritiseTransaction(other.GetHash(), other.GetHash().ToString(), 0.0, 30000);
+
+	auto pblocktemplate = CreateNewBlock(Params(), CScript() << OP_TRUE);
+	REQUIRE(pblocktemplate);
+	const std::vector<CTransaction>& vtx = pblocktemplate->block.vtx;
+	REQUIRE(vtx.size() == 4);
+	REQUIRE(vtx[1].GetHash() == parent.GetHash());
+	REQUIRE(vtx[2].GetHash() == child.GetHash());
+	REQUIRE(vtx[3].GetHash() == other.GetHash());
+	// the deltas only order the template, the fees are the paid ones
+	REQUIRE(pblocktemplate->vTxFees[2] == 0);
+
+	// parents ahead of children, so the block connects
+	fixture.IncrementBlocks(1);
+	REQUIRE(mempool.size() == 0);
+	mapArgs.erase("-blockprioritysize");
+}
@@ -4,6 +4,8 @@
 #include "main.h"
 #include "uint256.h"
 #include "test_ulord.h"
+#include "random.h"
+#include "utiltime.h"
 
 using namespace std;
 
@@ -13,10 +15,9 @@ public:
 	CClaimTrieCacheTest(CClaimTrie* base) :
 		CClaimTrieCache(*base, false) {}
 
-	bool recursiveComputeMerkleHash(CClaimTrieNode* tnCurrent,
-		std::string sPos) const
+	void computeMerkleHash(CClaimTrieNode* tnRoot) const
 	{
-		return CClaimTrieCache::recursiveComputeMerkleHash(tnCurrent, sPos);
+		CClaimTrieCache::computeMerkleHash(tnRoot);
 	}
 
 	bool recursivePruneName(CClaimTrieNode* tnCurrent, unsigned int nPos, std::string sName, bool* pfNullified) const
@@ -61,7 +62,7 @@ TEST_CASE_METHOD(RegTestingSetup, "merkle_hash_single_test")
 
 	// check trie with only root node
 	CClaimTrieNode base_node;
-	cc.recursiveComputeMerkleHash(&base_node, "");
+	cc.computeMerkleHash(&base_node);
 	REQUIRE(one == cc.getMerkleHash());
 }
 
@@ -185,6 +186,43 @@ TEST_CASE_METHOD(RegTestingSetup, "merkle_hash_multiple_test")
 	REQUIRE(pclaimTrie->checkConsistency());
 }
 
+TEST_CASE_METHOD(RegTestingSetup, "read_from_disk_test")
+{
+	uint256 hash0(uint256S("0000000000000000000000000000000000000000000000000000000000000001"));
+	uint160 hash160;
+	const char* names[] = {"test", "test2", "tes", "abab", "testtesttesttest", "a", "b"};
+
+	CClaimTrieCache ntState(*pclaimTrie, false);
+	uint256 prevHash = hash0;
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		CMutableTransaction tx = BuildTransaction(prevHash);
+		prevHash = tx.GetHash();
+		ntState.insertClaimIntoTrie(std::string(names[i]), CClaimValue(COutPoint(prevHash, 0), hash160, 50, 100, 200));
+	}
+	ntState.flush();
+	uint256 merkleHash = pclaimTrie->getMerkleHash();
+	unsigned int nNames = pclaimTrie->getTotalNamesInTrie();
+	REQUIRE(pclaimTrie->WriteToDisk());
+
+	// unchanged since the flush, so the full check may be skipped
+	pclaimTrie->clear();
+	REQUIRE(pclaimTrie->ReadFromDisk(true));
+	REQUIRE(merkleHash == pclaimTrie->getMerkleHash());
+	REQUIRE(nNames == pclaimTrie->getTotalNamesInTrie());
+
+	pclaimTrie->clear();
+	REQUIRE(pclaimTrie->ReadFromDisk(true, true));
+	REQUIRE(merkleHash == pclaimTrie->getMerkleHash());
+	REQUIRE(nNames == pclaimTrie->getTotalNamesInTrie());
+	REQUIRE(pclaimTrie->checkConsistency());
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		CClaimValue claim;
+		REQUIRE(pclaimTrie->getInfoForName(std::string(names[i]), claim));
+	}
+}
+
 TEST_CASE_METHOD(RegTestingSetup, "recursive_prune_test")
 {
 	CClaimTrieCacheTest cc(pclaimTrie.get());
@@ -221,4 +259,108 @@ TEST_CASE_METHOD(RegTestingSetup, "recursive_prune_test")
 	REQUIRE(10 == it->second->nHeightOfLastTakeover);
 	REQUIRE(1 == it->second->claims.size());
 	REQUIRE(0 == it->second->children.size());
-}
\ No newline at end of file
+}
+
+TEST_CASE("claimtrie_children_test")
+{
+	CClaimTrieNode nodes[4];
+	nodeMapType children;
+	REQUIRE(children.empty());
+	REQUIRE(children.find('a') == children.end());
+
+	// a single child stays inline
+	children['m'] = &nodes[0];
+	REQUIRE(1 == children.size());
+	REQUIRE(&nodes[0] == children.find('m')->second);
+
+	// children are kept sorted by character
+	children['z'] = &nodes[1];
+	children['a'] = &nodes[2];
+	children['f'] = &nodes[3];
+	REQUIRE(4 == children.size());
+	std::string order;
+	for (nodeMapType::const_iterator it = children.begin(); it != children.end(); ++it)
+		order.push_back(it->first);
+	REQUIRE("afmz" == order);
+
+	// copies are independent
+	nodeMapType copy(children);
+	children['f'] = &nodes[0];
+	REQUIRE(&nodes[3] == copy.find('f')->second);
+
+	// erase returns the next child, down to the inline slot and to empty
+	nodeMapType::iterator it = children.erase(children.find('f'));
+	REQUIRE('m' == it->first);
+	children.erase(children.find('a'));
+	children.erase(children.find('z'));
+	REQUIRE(1 == children.size());
+	REQUIRE(&nodes[0] == children.begin()->second);
+	REQUIRE(children.erase(children.begin()) == children.end());
+	REQUIRE(children.empty());
+	REQUIRE(4 == copy.size());
+}
+
+static CClaimTrieNode* benchInsertName(CClaimTrieNode* current, const std::string& name)
+{
+	for (std::string::const_iterator itname = name.begin(); itname != name.end(); ++itname)
+	{
+		nodeMapType::iterator itchild = current->children.find(*itname);
+		if (itchild == current->children.end())
+		{
+			CClaimTrieNode* newNode = new CClaimTrieNode();
+			current->children[*itname] = newNode;
+			current = newNode;
+		}
+		else
+			current = itchild->second;
+	}
+	return current;
+}
+
+static void benchDeleteChildren(CClaimTrieNode* current)
+{
+	for (nodeMapType::iterator it = current->children.begin(); it != current->children.end(); ++it)
+	{
+		benchDeleteChildren(it->second);
+		delete it->second;
+	}
+	current->children.clear();
+}
+
+// Run with: unit_test "[bench]"
+TEST_CASE("claimtrie_node_layout_bench", "[.][bench]")
+{
+	const size_t nNames = 2000000;
+	const char* tlds[] = {"com", "org", "net", "io"};
+	seed_insecure_rand(true);
+	std::vector<std::string> names;
+	names.reserve(nNames);
+	for (size_t i = 0; i < nNames; i++)
+		names.push_back(fmt::format("ulord://{}{}.{}/{}/{}", insecure_rand() % 2 ? "video" : "music",
+			insecure_rand() % 50000, tlds[insecure_rand() % 4], insecure_rand() % 1000, insecure_rand() % 100000));
+
+	CClaimTrieNode root;
+	int64_t nStart = GetTimeMicros();
+	for (size_t i = 0; i < nNames; i++)
+		benchInsertName(&root, names[i]);
+	int64_t nInserted = GetTimeMicros();
+
+	size_t nFound = 0;
+	for (size_t i = 0; i < nNames; i++)
+	{
+		const std::string& name = names[(i * 7919) % nNames];
+		const CClaimTrieNode* current = &root;
+		for (std::string::const_iterator itname = name.begin(); current && itname != name.end(); ++itname)
+		{
+			nodeMapType::const_iterator itchild = current->children.find(*itname);
+			current = itchild != current->children.end() ? itchild->second : NULL;
+		}
+		nFound += current != NULL;
+	}
+	int64_t nLookedUp = GetTimeMicros();
+	REQUIRE(nNames == nFound);
+
+	WARN(fmt::format("{} names: insert {} ms, lookup {} ns/name", nNames,
+		(nInserted - nStart) / 1000, (nLookedUp - nInserted) * 1000 / nNames));
+	benchDeleteChildren(&root);
+}
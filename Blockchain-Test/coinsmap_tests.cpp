@@ -0,0 +1,303 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include "coins.h"
+#include "openhashmap.h"
+#include "random.h"
+#include "test_ulord.h"
+#include "txdb.h"
+#include "uint256.h"
+#include "utiltime.h"
+
+#include <map>
+#include <stdio.h>
+
+namespace
+{
+	//! Few distinct hashes, so probe chains and tombstones get exercised
+	struct CCollidingHasher
+	{
+		size_t operator()(int n) const { return n % 7; }
+	};
+
+	typedef COpenHashMap<int, int, CCollidingHasher> CTestMap;
+
+	//! Base view handing out the same coins for any txid
+	class CCoinsViewBench : public CCoinsView
+	{
+		CCoins coins;
+
+	public:
+		CCoinsViewBench()
+		{
+			coins.nVersion = 1;
+			coins.nHeight = 1;
+			coins.vout.resize(2);
+			for (CTxOut& out : coins.vout) {
+				out.nValue = 1000;
+				out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+			}
+		}
+
+		Opt<CCoins> GetCoins(const uint256& txid) const override { return coins; }
+		bool HaveCoins(const uint256& txid) const { return true; }
+		bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+		{
+			mapCoins.clear();
+			return true;
+		}
+	};
+}
+
+TEST_CASE("openhashmap_matches_std_map")
+{
+	CTestMap map;
+	std::map<int, int> ref;
+	seed_insecure_rand(true);
+	for (int i = 0; i < 20000; i++) {
+		int key = insecure_rand() % 500;
+		switch (insecure_rand() % 4) {
+		case 0:
+		case 1: {
+			int value = insecure_rand();
+			std::pair<CTestMap::iterator, bool> ret = map.insert(std::make_pair(key, value));
+			REQUIRE(ret.second == ref.insert(std::make_pair(key, value)).second);
+			REQUIRE(ret.first->second == ref[key]);
+			break;
+		}
+		case 2:
+			REQUIRE(map.erase(key) == ref.erase(key));
+			break;
+		case 3:
+			map[key] += 1;
+			ref[key] += 1;
+			break;
+		}
+		REQUIRE(map.size() == ref.size());
+	}
+
+	for (std::map<int, int>::const_iterator it = ref.begin(); it != ref.end(); ++it) {
+		CTestMap::const_iterator found = static_cast<const CTestMap&>(map).find(it->first);
+		REQUIRE(found != map.end());
+		REQUIRE(found->second == it->second);
+	}
+	size_t nIterated = 0;
+	for (CTestMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+		REQUIRE(ref.count(it->first) == 1);
+		nIterated++;
+	}
+	REQUIRE(nIterated == ref.size());
+}
+
+TEST_CASE("openhashmap_erase_while_iterating")
+{
+	CTestMap map;
+	for (int i = 0; i < 1000; i++)
+		map[i] = i;
+
+	// the pattern the coins views use to drain a map
+	size_t nSeen = 0;
+	for (CTestMap::iterator it = map.begin(); it != map.end(); ) {
+		if (it->first % 3 == 0) {
+			CTestMap::iterator itOld = it++;
+			map.erase(itOld);
+		} else {
+			++it;
+		}
+		nSeen++;
+	}
+	REQUIRE(nSeen == 1000);
+	REQUIRE(map.size() == 666);
+	REQUIRE(map.find(3) == map.end());
+	REQUIRE(map.find(4)->second == 4);
+}
+
+TEST_CASE("openhashmap_entries_do_not_move")
+{
+	CTestMap map;
+	map[1] = 10;
+	int* p = &map.find(1)->second;
+	// grows the slots and the pools many times over
+	for (int i = 2; i < 10000; i++)
+		map[i] = i;
+	REQUIRE(p == &map.find(1)->second);
+	REQUIRE(*p == 10);
+
+	// erased entries are reused before the pools grow
+	size_t nUsage = map.DynamicMemoryUsage();
+	for (int i = 2; i < 1000; i++)
+		map.erase(i);
+	for (int i = 10000; i < 10998; i++)
+		map[i] = i;
+	REQUIRE(map.DynamicMemoryUsage() == nUsage);
+
+	CTestMap copy(map);
+	REQUIRE(copy.size() == map.size());
+	REQUIRE(&copy.find(1)->second != p);
+	REQUIRE(copy.find(1)->second == 10);
+
+	map.clear();
+	REQUIRE(map.empty());
+	REQUIRE(map.DynamicMemoryUsage() == 0);
+	REQUIRE(map.find(1) == map.end());
+}
+
+TEST_CASE("coinsviewcache_add_coins_from_base")
+{
+	CCoinsViewBench base;
+	CCoinsViewCache cache(&base);
+	uint256 txid = uint256S("01");
+	uint256 txidCached = uint256S("02");
+
+	// a cached entry, possibly modified, wins over what was read
+	cache.ModifyCoins(txidCached)->nHeight = 7;
+	Opt<CCoins> coins = base.GetCoins(txidCached);
+	cache.AddCoinsFromBase(txidCached, *coins);
+	REQUIRE(cache.AccessCoins(txidCached)->nHeight == 7);
+
+	coins = base.GetCoins(txid);
+	cache.AddCoinsFromBase(txid, *coins);
+	REQUIRE(cache.HaveCoinsInCache(txid));
+	REQUIRE(cache.AccessCoins(txid)->vout.size() == 2);
+
+	REQUIRE(cache.GetFlushCount() == 0);
+	REQUIRE(cache.Flush());
+	REQUIRE(cache.GetFlushCount() == 1);
+	REQUIRE(!cache.HaveCoinsInCache(txid));
+}
+
+TEST_CASE_METHOD(TestingSetup, "coins_background_flush")
+{
+	CCoinsViewDB db(1 << 20, true);
+	CCoinsViewBackgroundFlush flush(&db);
+	CCoinsViewCache cache(&flush);
+	uint256 txid = uint256S("03");
+	uint256 hashBlock = uint256S("04");
+	{
+		CCoinsModifier coins = cache.ModifyNewCoins(txid);
+		coins->nVersion = 1;
+		coins->nHeight = 5;
+		coins->vout.resize(2);
+		for (CTxOut& out : coins->vout) {
+			out.nValue = 1000;
+			out.scriptPubKey = CScript() << OP_TRUE;
+		}
+	}
+	cache.SetBestBlock(hashBlock);
+	REQUIRE(cache.Flush());
+
+	// answered from the map being written, or from the database once it is there
+	REQUIRE(flush.HaveCoins(txid));
+	REQUIRE(flush.GetBestBlock() == hashBlock);
+	REQUIRE(flush.Sync());
+	REQUIRE(db.GetBestBlock() == hashBlock);
+	Opt<CCoins> coins = db.GetCoins(txid);
+	REQUIRE(coins.is_initialized());
+	REQUIRE(coins->nHeight == 5);
+	REQUIRE(coins->vout.size() == 2);
+	REQUIRE(coins->vout[1].nValue == 1000);
+
+	// spending all outputs erases the coins from the database
+	{
+		CCoinsModifier modify = cache.ModifyCoins(txid);
+		modify->Spend(0);
+		modify->Spend(1);
+	}
+	uint256 hashNext = uint256S("05");
+	cache.SetBestBlock(hashNext);
+	REQUIRE(cache.Flush());
+	REQUIRE(!flush.HaveCoins(txid));
+	REQUIRE(!flush.GetCoins(txid));
+	REQUIRE(flush.Sync());
+	REQUIRE(!db.HaveCoins(txid));
+	REQUIRE(db.GetBestBlock() == hashNext);
+}
+
+TEST_CASE_METHOD(TestingSetup, "coins_background_flush_write_after")
+{
+	CCoinsViewDB db(1 << 20, true);
+	CCoinsViewBackgroundFlush flush(&db);
+	CCoinsViewCache cache(&flush);
+	uint256 hashBlock = uint256S("06");
+	int nWrites = 0;
+	uint256 hashOnDisk;
+	flush.WriteAfterNext([&]() {
+		nWrites++;
+		hashOnDisk = db.GetBestBlock();
+		return true;
+	});
+
+	// nothing runs until a map is handed over
+	REQUIRE(flush.Sync());
+	REQUIRE(nWrites == 0);
+
+	// and then only once the map's best block is committed
+	cache.SetBestBlock(hashBlock);
+	REQUIRE(cache.Flush());
+	REQUIRE(flush.Sync());
+	REQUIRE(nWrites == 1);
+	REQUIRE(hashOnDisk == hashBlock);
+
+	// once only
+	cache.SetBestBlock(uint256S("07"));
+	REQUIRE(cache.Flush());
+	REQUIRE(flush.Sync());
+	REQUIRE(nWrites == 1);
+
+	// a failure is reported like a failed write of the coins
+	flush.WriteAfterNext([]() { return false; });
+	cache.SetBestBlock(uint256S("08"));
+	REQUIRE(cache.Flush());
+	REQUIRE(!flush.Sync());
+}
+
+static uint256 BenchTxid(uint32_t n)
+{
+	uint256 txid;
+	for (int i = 0; i < 8; i++)
+		*(uint32_t*)(txid.begin() + 4 * i) = n * 0x9e3779b9 + i;
+	return txid;
+}
+
+// Run with: unit_test "[bench]"
+TEST_CASE("coinsmap_bench", "[.][bench]")
+{
+	const uint32_t nCoins = 2000000;
+	CCoinsViewBench base;
+	CCoinsViewCache cache(&base);
+
+	int64_t nStart = GetTimeMicros();
+	for (uint32_t i = 0; i < nCoins; i++)
+		cache.AccessCoins(BenchTxid(i));
+	int64_t nAccess = GetTimeMicros() - nStart;
+	size_t nUsage = cache.DynamicMemoryUsage();
+
+	nStart = GetTimeMicros();
+	for (uint32_t i = 0; i < nCoins; i++)
+		cache.AccessCoins(BenchTxid(i));
+	int64_t nHit = GetTimeMicros() - nStart;
+
+	nStart = GetTimeMicros();
+	for (uint32_t i = 0; i < nCoins; i++) {
+		CCoinsModifier coins = cache.ModifyCoins(BenchTxid(i));
+		coins->Spend(0);
+	}
+	int64_t nModify = GetTimeMicros() - nStart;
+
+	// A child layer as ConnectBlock uses, written into the big cache
+	CCoinsViewCache child(&cache);
+	for (uint32_t i = nCoins; i < nCoins + nCoins / 10; i++) {
+		CCoinsModifier coins = child.ModifyNewCoins(BenchTxid(i));
+		coins->vout.resize(1);
+		coins->vout[0].nValue = 1000;
+	}
+	nStart = GetTimeMicros();
+	child.Flush();
+	int64_t nBatchWrite = GetTimeMicros() - nStart;
+
+	printf("%u coins, %.1f MB (%.1f bytes/coin)\n", nCoins, nUsage / 1e6, (double)nUsage / nCoins);
+	printf("AccessCoins miss %.0f ns, hit %.0f ns, ModifyCoins %.0f ns, BatchWrite %.0f ns per coin\n",
+		nAccess * 1000.0 / nCoins, nHit * 1000.0 / nCoins, nModify * 1000.0 / nCoins, nBatchWrite * 10000.0 / nCoins);
+	REQUIRE(cache.GetCacheSize() == nCoins + nCoins / 10);
+}
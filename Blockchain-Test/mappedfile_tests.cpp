@@ -0,0 +1,57 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include <boost/filesystem.hpp>
+#include <stdio.h>
+
+#include "mappedfile.h"
+#include "streams.h"
+
+#ifndef WIN32
+TEST_CASE("mappedfile_grow")
+{
+	boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+	std::string strPath = path.string();
+
+	CDataStream ss(SER_DISK, 0);
+	ss << (uint32_t)0x01020304 << std::string("block");
+	FILE* file = fopen(strPath.c_str(), "wb");
+	REQUIRE(file);
+	fwrite(&ss[0], 1, ss.size(), file);
+	fflush(file);
+
+	CMappedFileCache cache(1);
+	REQUIRE(!cache.Get(strPath, ss.size() + 1));
+	CMappedFileRef mapped = cache.Get(strPath, ss.size());
+	REQUIRE(mapped);
+	REQUIRE(mapped->size == ss.size());
+
+	// deserialize in place
+	uint32_t n;
+	std::string str;
+	CSpanReader spanin(mapped->data, mapped->data + mapped->size, SER_DISK, 0);
+	spanin >> n >> str;
+	REQUIRE(n == 0x01020304);
+	REQUIRE(str == "block");
+	REQUIRE(spanin.empty());
+	REQUIRE_THROWS_AS(spanin >> n, std::ios_base::failure);
+
+	// a short mapping is replaced once the file grew
+	fwrite(&ss[0], 1, ss.size(), file);
+	fclose(file);
+	REQUIRE(cache.Get(strPath, ss.size()) == mapped);
+	CMappedFileRef grown = cache.Get(strPath, 2 * ss.size());
+	REQUIRE(grown);
+	REQUIRE(grown != mapped);
+	REQUIRE(grown->size == 2 * ss.size());
+	REQUIRE(memcmp(grown->data, grown->data + ss.size(), ss.size()) == 0);
+
+	// dropped mappings stay valid for their holders
+	cache.Erase(strPath);
+	REQUIRE(memcmp(mapped->data, grown->data, mapped->size) == 0);
+	boost::filesystem::remove(path);
+	REQUIRE(memcmp(mapped->data, grown->data, mapped->size) == 0);
+	REQUIRE(!cache.Get(strPath, 0));
+}
+#endif
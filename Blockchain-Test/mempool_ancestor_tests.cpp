@@ -0,0 +1,79 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include "txmempool.h"
+#include "test_ulord.h"
+
+#include <string>
+#include <vector>
+
+namespace
+{
+	template<int index>
+	void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder)
+	{
+		REQUIRE(pool.size() == sortedOrder.size());
+		typename CTxMemPool::indexed_transaction_set::nth_index<index>::type::iterator it = pool.mapTx.get<index>().begin();
+		int count = 0;
+		for (; it != pool.mapTx.get<index>().end(); ++it, ++count) {
+			REQUIRE(it->GetTx().GetHash().ToString() == sortedOrder[count]);
+		}
+	}
+}
+
+TEST_CASE("MempoolAncestorIndexingTest")
+{
+	CTxMemPool pool(CFeeRate(0));
+	TestMemPoolEntryHelper entry;
+
+	/* no fee, but paid for by its child */
+	CMutableTransaction tx1 = CMutableTransaction();
+	tx1.vout.resize(1);
+	tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+	tx1.vout[0].nValue = 10 * COIN;
+	pool.addUnchecked(tx1.GetHash(), entry.Fee(0LL).FromTx(tx1));
+
+	CMutableTransaction tx2 = CMutableTransaction();
+	tx2.vin.resize(1);
+	tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+	tx2.vin[0].scriptSig = CScript() << OP_11;
+	tx2.vout.resize(1);
+	tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+	tx2.vout[0].nValue = 9 * COIN;
+	pool.addUnchecked(tx2.GetHash(), entry.Fee(40000LL).FromTx(tx2));
+
+	/* unrelated, paying less per byte than the package */
+	CMutableTransaction tx3 = CMutableTransaction();
+	tx3.vout.resize(1);
+	tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+	tx3.vout[0].nValue = 5 * COIN;
+	pool.addUnchecked(tx3.GetHash(), entry.Fee(5000LL).FromTx(tx3));
+
+	CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHash());
+	REQUIRE(it2->GetCountWithAncestors() == 2);
+	REQUIRE(it2->GetSizeWithAncestors() == pool.mapTx.find(tx1.GetHash())->GetTxSize() + it2->GetTxSize());
+	REQUIRE(it2->GetModFeesWithAncestors() == 40000);
+	REQUIRE(it2->GetSigOpCountWithAncestors() == 2);
+
+	std::vector<std::string> sortedOrder;
+	sortedOrder.push_back(tx2.GetHash().ToString());
+	sortedOrder.push_back(tx3.GetHash().ToString());
+	sortedOrder.push_back(tx1.GetHash().ToString());
+	CheckSort<4>(pool, sortedOrder);
+
+	// A fee delta on the parent reaches the child's ancestor state
+	pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0.0, 10000LL);
+	REQUIRE(pool.mapTx.find(tx2.GetHash())->GetModFeesWithAncestors() == 50000);
+
+	// Confirming the parent leaves the child on its own
+	pool.remove(tx1, false);
+	it2 = pool.mapTx.find(tx2.GetHash());
+	REQUIRE(pool.size() == 2);
+	REQUIRE(it2->GetCountWithAncestors() == 1);
+	REQUIRE(it2->GetSizeWithAncestors() == it2->GetTxSize());
+	REQUIRE(it2->GetModFeesWithAncestors() == 40000);
+	REQUIRE(it2->GetSigOpCountWithAncestors() == 1);
+	sortedOrder.pop_back();
+	CheckSort<4>(pool, sortedOrder);
+}
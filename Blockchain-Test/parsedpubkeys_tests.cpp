@@ -0,0 +1,240 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include "hash.h"
+#include "key.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "pubkey.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "script/standard.h"
+#include "test_ulord.h"
+#include "utiltime.h"
+
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+	//! Stands in for a signature, the keys are all ParseRepeatedPubKeys looks at
+	const std::vector<unsigned char> vchSig(72, 0x30);
+
+	//! A non-coinbase transaction whose only input has scriptSig
+	CTransaction SpendWith(const CScript& scriptSig)
+	{
+		static uint32_t nSpent = 0;
+		CMutableTransaction tx;
+		tx.vin.resize(1);
+		tx.vin[0].prevout = COutPoint(Hash(&nSpent, &nSpent + 1), nSpent);
+		nSpent++;
+		tx.vin[0].scriptSig = scriptSig;
+		tx.vout.resize(1);
+		tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+		tx.vout[0].nValue = 1;
+		return tx;
+	}
+
+	//! A block with a coinbase and a transaction per scriptSig
+	CBlock BlockSpending(const std::vector<CScript>& vScriptSigs)
+	{
+		CBlock block;
+		CMutableTransaction coinbase;
+		coinbase.vin.resize(1);
+		coinbase.vin[0].prevout.SetNull();
+		coinbase.vout.resize(1);
+		block.vtx.push_back(coinbase);
+		for (const CScript& scriptSig : vScriptSigs)
+			block.vtx.push_back(SpendWith(scriptSig));
+		return block;
+	}
+
+	CPubKey NewPubKey(bool fCompressed)
+	{
+		CKey key;
+		key.MakeNewKey(fCompressed);
+		return key.GetPubKey();
+	}
+}
+
+TEST_CASE_METHOD(BasicTestingSetup, "parsed_pubkeys")
+{
+	CKey key1, key1C, key2C;
+	key1.MakeNewKey(false);
+	key1C.MakeNewKey(true);
+	key2C.MakeNewKey(true);
+	CPubKey pubkey1 = key1.GetPubKey();
+	CPubKey pubkey1C = key1C.GetPubKey();
+	CPubKey pubkey2C = key2C.GetPubKey();
+
+	CParsedPubKeys parsedKeys;
+	REQUIRE(parsedKeys.Add(pubkey1));
+	REQUIRE(parsedKeys.Add(pubkey1C));
+	REQUIRE(parsedKeys.Add(pubkey1C));
+	REQUIRE(!parsedKeys.Add(CPubKey()));
+	REQUIRE(parsedKeys.size() == 2);
+
+	// an uncompressed-length key that isn't on the curve
+	std::vector<unsigned char> vchBad(65, 0x01);
+	vchBad[0] = 0x04;
+	REQUIRE(!parsedKeys.Add(CPubKey(vchBad)));
+
+	for (int n = 0; n < 16; n++) {
+		uint256 hashMsg = Hash(&n, &n + 1);
+		std::vector<unsigned char> sign1, sign1C, sign2C;
+		REQUIRE(key1.Sign(hashMsg, sign1));
+		REQUIRE(key1C.Sign(hashMsg, sign1C));
+		REQUIRE(key2C.Sign(hashMsg, sign2C));
+
+		// parsed keys and keys parsed on the spot give the same answers
+		REQUIRE(parsedKeys.Verify(pubkey1, hashMsg, sign1));
+		REQUIRE(parsedKeys.Verify(pubkey1C, hashMsg, sign1C));
+		REQUIRE(parsedKeys.Verify(pubkey2C, hashMsg, sign2C));
+		REQUIRE(!parsedKeys.Verify(pubkey1, hashMsg, sign1C));
+		REQUIRE(!parsedKeys.Verify(pubkey1C, hashMsg, sign2C));
+		REQUIRE(!parsedKeys.Verify(pubkey1C, hashMsg, std::vector<unsigned char>()));
+		REQUIRE(!parsedKeys.Verify(pubkey2C, hashMsg, sign1C));
+	}
+}
+
+TEST_CASE_METHOD(BasicTestingSetup, "parse_repeated_pubkeys_p2pkh")
+{
+	CPubKey pubkey1 = NewPubKey(false);
+	CPubKey pubkey1C = NewPubKey(true);
+	CPubKey pubkey2C = NewPubKey(true);
+
+	// pubkey1 and pubkey1C sign twice, pubkey2C once
+	std::vector<CScript> vScriptSigs;
+	vScriptSigs.push_back(CScript() << vchSig << ToByteVector(pubkey1C));
+	vScriptSigs.push_back(CScript() << vchSig << ToByteVector(pubkey1));
+	vScriptSigs.push_back(CScript() << vchSig << ToByteVector(pubkey2C));
+	vScriptSigs.push_back(CScript() << vchSig << ToByteVector(pubkey1C));
+	vScriptSigs.push_back(CScript() << vchSig << ToByteVector(pubkey1));
+	CBlock block = BlockSpending(vScriptSigs);
+
+	CParsedPubKeys parsedKeys;
+	ParseRepeatedPubKeys(block, parsedKeys);
+	REQUIRE(parsedKeys.size() == 2);
+
+	// the coinbase's scriptSig is not an input's, whatever it pushes
+	CMutableTransaction coinbase(block.vtx[0]);
+	coinbase.vin[0].scriptSig = CScript() << ToByteVector(pubkey2C) << ToByteVector(pubkey2C);
+	block.vtx[0] = coinbase;
+	CParsedPubKeys parsedKeysCoinbase;
+	ParseRepeatedPubKeys(block, parsedKeysCoinbase);
+	REQUIRE(parsedKeysCoinbase.size() == 2);
+
+	// one input alone never repeats a key
+	vScriptSigs.resize(3);
+	CParsedPubKeys parsedKeysOnce;
+	ParseRepeatedPubKeys(BlockSpending(vScriptSigs), parsedKeysOnce);
+	REQUIRE(parsedKeysOnce.size() == 0);
+}
+
+TEST_CASE_METHOD(BasicTestingSetup, "parse_repeated_pubkeys_p2sh_multisig")
+{
+	CPubKey pubkeyA = NewPubKey(true), pubkeyB = NewPubKey(true), pubkeyC = NewPubKey(false);
+	CPubKey pubkeyD = NewPubKey(true);
+	CScript redeemScript = CScript() << OP_2 << ToByteVector(pubkeyA) << ToByteVector(pubkeyB) << ToByteVector(pubkeyC) << OP_3 << OP_CHECKMULTISIG;
+	CScript redeemScriptOnce = CScript() << OP_1 << ToByteVector(pubkeyD) << OP_1 << OP_CHECKMULTISIG;
+
+	// the keys sit in the redeem script, the last push of the scriptSig
+	std::vector<CScript> vScriptSigs;
+	vScriptSigs.push_back(CScript() << OP_0 << vchSig << vchSig << ToByteVector(redeemScript));
+	vScriptSigs.push_back(CScript() << OP_0 << vchSig << vchSig << ToByteVector(redeemScript));
+	vScriptSigs.push_back(CScript() << OP_0 << vchSig << ToByteVector(redeemScriptOnce));
+	CParsedPubKeys parsedKeys;
+	ParseRepeatedPubKeys(BlockSpending(vScriptSigs), parsedKeys);
+	REQUIRE(parsedKeys.size() == 3);
+
+	// a key spent by pay-to-pubkey-hash and named in a redeem script counts twice
+	vScriptSigs.push_back(CScript() << vchSig << ToByteVector(pubkeyD));
+	CParsedPubKeys parsedKeysMixed;
+	ParseRepeatedPubKeys(BlockSpending(vScriptSigs), parsedKeysMixed);
+	REQUIRE(parsedKeysMixed.size() == 4);
+}
+
+TEST_CASE_METHOD(BasicTestingSetup, "parse_repeated_pubkeys_non_push_last_op")
+{
+	CPubKey pubkeyA = NewPubKey(true), pubkeyB = NewPubKey(true);
+	CScript redeemScript = CScript() << OP_1 << ToByteVector(pubkeyA) << ToByteVector(pubkeyB) << OP_2 << OP_CHECKMULTISIG;
+
+	// Ending in an opcode, the scriptSig has no redeem script to look into
+	std::vector<CScript> vScriptSigs;
+	vScriptSigs.push_back(CScript() << OP_0 << vchSig << ToByteVector(redeemScript) << OP_NOP);
+	vScriptSigs.push_back(CScript() << OP_0 << vchSig << ToByteVector(redeemScript) << OP_NOP);
+	CParsedPubKeys parsedKeys;
+	ParseRepeatedPubKeys(BlockSpending(vScriptSigs), parsedKeys);
+	REQUIRE(parsedKeys.size() == 0);
+
+	// and a key pushed before the opcode is still a pushed key
+	vScriptSigs.clear();
+	vScriptSigs.push_back(CScript() << vchSig << ToByteVector(pubkeyA) << OP_NOP);
+	vScriptSigs.push_back(CScript() << vchSig << ToByteVector(pubkeyA) << OP_NOP);
+	CParsedPubKeys parsedKeysPushed;
+	ParseRepeatedPubKeys(BlockSpending(vScriptSigs), parsedKeysPushed);
+	REQUIRE(parsedKeysPushed.size() == 1);
+}
+
+// Run with: unit_test "[bench]"
+TEST_CASE_METHOD(BasicTestingSetup, "parse_repeated_pubkeys_bench", "[.][bench]")
+{
+	// A block of pay-to-pubkey-hash spends, each key signing several of them.
+	// Only the script checks are timed, the outputs spent are not tracked.
+	const int nKeys = 200, nSpendsPerKey = 10;
+	CCoins coins;
+	coins.nVersion = 1;
+	coins.nHeight = 1;
+	coins.vout.resize(nKeys);
+	std::vector<CKey> vKeys(nKeys);
+	for (int k = 0; k < nKeys; k++) {
+		vKeys[k].MakeNewKey(true);
+		coins.vout[k].nValue = 1000;
+		coins.vout[k].scriptPubKey = GetScriptForDestination(vKeys[k].GetPubKey().GetID());
+	}
+	uint256 hashFrom = Hash(&nKeys, &nKeys + 1);
+
+	CBlock block = BlockSpending(std::vector<CScript>());
+	for (int n = 0; n < nSpendsPerKey; n++) {
+		for (int k = 0; k < nKeys; k++) {
+			CMutableTransaction tx;
+			tx.vin.resize(1);
+			tx.vin[0].prevout = COutPoint(hashFrom, k);
+			tx.vout.resize(1);
+			tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+			tx.vout[0].nValue = n + 1;
+			std::vector<unsigned char> vchSig;
+			uint256 hash = SignatureHash(coins.vout[k].scriptPubKey, tx, 0, SIGHASH_ALL);
+			REQUIRE(vKeys[k].Sign(hash, vchSig));
+			vchSig.push_back((unsigned char)SIGHASH_ALL);
+			tx.vin[0].scriptSig = CScript() << vchSig << ToByteVector(vKeys[k].GetPubKey());
+			block.vtx.push_back(tx);
+		}
+	}
+
+	// While syncing nothing is cached; at the tip each transaction was
+	// cached when it entered the mempool, and the block's check uses it up
+	for (int fTip = 0; fTip < 2; fTip++) {
+		for (int fParse = 0; fParse < 2; fParse++) {
+			if (fTip) {
+				for (size_t i = 1; i < block.vtx.size(); i++)
+					CScriptCheck(coins, block.vtx[i], 0, MANDATORY_SCRIPT_VERIFY_FLAGS, true).Verify();
+			}
+			bool fValid = true;
+			int64_t nStart = GetTimeMicros();
+			CParsedPubKeys parsedKeys;
+			if (fParse)
+				ParseRepeatedPubKeys(block, parsedKeys);
+			for (size_t i = 1; i < block.vtx.size(); i++) {
+				CScriptCheck check(coins, block.vtx[i], 0, MANDATORY_SCRIPT_VERIFY_FLAGS, false, fParse ? &parsedKeys : NULL);
+				fValid &= check.Verify() == SCRIPT_ERR_OK;
+			}
+			int64_t nTime = GetTimeMicros() - nStart;
+			printf("%-8s %-28s %8.2f ms per block (%u inputs)\n", fTip ? "tip" : "syncing",
+				fParse ? "repeated keys parsed first" : "keys parsed by each check", nTime * 0.001, (unsigned int)block.vtx.size() - 1);
+			REQUIRE(fValid);
+			REQUIRE(parsedKeys.size() == (fParse ? (size_t)nKeys : 0));
+		}
+	}
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include <limits>
+#include <string.h>
+
+#include "hello/common.h"
+#include "hello/oneWayFunction.h"
+#include "hello/PoW.h"
+#include "hello/powKernels.h"
+#include "random.h"
+#include "utilstrencodings.h"
+
+/* Every kernel set the CPU supports must match the byte-wise reference */
+TEST_CASE("pow_kernels_conformance")
+{
+	initOneWayFunction();
+	const PowKernels *ref = getPowKernels(POW_KERNELS_REFERENCE);
+	REQUIRE(ref != NULL);
+
+	for (int id = 0; id < POW_KERNELS_NUM; ++id) {
+		const PowKernels *kernels = getPowKernels(id);
+		if (!kernels)
+			continue;
+		INFO(kernels->name);
+
+		for (int round = 0; round < 32; ++round) {
+			uint8_t input[32], src[32], expected[32], actual[32];
+			GetRandBytes(input, sizeof(input));
+			GetRandBytes(src, sizeof(src));
+
+			for (uint32_t bits = 0; bits < 256; ++bits) {
+				ref->rrs32(input, expected, bits);
+				kernels->rrs32(input, actual, bits);
+				REQUIRE(memcmp(expected, actual, 32) == 0);
+			}
+
+			memcpy(expected, input, 32);
+			memcpy(actual, input, 32);
+			ref->xor32(expected, src);
+			kernels->xor32(actual, src);
+			REQUIRE(memcmp(expected, actual, 32) == 0);
+
+			struct my_rand48_data refRand[4], rand[4];
+			for (int j = 0; j < 4; ++j) {
+				uint64_t seed = GetRand(std::numeric_limits<uint64_t>::max());
+				my_seed48_r(seed, &refRand[j]);
+				my_seed48_r(seed, &rand[j]);
+			}
+			for (int n = 0; n < 8; ++n) {
+				ref->rand64x4(refRand, expected);
+				kernels->rand64x4(rand, actual);
+				REQUIRE(memcmp(expected, actual, 32) == 0);
+			}
+		}
+	}
+}
+
+TEST_CASE("pow_fold_matches_reduce_bit")
+{
+	for (int round = 0; round < 64; ++round) {
+		uint8_t input[32], expected;
+		GetRandBytes(input, sizeof(input));
+
+		reduce_bit(input, 32, &expected, 8);
+		REQUIRE(fold_32bytes(input) == expected);
+
+		uint64_t word;
+		memcpy(&word, input, 8);
+		reduce_bit(input, 8, &expected, 8);
+		REQUIRE(fold_u64(word) == expected);
+	}
+}
+
+/* The fixed 32-byte one-way function entries must match the generic ones */
+TEST_CASE("one_way_function_fixed_length")
+{
+	initOneWayFunction();
+	for (int round = 0; round < 64; ++round) {
+		uint8_t input[32], expected[OUTPUT_LEN], actual[OUTPUT_LEN];
+		GetRandBytes(input, sizeof(input));
+
+		for (int i = 0; i < FUNCTION_NUM; ++i) {
+			INFO(funcInfor[i].funcName);
+			funcInfor[i].func(input, 32, expected);
+			funcInfor[i].func32(input, 32, actual);
+			REQUIRE(memcmp(expected, actual, OUTPUT_LEN) == 0);
+		}
+	}
+}
+
+/* helloHash under each kernel set, against output of the pre-kernel code */
+TEST_CASE("pow_kernels_hello_hash")
+{
+	initOneWayFunction();
+	const PowKernels *selected = powKernels;
+
+	uint8_t header[INPUT_LEN], output[OUTPUT_LEN];
+	for (int i = 0; i < INPUT_LEN; ++i)
+		header[i] = (uint8_t)(i * 7 + 3);
+
+	for (int id = 0; id < POW_KERNELS_NUM; ++id) {
+		if (!selectPowKernels(id))
+			continue;
+		INFO(powKernels->name);
+
+		header[0] = 3;
+		helloHash(header, INPUT_LEN, output);
+		REQUIRE(HexStr(output, output + OUTPUT_LEN) == "d10ba0681d6a0c958c7bed80c092f85be95427c33a8ea7cd6c4f8013f095a544");
+
+		header[0] = 2;
+		helloHash(header, INPUT_LEN, output);
+		REQUIRE(HexStr(output, output + OUTPUT_LEN) == "ee30702b9e60a4ca4092566ef980857ffe2ad6ddfb0a0e76b672c7a416b6993b");
+	}
+
+	powKernels = selected;
+}
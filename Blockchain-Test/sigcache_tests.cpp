@@ -0,0 +1,135 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+
+#include <catch2/catch.hpp>
+
+#include "script/sigcache.h"
+#include "random.h"
+#include "uint256.h"
+#include "utiltime.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+namespace
+{
+	//! Entries are salted hashes, so random ones are what the cache sees
+	std::vector<uint256> RandomEntries(size_t nCount)
+	{
+		std::vector<uint256> vEntries(nCount);
+		for (uint256& entry : vEntries)
+			for (int i = 0; i < 8; i++)
+				*(uint32_t*)(entry.begin() + 4 * i) = insecure_rand();
+		return vEntries;
+	}
+
+	void LookUp(CSignatureCache* pcache, const std::vector<uint256>* pvEntries, int nThread, int nThreads, size_t* pnFound)
+	{
+		size_t nFound = 0;
+		for (size_t i = nThread; i < pvEntries->size(); i += nThreads) {
+			if (pcache->Get((*pvEntries)[i]))
+				nFound++;
+			else
+				pcache->Set((*pvEntries)[i]);
+		}
+		*pnFound = nFound;
+	}
+}
+
+TEST_CASE("sigcache_get_set_erase")
+{
+	seed_insecure_rand(true);
+	CSignatureCache cache;
+	std::vector<uint256> vEntries = RandomEntries(1000);
+
+	// not initialized, or sized to nothing: caches nothing
+	cache.Set(vEntries[0]);
+	REQUIRE(!cache.Get(vEntries[0]));
+
+	cache.Init(1 << 20);
+	REQUIRE(cache.GetStats().nBytes <= (1 << 20));
+	for (const uint256& entry : vEntries)
+		REQUIRE(!cache.Get(entry));
+	for (const uint256& entry : vEntries)
+		cache.Set(entry);
+	for (const uint256& entry : vEntries)
+		REQUIRE(cache.Get(entry));
+
+	cache.Erase(vEntries[7]);
+	REQUIRE(!cache.Get(vEntries[7]));
+	REQUIRE(cache.Get(vEntries[8]));
+
+	// setting an entry twice keeps one copy
+	cache.Set(vEntries[8]);
+	cache.Erase(vEntries[8]);
+	REQUIRE(!cache.Get(vEntries[8]));
+
+	CSignatureCacheStats stats = cache.GetStats();
+	REQUIRE(stats.nInserts == 1000);
+	REQUIRE(stats.nHits == 1001);
+	REQUIRE(stats.nMisses == 1002);
+	REQUIRE(stats.nEvictions == 0);
+
+	// a new nonce and table
+	cache.Init(1 << 20);
+	REQUIRE(!cache.Get(vEntries[0]));
+}
+
+TEST_CASE("sigcache_stays_within_its_size")
+{
+	seed_insecure_rand(true);
+	CSignatureCache cache;
+	cache.Init(64 << 10);
+	size_t nBytes = cache.GetStats().nBytes;
+	REQUIRE(nBytes <= (64 << 10));
+
+	std::vector<uint256> vEntries = RandomEntries(100000);
+	for (const uint256& entry : vEntries)
+		cache.Set(entry);
+	REQUIRE(cache.GetStats().nBytes == nBytes);
+
+	// The most recent entries are mostly still there, the oldest mostly gone
+	size_t nNew = 0, nOld = 0;
+	for (size_t i = 0; i < 1000; i++) {
+		nOld += cache.Get(vEntries[i]);
+		nNew += cache.Get(vEntries[vEntries.size() - 1 - i]);
+	}
+	REQUIRE(nNew > 800);
+	REQUIRE(nOld < 100);
+	CSignatureCacheStats stats = cache.GetStats();
+	REQUIRE(stats.nEvictions > 0);
+	REQUIRE(stats.nInserts == 100000);
+}
+
+// Run with: unit_test "[bench]"
+TEST_CASE("sigcache_bench", "[.][bench]")
+{
+	seed_insecure_rand(true);
+	// What a block's worth of checks does to a default sized cache: the
+	// second pass hits what the first (the mempool) inserted
+	std::vector<uint256> vEntries = RandomEntries(2000000);
+	int anThreads[] = {1, 2, 4, 8, 16};
+	for (int nThreads : anThreads) {
+		CSignatureCache cache;
+		cache.Init((size_t)DEFAULT_MAX_SIG_CACHE_SIZE << 20);
+		for (int nPass = 0; nPass < 2; nPass++) {
+			boost::thread_group threadGroup;
+			std::vector<size_t> vFound(nThreads);
+			int64_t nStart = GetTimeMicros();
+			for (int i = 0; i < nThreads; i++)
+				threadGroup.create_thread(boost::bind(&LookUp, &cache, &vEntries, i, nThreads, &vFound[i]));
+			threadGroup.join_all();
+			int64_t nTime = GetTimeMicros() - nStart;
+			size_t nFound = 0;
+			for (size_t n : vFound)
+				nFound += n;
+			printf("%2d threads, pass %d: %6.1f ns per entry, %.1f%% found\n",
+				nThreads, nPass, nTime * 1000.0 / vEntries.size(), nFound * 100.0 / vEntries.size());
+		}
+		CSignatureCacheStats stats = cache.GetStats();
+		printf("  %.1f MB, %lu hits, %lu misses, %lu evictions, %lu contended\n", stats.nBytes / 1e6,
+			(unsigned long)stats.nHits, (unsigned long)stats.nMisses, (unsigned long)stats.nEvictions, (unsigned long)stats.nContended);
+	}
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+CBlockPayloadCache::CBlockPayloadCache(size_t nMaxBytesIn)
+    : nMaxBytes(nMaxBytesIn), nBytes(0), nHits(0), nMisses(0)
+{
+}
+
+void CBlockPayloadCache::Prune()
+{
+    while (nBytes > nMaxBytes && !listItems.empty()) {
+        nBytes -= listItems.back().second->vch.size();
+        mapIndex.erase(listItems.back().first);
+        listItems.pop_back();
+    }
+}
+
+void CBlockPayloadCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+    Prune();
+}
+
+CSharedPayloadRef CBlockPayloadCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, list_t::iterator>::iterator it = mapIndex.find(hash);
+    if (it == mapIndex.end()) {
+        nMisses++;
+        return CSharedPayloadRef();
+    }
+    nHits++;
+    listItems.splice(listItems.begin(), listItems, it->second);
+    return it->second->second;
+}
+
+void CBlockPayloadCache::Insert(const uint256& hash, const CSharedPayloadRef& payload)
+{
+    LOCK(cs);
+    // A block larger than the whole cache would only evict everything else
+    if (payload->vch.size() > nMaxBytes || mapIndex.count(hash))
+        return;
+    listItems.push_front(std::make_pair(hash, payload));
+    mapIndex[hash] = listItems.begin();
+    nBytes += payload->vch.size();
+    Prune();
+}
+
+void CBlockPayloadCache::Clear()
+{
+    LOCK(cs);
+    mapIndex.clear();
+    listItems.clear();
+    nBytes = 0;
+}
+
+size_t CBlockPayloadCache::GetBytes() const
+{
+    LOCK(cs);
+    return nBytes;
+}
+
+size_t CBlockPayloadCache::GetCount() const
+{
+    LOCK(cs);
+    return listItems.size();
+}
+
+uint64_t CBlockPayloadCache::GetHits() const
+{
+    LOCK(cs);
+    return nHits;
+}
+
+uint64_t CBlockPayloadCache::GetMisses() const
+{
+    LOCK(cs);
+    return nMisses;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+
+/** -blockservecache default, in MiB */
+static const unsigned int DEFAULT_BLOCK_SERVE_CACHE = 32;
+
+/**
+ * Serialized blocks recently sent to peers, as they are read from the block
+ * files. When a new block propagates every peer asks for the same few blocks,
+ * which are then queued for all of them from one buffer.
+ *
+ * Once the blocks take more than the byte limit, the least recently used are
+ * dropped. Peers still sending a dropped block keep its buffer alive.
+ */
+class CBlockPayloadCache
+{
+private:
+    typedef std::list<std::pair<uint256, CSharedPayloadRef> > list_t;
+
+    //! Most recently used first
+    list_t listItems;
+
+    std::map<uint256, list_t::iterator> mapIndex;
+
+    size_t nMaxBytes;
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    mutable CCriticalSection cs;
+
+    void Prune();
+
+public:
+    explicit CBlockPayloadCache(size_t nMaxBytesIn);
+
+    void SetMaxBytes(size_t nMaxBytesIn);
+
+    //! The cached block, counted as a hit, or NULL, counted as a miss
+    CSharedPayloadRef Get(const uint256& hash);
+
+    void Insert(const uint256& hash, const CSharedPayloadRef& payload);
+
+    void Clear();
+
+    size_t GetBytes() const;
+    size_t GetCount() const;
+    uint64_t GetHits() const;
+    uint64_t GetMisses() const;
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
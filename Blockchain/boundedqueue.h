@@ -0,0 +1,85 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BOUNDEDQUEUE_H
+#define BITCOIN_BOUNDEDQUEUE_H
+
+#include <deque>
+#include <stddef.h>
+#include <utility>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * FIFO handing items from one thread to the next stage of a pipeline.
+ *
+ * Push() blocks while nMaxSize items are queued, so a fast producer cannot
+ * run ahead of its consumer by more than that. Close() ends the stream:
+ * producers stop, and consumers drain what is left. Both waits are boost
+ * interruption points.
+ */
+template <typename T>
+class CBoundedQueue
+{
+private:
+    boost::mutex mutex;
+
+    //! Producers block on this while the queue is full
+    boost::condition_variable condPush;
+
+    //! Consumers block on this while the queue is empty
+    boost::condition_variable condPop;
+
+    std::deque<T> queue;
+    size_t nMaxSize;
+    bool fClosed;
+
+public:
+    explicit CBoundedQueue(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn), fClosed(false) {}
+
+    //! Queue item, waiting for room; false (and item untouched) once closed
+    bool Push(T& item)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fClosed && queue.size() >= nMaxSize)
+            condPush.wait(lock);
+        if (fClosed)
+            return false;
+        queue.push_back(std::move(item));
+        condPop.notify_one();
+        return true;
+    }
+
+    //! Take the oldest item, waiting for one; false once closed and drained
+    bool Pop(T& item)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fClosed && queue.empty())
+            condPop.wait(lock);
+        if (queue.empty())
+            return false;
+        item = std::move(queue.front());
+        queue.pop_front();
+        condPush.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fClosed = true;
+        condPush.notify_all();
+        condPop.notify_all();
+    }
+
+    size_t Size()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return queue.size();
+    }
+};
+
+#endif // BITCOIN_BOUNDEDQUEUE_H
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chain.h"
+#include "hash.h"
 
 using namespace std;
 
@@ -110,3 +111,10 @@ void CBlockIndex::BuildSkip()
     if (pprev)
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
+
+uint256 CDiskBlockIndex::GetPowChecksum() const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << nVersion << hashPrev << hashMerkleRoot << hashClaimTrie << nTime << nBits << nNonce << hash;
+    return ss.GetHash();
+}
@@ -93,6 +93,8 @@ enum BlockStatus {
     BLOCK_FAILED_VALID       =   32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, //! descends from failed block
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    BLOCK_OPT_POWCHECKSUM    =  128, //! (disk only) index record carries hashPowChecksum
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -266,15 +268,21 @@ class CDiskBlockIndex : public CBlockIndex
 public:
     uint256 hash;
     uint256 hashPrev;
+    //! cheap double-SHA256 over the header fields and hash, lets a restart trust
+    //! the stored PoW hash without running CryptoHello again
+    uint256 hashPowChecksum;
 
     CDiskBlockIndex() {
         hash = uint256();
         hashPrev = uint256();
+        hashPowChecksum = uint256();
     }
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hash = (hash == uint256() ? pindex->GetBlockHash() : hash);
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        nStatus |= BLOCK_OPT_POWCHECKSUM;
+        hashPowChecksum = GetPowChecksum();
     }
 
     ADD_SERIALIZE_METHODS;
@@ -304,12 +312,30 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+        // records written before the checksum existed simply lack it
+        if (nStatus & BLOCK_OPT_POWCHECKSUM)
+            READWRITE(hashPowChecksum);
     }
 
     uint256 GetBlockHash() const
     {
         if(hash != uint256()) return hash;
         // should never really get here, keeping this as a fallback
+        return ComputeBlockHash();
+    }
+
+    //! Checksum of the stored header and hash (see hashPowChecksum)
+    uint256 GetPowChecksum() const;
+
+    //! Whether the stored hash can be trusted without recomputing the PoW
+    bool HasValidPowChecksum() const
+    {
+        return (nStatus & BLOCK_OPT_POWCHECKSUM) && hashPowChecksum == GetPowChecksum();
+    }
+
+    //! Run CryptoHello over the stored header fields
+    uint256 ComputeBlockHash() const
+    {
         CBlockHeader block;
         block.nVersion        = nVersion;
         block.hashPrevBlock   = hashPrev;
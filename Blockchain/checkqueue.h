@@ -5,7 +5,13 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "script/script_error.h"
+
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <new>
+#include <stdint.h>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -15,162 +21,339 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
+  * The verifications are represented by a type T, which must provide a
+  * Verify() returning SCRIPT_ERR_OK on success, swap() and a default
+  * constructor.
   *
   * One thread (the master) is assumed to push batches of verifications
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Taking work does not lock. Added checks sit in segments that never
+  * move and are claimed by index: a thread takes a run of new checks off
+  * a shared cursor, keeps what it does not run at once as a range in its
+  * own slot, and runs it from the front a batch at a time, while threads
+  * out of work steal the back half of other slots' ranges. Cursor and
+  * ranges are single words changed by compare-and-swap; both carry the
+  * round (a master's Add..Wait), so a thread that stalls across rounds
+  * cannot take stale indices. The mutex is only taken to sleep and wake.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Segment p holds 2^(SEGMENT_BITS + p) checks
+    static const unsigned int SEGMENT_BITS = 10;
+    static const unsigned int MAX_SEGMENTS = 14;
+
+    //! Checks in one round; indices fit the 24 bits a range word has for them
+    static const uint32_t MAX_CHECKS = ((1U << MAX_SEGMENTS) - 1) << SEGMENT_BITS;
+
+    //! Slot 0 is the master's, the workers get the others in start order
+    static const unsigned int MAX_SLOTS = 64;
+
+    struct alignas(64) WorkerSlot
+    {
+        //! Round tag (16 bits), begin and end (24 bits each) of the checks left to this thread
+        std::atomic<uint64_t> nRange;
+    };
+
+    //! Mutex the threads sleep on; the state below is atomic
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
     boost::condition_variable condWorker;
 
-    //! Master thread blocks on this when out of work
+    //! Master thread blocks on this while workers finish the last checks
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! Storage of the current round's checks, written by the master only
+    T* apSegments[MAX_SEGMENTS];
+    unsigned int nSegments;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Current round, written by the master only
+    uint32_t nRound;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Round (high 32 bits) and number of checks added
+    std::atomic<uint64_t> nAdded;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Round (high 32 bits) and number of checks taken off the shared cursor
+    std::atomic<uint64_t> nClaimed;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * This includes checks that are claimed, but still in a thread's slot
+     * or being run.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! Worker threads started, and those asleep
+    std::atomic<unsigned int> nWorkers;
+    std::atomic<int> nSleeping;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
-    {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+    WorkerSlot slots[MAX_SLOTS];
+
+    static unsigned int BitLength(uint32_t x)
+    {
+#if defined(__GNUC__)
+        return x == 0 ? 0 : 32 - __builtin_clz(x);
+#else
+        unsigned int n = 0;
+        while (x) {
+            x >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    static unsigned int SegmentOf(uint32_t n)
+    {
+        // Segment p starts at check (2^p - 1) << SEGMENT_BITS
+        return BitLength((n >> SEGMENT_BITS) + 1) - 1;
+    }
+
+    T& At(uint32_t n) const
+    {
+        unsigned int p = SegmentOf(n);
+        return apSegments[p][n - ((((uint32_t)1 << p) - 1) << SEGMENT_BITS)];
+    }
+
+    static uint64_t PackRange(uint32_t nTag, uint32_t nBegin, uint32_t nEnd)
+    {
+        return ((uint64_t)(nTag & 0xffff) << 48) | ((uint64_t)nBegin << 24) | nEnd;
+    }
+    static uint32_t RangeTag(uint64_t n) { return n >> 48; }
+    static uint32_t RangeBegin(uint64_t n) { return (n >> 24) & 0xffffff; }
+    static uint32_t RangeEnd(uint64_t n) { return n & 0xffffff; }
+
+    static uint32_t CounterRound(uint64_t n) { return n >> 32; }
+    static uint32_t CounterValue(uint64_t n) { return (uint32_t)n; }
+
+    unsigned int SlotsInUse() const
+    {
+        return std::min(MAX_SLOTS, nWorkers.load() + 1);
+    }
+
+    /**
+     * Keep [nBegin, nEnd) in pslot for later, after a batch off its front.
+     * Narrows nEnd to the checks the caller runs now: that batch, or all of
+     * them if the slot is taken.
+     */
+    void KeepRange(WorkerSlot* pslot, uint32_t nTag, uint32_t nBegin, uint32_t& nEnd)
+    {
+        uint32_t nNow = std::max(1U, std::min(nBatchSize, (nEnd - nBegin) / 2));
+        if (pslot == NULL || nBegin + nNow == nEnd)
+            return;
+        uint64_t nOld = pslot->nRange.load();
+        if (RangeTag(nOld) == (nTag & 0xffff) && RangeBegin(nOld) < RangeEnd(nOld))
+            return;
+        if (pslot->nRange.compare_exchange_strong(nOld, PackRange(nTag, nBegin + nNow, nEnd)))
+            nEnd = nBegin + nNow;
+    }
+
+    /** Claim checks [nBegin, nEnd) to run now; false if there is nothing to take */
+    bool Take(WorkerSlot* pslot, uint32_t& nBegin, uint32_t& nEnd)
+    {
+        while (true) {
+            uint64_t nClaimedNow = nClaimed.load();
+            uint64_t nAddedNow = nAdded.load();
+            uint32_t nTag = CounterRound(nAddedNow);
+            bool fRetry = false;
+
+            // Our own range first, from the front
+            if (pslot != NULL) {
+                uint64_t nOld = pslot->nRange.load();
+                uint32_t nOldBegin = RangeBegin(nOld), nOldEnd = RangeEnd(nOld);
+                if (RangeTag(nOld) == (nTag & 0xffff) && nOldBegin < nOldEnd) {
+                    uint32_t nNow = std::max(1U, std::min(nBatchSize, (nOldEnd - nOldBegin) / 2));
+                    if (pslot->nRange.compare_exchange_strong(nOld, PackRange(nTag, nOldBegin + nNow, nOldEnd))) {
+                        nBegin = nOldBegin;
+                        nEnd = nOldBegin + nNow;
+                        return true;
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                    continue;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+            }
+
+            // Then a run of new checks off the shared cursor
+            if (CounterRound(nClaimedNow) == nTag && CounterValue(nClaimedNow) < CounterValue(nAddedNow)) {
+                uint32_t nFirst = CounterValue(nClaimedNow);
+                uint32_t nLeft = CounterValue(nAddedNow) - nFirst;
+                uint32_t nGrab = std::min(nLeft, std::max(nBatchSize, nLeft / (SlotsInUse() + 1)));
+                if (!nClaimed.compare_exchange_strong(nClaimedNow, nClaimedNow + nGrab))
+                    continue;
+                nBegin = nFirst;
+                nEnd = nFirst + nGrab;
+                KeepRange(pslot, nTag, nBegin, nEnd);
+                return true;
+            }
+
+            // Then the back half of someone else's range
+            unsigned int nSlots = SlotsInUse();
+            unsigned int nSelf = pslot != NULL ? pslot - slots : 0;
+            for (unsigned int i = 1; i <= nSlots; i++) {
+                WorkerSlot& victim = slots[(nSelf + i) % nSlots];
+                if (&victim == pslot)
+                    continue;
+                uint64_t nOld = victim.nRange.load();
+                uint32_t nOldBegin = RangeBegin(nOld), nOldEnd = RangeEnd(nOld);
+                if (RangeTag(nOld) != (nTag & 0xffff) || nOldBegin >= nOldEnd)
+                    continue;
+                uint32_t nMid = nOldBegin + (nOldEnd - nOldBegin) / 2;
+                if (!victim.nRange.compare_exchange_strong(nOld, PackRange(nTag, nOldBegin, nMid))) {
+                    fRetry = true;
+                    continue;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nBegin = nMid;
+                nEnd = nOldEnd;
+                KeepRange(pslot, nTag, nBegin, nEnd);
+                return true;
             }
-            // execute work
-            for (T& check : vChecks)
-				if (fOk) {
-					auto result = check.Verify();
-					fOk = (result == SCRIPT_ERR_OK);
-				}
-            vChecks.clear();
-        } while (true);
+            if (!fRetry)
+                return false;
+        }
+    }
+
+    /** Whether Take() could find anything */
+    bool HasWork() const
+    {
+        uint64_t nClaimedNow = nClaimed.load();
+        uint64_t nAddedNow = nAdded.load();
+        uint32_t nTag = CounterRound(nAddedNow);
+        if (CounterRound(nClaimedNow) == nTag && CounterValue(nClaimedNow) < CounterValue(nAddedNow))
+            return true;
+        for (unsigned int i = 0; i < SlotsInUse(); i++) {
+            uint64_t nRange = slots[i].nRange.load();
+            if (RangeTag(nRange) == (nTag & 0xffff) && RangeBegin(nRange) < RangeEnd(nRange))
+                return true;
+        }
+        return false;
+    }
+
+    /** Run claimed checks [nBegin, nEnd), destroying each as it goes */
+    void Run(uint32_t nBegin, uint32_t nEnd)
+    {
+        for (uint32_t i = nBegin; i < nEnd; i++) {
+            T& check = At(i);
+            // Once a check failed, the rest only need to be counted
+            if (fAllOk.load(std::memory_order_relaxed) && check.Verify() != SCRIPT_ERR_OK)
+                fAllOk.store(false, std::memory_order_relaxed);
+            check.~T();
+        }
+        if (nTodo.fetch_sub(nEnd - nBegin) == nEnd - nBegin) {
+            // We ran the last check; wake the master
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+    /** Run checks until there are none left to take */
+    void Work(WorkerSlot* pslot)
+    {
+        uint32_t nBegin, nEnd;
+        while (Take(pslot, nBegin, nEnd))
+            Run(nBegin, nEnd);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nSegments(0), nRound(0), nAdded(0), nClaimed(0), nTodo(0), fAllOk(true), nWorkers(0), nSleeping(0), nBatchSize(nBatchSizeIn)
+    {
+        for (WorkerSlot& slot : slots)
+            slot.nRange = 0;
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        unsigned int nId = ++nWorkers;
+        WorkerSlot* pslot = nId < MAX_SLOTS ? &slots[nId] : NULL;
+        while (true) {
+            Work(pslot);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nSleeping++;
+            // Add() checks nSleeping after publishing its checks, and we
+            // look for work after counting ourselves, so one of us sees the other
+            while (!HasWork())
+                condWorker.wait(lock); // wait
+            nSleeping--;
+        }
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        while (true) {
+            Work(&slots[0]);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nTodo.load() == 0)
+                break;
+            // Workers are running their last batches, or kept ranges we
+            // can still steal from
+            if (!HasWork())
+                condMaster.wait(lock);
+        }
+        bool fRet = fAllOk.load();
+        // reset the status for new work later
+        fAllOk = true;
+        nRound++;
+        nClaimed = (uint64_t)nRound << 32;
+        nAdded = (uint64_t)nRound << 32;
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vChecks.empty())
+            return;
+        uint64_t nAddedNow = nAdded.load();
+        uint32_t n = CounterValue(nAddedNow);
+        assert(vChecks.size() <= MAX_CHECKS - n);
         for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+            unsigned int p = SegmentOf(n);
+            if (p == nSegments)
+                apSegments[nSegments++] = static_cast<T*>(::operator new(sizeof(T) << (SEGMENT_BITS + p)));
+            T* pcheck = new (&At(n)) T();
+            check.swap(*pcheck);
+            n++;
         }
+        // Count the checks before anyone can take them
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        nAdded = (nAddedNow & ~(uint64_t)0xffffffff) | n;
+        if (nSleeping.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
     {
+        for (unsigned int p = 0; p < nSegments; p++)
+            ::operator delete(apSegments[p]);
     }
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo.load() == 0 && CounterValue(nAdded.load()) == 0 && fAllOk.load();
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
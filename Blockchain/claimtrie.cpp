@@ -5,6 +5,7 @@
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
 
 #include "claimtrie.h"
 #include "coins.h"
@@ -12,6 +13,9 @@
 #include "hash.h"
 #include "Log.h"
 
+#include <boost/pool/singleton_pool.hpp>
+#include <boost/thread.hpp>
+
 // leveldb keysc
 static constexpr char HASH_BLOCK = 'h';
 static constexpr char CURRENT_HEIGHT = 't';
@@ -24,6 +28,33 @@ static constexpr char SUPPORT = 's';
 static constexpr char SUPPORT_QUEUE_ROW = 'u';
 static constexpr char SUPPORT_QUEUE_NAME_ROW = 'p';
 static constexpr char SUPPORT_EXP_QUEUE_ROW = 'x';
+static constexpr char VERIFIED_ROOT = 'v';
+
+//! Look key up in the rows not yet on disk, the newest first
+template<typename K, typename V>
+static bool findUnwritten(const std::map<K, V>& dirty, const std::map<K, V>& writing, const K& key, V& value)
+{
+    typename std::map<K, V>::const_iterator it = dirty.find(key);
+    if (it == dirty.end())
+    {
+        it = writing.find(key);
+        if (it == writing.end())
+            return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<typename K, typename V>
+static bool rowsEmpty(const std::map<K, V>& rows)
+{
+    for (typename std::map<K, V>::const_iterator itRow = rows.begin(); itRow != rows.end(); ++itRow)
+    {
+        if (!itRow->second.empty())
+            return false;
+    }
+    return true;
+}
 
 std::vector<unsigned char> heightToVch(int n)
 {
@@ -72,6 +103,129 @@ uint256 getValueHash(COutPoint outPoint, int nHeightOfLastTakeover)
     return valueHash;
 }
 
+CClaimTrieChildren::CClaimTrieChildren(CClaimTrieChildren&& other) : nSize(0), nCapacity(0)
+{
+    *this = std::move(other);
+}
+
+CClaimTrieChildren& CClaimTrieChildren::operator=(const CClaimTrieChildren& other)
+{
+    if (this != &other)
+    {
+        clear();
+        assign(other);
+    }
+    return *this;
+}
+
+CClaimTrieChildren& CClaimTrieChildren::operator=(CClaimTrieChildren&& other)
+{
+    if (this != &other)
+    {
+        clear();
+        if (other.nCapacity)
+            indirect = other.indirect;
+        else if (other.nSize)
+            new (&direct) value_type(*other.data());
+        nSize = other.nSize;
+        nCapacity = other.nCapacity;
+        other.nSize = 0;
+        other.nCapacity = 0;
+    }
+    return *this;
+}
+
+void CClaimTrieChildren::assign(const CClaimTrieChildren& other)
+{
+    if (other.nSize > 1)
+    {
+        indirect = new value_type[other.nSize];
+        nCapacity = other.nSize;
+        std::copy(other.begin(), other.end(), indirect);
+    }
+    else if (other.nSize == 1)
+        new (&direct) value_type(*other.data());
+    nSize = other.nSize;
+}
+
+CClaimTrieChildren::iterator CClaimTrieChildren::insert(iterator pos, unsigned char c)
+{
+    size_t nPos = pos - begin();
+    if (nSize == 0)
+    {
+        new (&direct) value_type(c, NULL);
+        nSize = 1;
+        return begin();
+    }
+    if (nSize == nCapacity || nCapacity == 0)
+    {
+        // Double the array, leaving the inline slot on the first growth
+        uint16_t nNewCapacity = nCapacity ? std::min(2 * nCapacity, 256) : 2;
+        value_type* vNew = new value_type[nNewCapacity];
+        std::copy(begin(), end(), vNew);
+        if (nCapacity)
+            delete[] indirect;
+        indirect = vNew;
+        nCapacity = nNewCapacity;
+    }
+    std::copy_backward(indirect + nPos, indirect + nSize, indirect + nSize + 1);
+    indirect[nPos] = value_type(c, NULL);
+    nSize++;
+    return indirect + nPos;
+}
+
+CClaimTrieChildren::iterator CClaimTrieChildren::erase(iterator pos)
+{
+    size_t nPos = pos - begin();
+    std::copy(pos + 1, end(), pos);
+    nSize--;
+    if (nCapacity && nSize <= 1)
+    {
+        // Back to the inline slot
+        value_type* vOld = indirect;
+        if (nSize)
+            new (&direct) value_type(vOld[0]);
+        delete[] vOld;
+        nCapacity = 0;
+    }
+    return begin() + nPos;
+}
+
+void CClaimTrieChildren::clear()
+{
+    if (nCapacity)
+        delete[] indirect;
+    nSize = 0;
+    nCapacity = 0;
+}
+
+struct CClaimTrieNodePoolTag {};
+// Grow by at most 64k nodes at a time, so a large trie does not leave up
+// to half of its last doubling unused
+typedef boost::singleton_pool<CClaimTrieNodePoolTag, sizeof(CClaimTrieNode),
+                              boost::default_user_allocator_new_delete,
+                              boost::details::pool::default_mutex, 1024, 65536> CClaimTrieNodePool;
+
+void* CClaimTrieNode::operator new(size_t size)
+{
+    if (size != sizeof(CClaimTrieNode))
+        return ::operator new(size);
+    void* p = CClaimTrieNodePool::malloc();
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void CClaimTrieNode::operator delete(void* p, size_t size)
+{
+    if (p == NULL)
+        return;
+    if (size != sizeof(CClaimTrieNode))
+        ::operator delete(p);
+    else
+        CClaimTrieNodePool::free(p);
+}
+
 bool CClaimTrieNode::insertClaim(CClaimValue claim)
 {
 	LOG_INFO("{}: Inserting {}:{} (amount: {})  into the claim trie", __func__, claim.outPoint.hash.ToString(), claim.outPoint.n, claim.nAmount);
@@ -200,44 +354,32 @@ template<typename K> bool CClaimTrie::keyTypeEmpty(char keyType, K& dummy) const
 
 bool CClaimTrie::queueEmpty() const
 {
-    for (claimQueueType::const_iterator itRow = dirtyQueueRows.begin(); itRow != dirtyQueueRows.end(); ++itRow)
-    {
-        if (!itRow->second.empty())
-            return false;
-    }
+    if (!rowsEmpty(dirtyQueueRows) || !rowsEmpty(writingQueueRows))
+        return false;
     int dummy;
     return keyTypeEmpty(CLAIM_QUEUE_ROW, dummy);
 }
 
 bool CClaimTrie::expirationQueueEmpty() const
 {
-    for (expirationQueueType::const_iterator itRow = dirtyExpirationQueueRows.begin(); itRow != dirtyExpirationQueueRows.end(); ++itRow)
-    {
-        if (!itRow->second.empty())
-            return false;
-    }
+    if (!rowsEmpty(dirtyExpirationQueueRows) || !rowsEmpty(writingExpirationQueueRows))
+        return false;
     int dummy;
     return keyTypeEmpty(EXP_QUEUE_ROW, dummy);
 }
 
 bool CClaimTrie::supportEmpty() const
 {
-    for (supportMapType::const_iterator itNode = dirtySupportNodes.begin(); itNode != dirtySupportNodes.end(); ++itNode)
-    {
-        if (!itNode->second.empty())
-            return false;
-    }
+    if (!rowsEmpty(dirtySupportNodes) || !rowsEmpty(writingSupportNodes))
+        return false;
     std::string dummy;
     return keyTypeEmpty(SUPPORT, dummy);
 }
 
 bool CClaimTrie::supportQueueEmpty() const
 {
-    for (supportQueueType::const_iterator itRow = dirtySupportQueueRows.begin(); itRow != dirtySupportQueueRows.end(); ++itRow)
-    {
-        if (!itRow->second.empty())
-            return false;
-    }
+    if (!rowsEmpty(dirtySupportQueueRows) || !rowsEmpty(writingSupportQueueRows))
+        return false;
     int dummy;
     return keyTypeEmpty(SUPPORT_QUEUE_ROW, dummy);
 }
@@ -259,6 +401,7 @@ void CClaimTrie::clear(CClaimTrieNode* current)
         clear(itchildren->second);
         delete itchildren->second;
     }
+    current->children.clear();
 }
 
 bool CClaimTrie::haveClaim(const std::string& name, const COutPoint& outPoint) const
@@ -578,26 +721,14 @@ CAmount CClaimTrie::getEffectiveAmountForClaim(const std::string& name, uint160
 
 }
 
-bool CClaimTrie::checkConsistency() const
+/** Whether node's stored hash matches its stored children's hashes and its best claim */
+static bool checkNodeHash(const CClaimTrieNode* node)
 {
-    if (empty())
-        return true;
-    return recursiveCheckConsistency(&root);
-}
-
-bool CClaimTrie::recursiveCheckConsistency(const CClaimTrieNode* node) const
-{
-    std::vector<unsigned char> vchToHash;
-
+    CHash256 hasher;
     for (nodeMapType::const_iterator it = node->children.begin(); it != node->children.end(); ++it)
     {
-        if (recursiveCheckConsistency(it->second))
-        {
-            vchToHash.push_back(it->first);
-            vchToHash.insert(vchToHash.end(), it->second->hash.begin(), it->second->hash.end());
-        }
-        else
-            return false;
+        hasher.Write(&it->first, 1);
+        hasher.Write(it->second->hash.begin(), it->second->hash.size());
     }
 
     CClaimValue claim;
@@ -606,17 +737,68 @@ bool CClaimTrie::recursiveCheckConsistency(const CClaimTrieNode* node) const
     if (hasClaim)
     {
         uint256 valueHash = getValueHash(claim.outPoint, node->nHeightOfLastTakeover);
-        vchToHash.insert(vchToHash.end(), valueHash.begin(), valueHash.end());
+        hasher.Write(valueHash.begin(), valueHash.size());
     }
 
-    CHash256 hasher;
-    std::vector<unsigned char> vchHash(hasher.OUTPUT_SIZE);
-    hasher.Write(vchToHash.data(), vchToHash.size());
-    hasher.Finalize(&(vchHash[0]));
-    uint256 calculatedHash(vchHash);
+    uint256 calculatedHash;
+    hasher.Finalize(calculatedHash.begin());
     return calculatedHash == node->hash;
 }
 
+bool CClaimTrie::checkConsistency() const
+{
+    if (empty())
+        return true;
+    const int nThreads = GetNumCores();
+    if (nThreads <= 1)
+        return recursiveCheckConsistency(&root);
+
+    // Every node is checked against its children's stored hashes only, so
+    // the trie can be cut anywhere. Check the top levels here until they
+    // fan out into enough subtrees, then check those on worker threads.
+    std::vector<const CClaimTrieNode*> vSubtrees(1, &root);
+    while (vSubtrees.size() < CLAIMTRIE_CHECK_SUBTREES_PER_THREAD * nThreads)
+    {
+        std::vector<const CClaimTrieNode*> vNext;
+        for (size_t i = 0; i < vSubtrees.size(); i++)
+        {
+            if (!checkNodeHash(vSubtrees[i]))
+                return false;
+            for (nodeMapType::const_iterator it = vSubtrees[i]->children.begin(); it != vSubtrees[i]->children.end(); ++it)
+                vNext.push_back(it->second);
+        }
+        if (vNext.empty())
+            return true;
+        vSubtrees.swap(vNext);
+    }
+
+    std::atomic<size_t> nNext(0);
+    std::atomic<bool> fConsistent(true);
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads; i++) {
+        workers.create_thread([&]() {
+            size_t n;
+            while (fConsistent && (n = nNext++) < vSubtrees.size())
+            {
+                if (!recursiveCheckConsistency(vSubtrees[n]))
+                    fConsistent = false;
+            }
+        });
+    }
+    workers.join_all();
+    return fConsistent;
+}
+
+bool CClaimTrie::recursiveCheckConsistency(const CClaimTrieNode* node) const
+{
+    for (nodeMapType::const_iterator it = node->children.begin(); it != node->children.end(); ++it)
+    {
+        if (!recursiveCheckConsistency(it->second))
+            return false;
+    }
+    return checkNodeHash(node);
+}
+
 
 bool CClaimTrie::getClaimById(const uint160 claimId, std::string& name, CClaimValue& claim) const
 {
@@ -638,34 +820,22 @@ bool CClaimTrie::getClaimById(const uint160 claimId, std::string& name, CClaimVa
 
 bool CClaimTrie::getQueueRow(int nHeight, claimQueueRowType& row) const
 {
-    claimQueueType::const_iterator itQueueRow = dirtyQueueRows.find(nHeight);
-    if (itQueueRow != dirtyQueueRows.end())
-    {
-        row = itQueueRow->second;
+    if (findUnwritten(dirtyQueueRows, writingQueueRows, nHeight, row))
         return true;
-    }
     return db.Read(std::make_pair(CLAIM_QUEUE_ROW, nHeight), row);
 }
 
 bool CClaimTrie::getQueueNameRow(const std::string& name, queueNameRowType& row) const
 {
-    queueNameType::const_iterator itQueueNameRow = dirtyQueueNameRows.find(name);
-    if (itQueueNameRow != dirtyQueueNameRows.end())
-    {
-        row = itQueueNameRow->second;
+    if (findUnwritten(dirtyQueueNameRows, writingQueueNameRows, name, row))
         return true;
-    }
     return db.Read(std::make_pair(CLAIM_QUEUE_NAME_ROW, name), row);
 }
 
 bool CClaimTrie::getExpirationQueueRow(int nHeight, expirationQueueRowType& row) const
 {
-    expirationQueueType::const_iterator itQueueRow = dirtyExpirationQueueRows.find(nHeight);
-    if (itQueueRow != dirtyExpirationQueueRows.end())
-    {
-        row = itQueueRow->second;
+    if (findUnwritten(dirtyExpirationQueueRows, writingExpirationQueueRows, nHeight, row))
         return true;
-    }
     return db.Read(std::make_pair(EXP_QUEUE_ROW, nHeight), row);
 }
 
@@ -797,45 +967,29 @@ void CClaimTrie::updateSupportExpirationQueue(int nHeight, expirationQueueRowTyp
 
 bool CClaimTrie::getSupportNode(std::string name, supportMapEntryType& node) const
 {
-    supportMapType::const_iterator itNode = dirtySupportNodes.find(name);
-    if (itNode != dirtySupportNodes.end())
-    {
-        node = itNode->second;
+    if (findUnwritten(dirtySupportNodes, writingSupportNodes, name, node))
         return true;
-    }
     return db.Read(std::make_pair(SUPPORT, name), node);
 }
 
 bool CClaimTrie::getSupportQueueRow(int nHeight, supportQueueRowType& row) const
 {
-    supportQueueType::const_iterator itQueueRow = dirtySupportQueueRows.find(nHeight);
-    if (itQueueRow != dirtySupportQueueRows.end())
-    {
-        row = itQueueRow->second;
+    if (findUnwritten(dirtySupportQueueRows, writingSupportQueueRows, nHeight, row))
         return true;
-    }
     return db.Read(std::make_pair(SUPPORT_QUEUE_ROW, nHeight), row);
 }
 
 bool CClaimTrie::getSupportQueueNameRow(const std::string& name, queueNameRowType& row) const
 {
-    queueNameType::const_iterator itQueueNameRow = dirtySupportQueueNameRows.find(name);
-    if (itQueueNameRow != dirtySupportQueueNameRows.end())
-    {
-        row = itQueueNameRow->second;
+    if (findUnwritten(dirtySupportQueueNameRows, writingSupportQueueNameRows, name, row))
         return true;
-    }
     return db.Read(std::make_pair(SUPPORT_QUEUE_NAME_ROW, name), row);
 }
 
 bool CClaimTrie::getSupportExpirationQueueRow(int nHeight, expirationQueueRowType& row) const
 {
-    expirationQueueType::const_iterator itQueueRow = dirtySupportExpirationQueueRows.find(nHeight);
-    if (itQueueRow != dirtySupportExpirationQueueRows.end())
-    {
-        row = itQueueRow->second;
+    if (findUnwritten(dirtySupportExpirationQueueRows, writingSupportExpirationQueueRows, nHeight, row))
         return true;
-    }
     return db.Read(std::make_pair(SUPPORT_EXP_QUEUE_ROW, nHeight), row);
 }
 
@@ -938,7 +1092,7 @@ bool CClaimTrie::updateName(const std::string &name, CClaimTrieNode* updatedNode
             std::string newName = ss.str();
             if (!recursiveNullify(itchild->second, newName))
                 return false;
-            current->children.erase(itchild++);
+            itchild = current->children.erase(itchild);
         }
         else
             ++itchild;
@@ -1126,26 +1280,56 @@ void CClaimTrie::BatchWriteSupportExpirationQueueRows(CDBBatch& batch)
 
 bool CClaimTrie::WriteToDisk()
 {
-    CDBBatch batch(&db.GetObfuscateKey());
+    std::shared_ptr<CDBBatch> pbatch = PrepareWrite();
+    if (!CommitWrite(*pbatch))
+        return false;
+    writingQueueRows.clear();
+    writingQueueNameRows.clear();
+    writingExpirationQueueRows.clear();
+    writingSupportNodes.clear();
+    writingSupportQueueRows.clear();
+    writingSupportQueueNameRows.clear();
+    writingSupportExpirationQueueRows.clear();
+    return true;
+}
+
+std::shared_ptr<CDBBatch> CClaimTrie::PrepareWrite()
+{
+    std::shared_ptr<CDBBatch> pbatch = std::make_shared<CDBBatch>(&db.GetObfuscateKey());
+    CDBBatch& batch = *pbatch;
     for (nodeCacheType::iterator itcache = dirtyNodes.begin(); itcache != dirtyNodes.end(); ++itcache)
         BatchWriteNode(batch, itcache->first, itcache->second);
     dirtyNodes.clear();
+    // The batch before this one is on disk, so its rows can go
     BatchWriteQueueRows(batch);
-    dirtyQueueRows.clear();
+    writingQueueRows.clear();
+    writingQueueRows.swap(dirtyQueueRows);
     BatchWriteQueueNameRows(batch);
-    dirtyQueueNameRows.clear();
+    writingQueueNameRows.clear();
+    writingQueueNameRows.swap(dirtyQueueNameRows);
     BatchWriteExpirationQueueRows(batch);
-    dirtyExpirationQueueRows.clear();
+    writingExpirationQueueRows.clear();
+    writingExpirationQueueRows.swap(dirtyExpirationQueueRows);
     BatchWriteSupportNodes(batch);
-    dirtySupportNodes.clear();
+    writingSupportNodes.clear();
+    writingSupportNodes.swap(dirtySupportNodes);
     BatchWriteSupportQueueRows(batch);
-    dirtySupportQueueRows.clear();
+    writingSupportQueueRows.clear();
+    writingSupportQueueRows.swap(dirtySupportQueueRows);
     BatchWriteSupportQueueNameRows(batch);
-    dirtySupportQueueNameRows.clear();
+    writingSupportQueueNameRows.clear();
+    writingSupportQueueNameRows.swap(dirtySupportQueueNameRows);
     BatchWriteSupportExpirationQueueRows(batch);
-    dirtySupportExpirationQueueRows.clear();
+    writingSupportExpirationQueueRows.clear();
+    writingSupportExpirationQueueRows.swap(dirtySupportExpirationQueueRows);
     batch.Write(HASH_BLOCK, hashBlock);
     batch.Write(CURRENT_HEIGHT, nCurrentHeight);
+    batch.Write(VERIFIED_ROOT, std::make_pair(hashBlock, root.hash));
+    return pbatch;
+}
+
+bool CClaimTrie::CommitWrite(CDBBatch& batch)
+{
     return db.WriteBatch(batch);
 }
 
@@ -1168,42 +1352,76 @@ bool CClaimTrie::InsertFromDisk(const std::string& name, CClaimTrieNode* node)
     return true;
 }
 
-bool CClaimTrie::ReadFromDisk(bool check)
+bool CClaimTrie::ReadFromDisk(bool check, bool fFullCheck)
 {
     if (!db.Read(HASH_BLOCK, hashBlock))
 		LOG_INFO("{}: Couldn't read the best block's hash", __func__);
     if (!db.Read(CURRENT_HEIGHT, nCurrentHeight))
 		LOG_INFO("{}: Couldn't read the current height", __func__);
     std::unique_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
-    
+    pcursor->Seek(std::make_pair(TRIE_NODE, std::string()));
+
+    // Node keys sort by name length, then by name. Every node comes after
+    // its parent, and the nodes of one length come in the order of their
+    // parents, so each is attached to the previous level by a forward scan
+    // instead of a descent from the root.
+    std::vector<std::pair<std::string, CClaimTrieNode*> > vParents;
+    std::vector<std::pair<std::string, CClaimTrieNode*> > vLevel(1, std::make_pair(std::string(), &root));
+    size_t nLevelLength = 0;
+    size_t nParent = 0;
     while (pcursor->Valid())
     {
         std::pair<char, std::string> key;
-        if (pcursor->GetKey(key))
+        if (!pcursor->GetKey(key) || key.first != TRIE_NODE)
+            break;
+        CClaimTrieNode* node = new CClaimTrieNode();
+        if (!pcursor->GetValue(*node))
         {
-            if (key.first == TRIE_NODE)
-            {
-                CClaimTrieNode* node = new CClaimTrieNode();
-                if (pcursor->GetValue(*node))
-                {
-                    if (!InsertFromDisk(key.second, node))
-                    {
-                        LOG_ERROR("%s(): error restoring claim trie from disk", __func__);
-						return false;
-                    }
-                }
-                else
-                {
-                    LOG_ERROR("%s(): error reading claim trie from disk", __func__);
-					return false;
-                }
-            }
+            delete node;
+            LOG_ERROR("{}(): error reading claim trie from disk", __func__);
+            return false;
+        }
+        const std::string& name = key.second;
+        if (name.empty())
+        {
+            root = *node;
+            delete node;
+            pcursor->Next();
+            continue;
+        }
+        if (name.size() != nLevelLength)
+        {
+            if (name.size() == nLevelLength + 1)
+                vParents.swap(vLevel);
+            else
+                vParents.clear();
+            vLevel.clear();
+            nLevelLength = name.size();
+            nParent = 0;
+        }
+        while (nParent < vParents.size() && name.compare(0, name.size() - 1, vParents[nParent].first) > 0)
+            nParent++;
+        if (nParent < vParents.size() && name.compare(0, name.size() - 1, vParents[nParent].first) == 0)
+            vParents[nParent].second->children[name[name.size()-1]] = node;
+        else if (!InsertFromDisk(name, node))
+        {
+            delete node;
+            LOG_ERROR("{}(): error restoring claim trie from disk", __func__);
+            return false;
         }
+        vLevel.push_back(std::make_pair(name, node));
         pcursor->Next();
     }
     if (check)
     {
+        // A trie flushed by this node at this block is not re-verified
+        std::pair<uint256, uint256> verifiedRoot;
+        if (!fFullCheck && db.Read(VERIFIED_ROOT, verifiedRoot) &&
+            verifiedRoot.first == hashBlock && verifiedRoot.second == root.hash)
+        {
+            LOG_INFO("Claim trie root {} matches the last flush, skipping consistency check", root.hash.ToString());
+            return true;
+        }
 		LOG_INFO("Checking Claim trie consistency...");
         if (checkConsistency())
         {
@@ -1216,67 +1434,173 @@ bool CClaimTrie::ReadFromDisk(bool check)
     return true;
 }
 
-bool CClaimTrieCache::recursiveComputeMerkleHash(CClaimTrieNode* tnCurrent, std::string sPos) const
+/** A child slot of a dirty node, in CClaimTrieCache::computeMerkleHash() */
+struct CClaimTrieMerkleChild
 {
-    if (sPos == "" && tnCurrent->empty())
-    {
-        cacheHashes[""] = uint256S("0000000000000000000000000000000000000000000000000000000000000001");
-        return true;
-    }
-    std::vector<unsigned char> vchToHash;
-    nodeCacheType::iterator cachedNode;
+    unsigned char c;
+    //! Job recomputing the child, or -1 if the child is clean
+    int nJob;
+    //! Hash used when the child is clean or its job failed
+    uint256 hash;
+};
 
+/** A dirty node whose hash is recomputed, in CClaimTrieCache::computeMerkleHash() */
+struct CClaimTrieMerkleJob
+{
+    std::string sPos;
+    //! Its child slots in the shared child vector
+    size_t nChildBegin;
+    size_t nChildEnd;
+    //! Jobs are in post-order: [nSubtreeBegin, own index] is the node's dirty subtree
+    size_t nSubtreeBegin;
+    bool fHasClaim;
+    COutPoint outPoint;
+    int nHeightOfLastTakeover;
+    //! The takeover height lookup failed: the node keeps its old hash and stays dirty
+    bool fFailed;
+};
 
+int CClaimTrieCache::collectMerkleHashJobs(CClaimTrieNode* tnCurrent, std::string& sPos,
+                                           std::vector<CClaimTrieMerkleJob>& jobs,
+                                           std::vector<CClaimTrieMerkleChild>& children) const
+{
+    const size_t nSubtreeBegin = jobs.size();
+    const size_t nChildBegin = children.size();
     for (nodeMapType::iterator it = tnCurrent->children.begin(); it != tnCurrent->children.end(); ++it)
     {
-        std::stringstream ss;
-        ss << it->first;
-        std::string sNextPos = sPos + ss.str();
-        if (dirtyHashes.count(sNextPos) != 0)
+        sPos.push_back(it->first);
+        CClaimTrieMerkleChild child;
+        child.c = it->first;
+        child.nJob = -1;
+        hashMapType::iterator ithash = cacheHashes.find(sPos);
+        child.hash = ithash != cacheHashes.end() ? ithash->second : it->second->hash;
+        children.push_back(child);
+        sPos.pop_back();
+    }
+    const size_t nChildEnd = children.size();
+
+    nodeMapType::iterator it = tnCurrent->children.begin();
+    for (size_t n = nChildBegin; n < nChildEnd; ++n, ++it)
+    {
+        sPos.push_back(it->first);
+        if (dirtyHashes.count(sPos) != 0)
         {
             // the child might be in the cache, so look for it there
-            cachedNode = cache.find(sNextPos);
-            if (cachedNode != cache.end())
-                recursiveComputeMerkleHash(cachedNode->second, sNextPos);
-            else
-                recursiveComputeMerkleHash(it->second, sNextPos);
+            nodeCacheType::iterator cachedNode = cache.find(sPos);
+            CClaimTrieNode* tnChild = cachedNode != cache.end() ? cachedNode->second : it->second;
+            int nJob = collectMerkleHashJobs(tnChild, sPos, jobs, children);
+            children[n].nJob = nJob;
         }
-        vchToHash.push_back(it->first);
-        hashMapType::iterator ithash = cacheHashes.find(sNextPos);
-        if (ithash != cacheHashes.end())
+        sPos.pop_back();
+    }
+
+    CClaimTrieMerkleJob job;
+    job.sPos = sPos;
+    job.nChildBegin = nChildBegin;
+    job.nChildEnd = nChildEnd;
+    job.nSubtreeBegin = nSubtreeBegin;
+    job.nHeightOfLastTakeover = 0;
+    job.fFailed = false;
+
+    CClaimValue claim;
+    job.fHasClaim = tnCurrent->getBestClaim(claim);
+    if (job.fHasClaim)
+    {
+        job.outPoint = claim.outPoint;
+        if (!getLastTakeoverForName(sPos, job.nHeightOfLastTakeover))
         {
-            vchToHash.insert(vchToHash.end(), ithash->second.begin(), ithash->second.end());
+            LOG_INFO("getLastTakeoverForName is error {},{}", __LINE__, __func__);
+            job.fFailed = true;
         }
-        else
+    }
+    jobs.push_back(job);
+    return jobs.size() - 1;
+}
+
+/** Hash jobs [nBegin, nEnd), whose dirty children all come before them */
+static void hashMerkleJobs(const std::vector<CClaimTrieMerkleJob>& jobs,
+                           const std::vector<CClaimTrieMerkleChild>& children,
+                           size_t nBegin, size_t nEnd, std::vector<uint256>& vHashes)
+{
+    for (size_t n = nBegin; n < nEnd; ++n)
+    {
+        const CClaimTrieMerkleJob& job = jobs[n];
+        if (job.fFailed)
+            continue;
+        CHash256 hasher;
+        for (size_t i = job.nChildBegin; i < job.nChildEnd; ++i)
+        {
+            const CClaimTrieMerkleChild& child = children[i];
+            const uint256& hash = (child.nJob >= 0 && !jobs[child.nJob].fFailed) ? vHashes[child.nJob] : child.hash;
+            hasher.Write(&child.c, 1);
+            hasher.Write(hash.begin(), hash.size());
+        }
+        if (job.fHasClaim)
         {
-            vchToHash.insert(vchToHash.end(), it->second->hash.begin(), it->second->hash.end());
+            uint256 valueHash = getValueHash(job.outPoint, job.nHeightOfLastTakeover);
+            hasher.Write(valueHash.begin(), valueHash.size());
         }
+        hasher.Finalize(vHashes[n].begin());
     }
-    
-    CClaimValue claim;
-    bool hasClaim = tnCurrent->getBestClaim(claim);
+}
 
-    if (hasClaim)
+void CClaimTrieCache::computeMerkleHash(CClaimTrieNode* tnRoot) const
+{
+    if (tnRoot->empty())
     {
-        int nHeightOfLastTakeover;
-		if (!getLastTakeoverForName(sPos, nHeightOfLastTakeover))
-		{
-			LOG_INFO("getLastTakeoverForName is error {},{}", __LINE__, __func__);
-			return false;
-		}
-        uint256 valueHash = getValueHash(claim.outPoint, nHeightOfLastTakeover);
-        vchToHash.insert(vchToHash.end(), valueHash.begin(), valueHash.end());
+        cacheHashes[""] = uint256S("0000000000000000000000000000000000000000000000000000000000000001");
+        return;
+    }
+
+    // Walk the dirty spine once, resolving every node and clean child hash,
+    // so the hashing below touches neither the string-keyed maps nor the trie.
+    std::vector<CClaimTrieMerkleJob> jobs;
+    std::vector<CClaimTrieMerkleChild> children;
+    jobs.reserve(dirtyHashes.size() + 1);
+    std::string sPos;
+    collectMerkleHashJobs(tnRoot, sPos, jobs, children);
+
+    std::vector<uint256> vHashes(jobs.size());
+    const size_t nRoot = jobs.size() - 1;
+    const int nThreads = std::min<int>(GetNumCores(), jobs.size() / CLAIMTRIE_MERKLE_JOBS_PER_THREAD);
+    if (nThreads > 1)
+    {
+        // The root's dirty subtrees are contiguous, independent job ranges
+        std::vector<std::pair<size_t, size_t> > vSubtrees;
+        const CClaimTrieMerkleJob& root = jobs[nRoot];
+        for (size_t i = root.nChildBegin; i < root.nChildEnd; ++i)
+        {
+            if (children[i].nJob >= 0)
+                vSubtrees.push_back(std::make_pair(jobs[children[i].nJob].nSubtreeBegin, (size_t)children[i].nJob + 1));
+        }
+        // Largest first, so one big subtree does not start last
+        std::sort(vSubtrees.begin(), vSubtrees.end(), [](const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b) {
+            return a.second - a.first > b.second - b.first;
+        });
+        std::atomic<size_t> nNext(0);
+        boost::thread_group workers;
+        for (int i = 0; i < nThreads; i++) {
+            workers.create_thread([&]() {
+                size_t n;
+                while ((n = nNext++) < vSubtrees.size())
+                    hashMerkleJobs(jobs, children, vSubtrees[n].first, vSubtrees[n].second, vHashes);
+            });
+        }
+        workers.join_all();
+        hashMerkleJobs(jobs, children, nRoot, nRoot + 1, vHashes);
+    }
+    else
+    {
+        hashMerkleJobs(jobs, children, 0, jobs.size(), vHashes);
     }
 
-    CHash256 hasher;
-    std::vector<unsigned char> vchHash(hasher.OUTPUT_SIZE);
-    hasher.Write(vchToHash.data(), vchToHash.size());
-    hasher.Finalize(&(vchHash[0]));
-    cacheHashes[sPos] = uint256(vchHash);
-    std::set<std::string>::iterator itDirty = dirtyHashes.find(sPos);
-    if (itDirty != dirtyHashes.end())
-        dirtyHashes.erase(itDirty);
-    return true;
+    for (size_t n = 0; n < jobs.size(); ++n)
+    {
+        if (jobs[n].fFailed)
+            continue;
+        cacheHashes[jobs[n].sPos] = vHashes[n];
+        dirtyHashes.erase(jobs[n].sPos);
+    }
 }
 
 uint256 CClaimTrieCache::getMerkleHash() const
@@ -1290,9 +1614,9 @@ uint256 CClaimTrieCache::getMerkleHash() const
     {
         nodeCacheType::iterator cachedNode = cache.find("");
         if (cachedNode != cache.end())
-            recursiveComputeMerkleHash(cachedNode->second, "");
+            computeMerkleHash(cachedNode->second);
         else
-            recursiveComputeMerkleHash(&(base.root), "");
+            computeMerkleHash(&(base.root));
     }
     hashMapType::iterator ithash = cacheHashes.find("");
     if (ithash != cacheHashes.end())
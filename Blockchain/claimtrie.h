@@ -14,6 +14,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <type_traits>
 
 uint256 getValueHash(COutPoint outPoint, int nHeightOfLastTakeover);
 
@@ -124,7 +126,81 @@ class CClaimTrie;
 
 typedef std::vector<CSupportValue> supportMapEntryType;
 
-typedef std::map<unsigned char, CClaimTrieNode*> nodeMapType;
+/**
+ * Children of a CClaimTrieNode, sorted by character. Most nodes of a name
+ * trie have a single child, which is kept inline; larger sets move to a
+ * heap array. Insertion and erasure invalidate iterators.
+ */
+class CClaimTrieChildren
+{
+public:
+    typedef std::pair<unsigned char, CClaimTrieNode*> value_type;
+    typedef value_type* iterator;
+    typedef const value_type* const_iterator;
+
+    CClaimTrieChildren() : nSize(0), nCapacity(0) {}
+    CClaimTrieChildren(const CClaimTrieChildren& other) : nSize(0), nCapacity(0) { assign(other); }
+    CClaimTrieChildren(CClaimTrieChildren&& other);
+    ~CClaimTrieChildren() { clear(); }
+
+    CClaimTrieChildren& operator=(const CClaimTrieChildren& other);
+    CClaimTrieChildren& operator=(CClaimTrieChildren&& other);
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator begin() { return data(); }
+    iterator end() { return data() + nSize; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + nSize; }
+
+    iterator find(unsigned char c)
+    {
+        iterator it = lower_bound(c);
+        return (it != end() && it->first == c) ? it : end();
+    }
+
+    const_iterator find(unsigned char c) const
+    {
+        return const_cast<CClaimTrieChildren*>(this)->find(c);
+    }
+
+    CClaimTrieNode*& operator[](unsigned char c)
+    {
+        iterator it = lower_bound(c);
+        if (it == end() || it->first != c)
+            it = insert(it, c);
+        return it->second;
+    }
+
+    iterator erase(iterator pos);
+    void clear();
+
+private:
+    union {
+        value_type* indirect;
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type direct;
+    };
+    //! Children are on the heap iff nCapacity != 0, which holds iff nSize > 1
+    uint16_t nSize;
+    uint16_t nCapacity;
+
+    value_type* data() { return nCapacity ? indirect : reinterpret_cast<value_type*>(&direct); }
+    const value_type* data() const { return nCapacity ? indirect : reinterpret_cast<const value_type*>(&direct); }
+
+    iterator lower_bound(unsigned char c)
+    {
+        iterator it = begin();
+        while (it != end() && it->first < c)
+            ++it;
+        return it;
+    }
+
+    iterator insert(iterator pos, unsigned char c);
+    void assign(const CClaimTrieChildren& other);
+};
+
+typedef CClaimTrieChildren nodeMapType;
 
 typedef std::pair<std::string, CClaimTrieNode> namedNodeType;
 
@@ -133,6 +209,12 @@ class CClaimTrieNode
 public:
     CClaimTrieNode() : nHeightOfLastTakeover(0) {}
     CClaimTrieNode(uint256 hash) : hash(hash), nHeightOfLastTakeover(0) {}
+
+    //! Heap nodes come from a pool, so a trie with millions of names does
+    //! not pay a malloc header and a separate allocation per character
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
+
     uint256 hash;
     nodeMapType children;
     int nHeightOfLastTakeover;
@@ -288,6 +370,11 @@ struct claimsForNameType
 
 class CClaimTrieCache;
 
+/** Default for -checkclaimtrie */
+static const bool DEFAULT_CHECK_CLAIMTRIE = false;
+/** Subtrees per thread checkConsistency() splits the trie into */
+static const size_t CLAIMTRIE_CHECK_SUBTREES_PER_THREAD = 64;
+
 class CClaimTrie
 {
 public:
@@ -300,7 +387,19 @@ public:
     bool checkConsistency() const;
     
     bool WriteToDisk();
-    bool ReadFromDisk(bool check = false);
+    /**
+     * WriteToDisk in two steps: PrepareWrite moves the changes into a batch,
+     * and CommitWrite, which may run on another thread, writes it. The rows
+     * in the batch are read from memory until the next PrepareWrite, which
+     * must come after the CommitWrite before it.
+     */
+    std::shared_ptr<CDBBatch> PrepareWrite();
+    bool CommitWrite(CDBBatch& batch);
+    /**
+     * Load the trie. With check, verify every node hash, unless the root
+     * and best block match those of the last flush and fFullCheck is unset.
+     */
+    bool ReadFromDisk(bool check = false, bool fFullCheck = false);
     
     std::vector<namedNodeType> flattenTrie() const;
     bool getInfoForName(const std::string& name, CClaimValue& claim) const;
@@ -412,6 +511,17 @@ private:
     
     nodeCacheType dirtyNodes;
     supportMapType dirtySupportNodes;
+
+    //! Rows handed to PrepareWrite, read until its batch is committed
+    claimQueueType writingQueueRows;
+    queueNameType writingQueueNameRows;
+    expirationQueueType writingExpirationQueueRows;
+
+    supportQueueType writingSupportQueueRows;
+    queueNameType writingSupportQueueNameRows;
+    expirationQueueType writingSupportExpirationQueueRows;
+
+    supportMapType writingSupportNodes;
 };
 
 class CClaimTrieProofNode
@@ -438,6 +548,12 @@ public:
     int nHeightOfLastTakeover;
 };
 
+struct CClaimTrieMerkleJob;
+struct CClaimTrieMerkleChild;
+
+/** Below this many dirty nodes per thread, the Merkle hash is recomputed on one thread */
+static const size_t CLAIMTRIE_MERKLE_JOBS_PER_THREAD = 512;
+
 class CClaimTrieCache
 {
 public:
@@ -525,8 +641,10 @@ protected:
     uint256 computeHash() const;
     
     bool reorderTrieNode(const std::string& name, bool fCheckTakeover) const;
-    bool recursiveComputeMerkleHash(CClaimTrieNode* tnCurrent,
-                                    std::string sPos) const;
+    void computeMerkleHash(CClaimTrieNode* tnRoot) const;
+    int collectMerkleHashJobs(CClaimTrieNode* tnCurrent, std::string& sPos,
+                              std::vector<CClaimTrieMerkleJob>& jobs,
+                              std::vector<CClaimTrieMerkleChild>& children) const;
     bool recursivePruneName(CClaimTrieNode* tnCurrent, unsigned int nPos,
                             std::string sName,
                             bool* pfNullified = NULL) const;
@@ -9,6 +9,7 @@
 #include "compressor.h"
 #include "core_memusage.h"
 #include "memusage.h"
+#include "openhashmap.h"
 #include "serialize.h"
 #include "uint256.h"
 
@@ -298,7 +299,8 @@ struct CCoinsCacheEntry
     CCoinsCacheEntry() : coins(), flags(0) {}
 };
 
-typedef std::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/** Coins cache map; see COpenHashMap for the iterator and pointer guarantees */
+typedef COpenHashMap<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
 
 struct CCoinsStats
 {
@@ -352,6 +354,7 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
+    CCoinsView* GetBackend() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
 };
@@ -397,6 +400,9 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Number of Flush() calls so far. */
+    unsigned int nFlushes;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -447,6 +453,17 @@ public:
      */
     bool Flush();
 
+    //! Number of Flush() calls so far
+    unsigned int GetFlushCount() const { return nFlushes; }
+
+    /**
+     * Cache coins for txid that the caller read from the base view itself,
+     * unless txid is cached already. This lets the reads be done without
+     * the lock protecting this cache. The cache must not have been flushed
+     * since (see GetFlushCount), as the base may then hold newer coins.
+     */
+    void AddCoinsFromBase(const uint256 &txid, CCoins &coins);
+
     /**
      * Removes the transaction with the given hash from the cache, if it is
      * not modified.
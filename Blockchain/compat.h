@@ -64,6 +64,15 @@ typedef u_int SOCKET;
 #define SOCKET_ERROR        -1
 #endif
 
+#ifdef WIN32
+// Only used to gather send buffers; Windows has no sendmsg() and sends them one at a time
+struct iovec
+{
+    void* iov_base;
+    size_t iov_len;
+};
+#endif
+
 #ifdef WIN32
 #ifndef S_IRUSR
 #define S_IRUSR             0400
@@ -93,6 +102,11 @@ typedef u_int SOCKET;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+// epoll lets the socket handler serve descriptors beyond FD_SETSIZE
+#if defined(__linux__)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s) {
 #ifdef WIN32
     return true;
@@ -7,6 +7,8 @@
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 
+#include <mutex>
+
 
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
@@ -101,9 +103,24 @@ CryptoHello& CryptoHello::write(uchar *data, size_t len)
 	return *this;
 }
 
+static void InitCryptoHello()
+{
+	static std::once_flag initFlag;
+	std::call_once(initFlag, [] {
+		initOneWayFunction();
+		selectFastestPowKernels();
+	});
+}
+
 void CryptoHello::finalize(uchar hash[OUTPUT_SIZE])
 {
 	//in = "hashcat";
-	initOneWayFunction();
+	InitCryptoHello();
 	helloHash((const uint8_t *)in.data(), in.size(), hash);
+}
+
+void CryptoHello::Hash(const uchar header[INPUT_LEN], uchar hash[OUTPUT_SIZE])
+{
+	InitCryptoHello();
+	helloHash(header, INPUT_LEN, hash);
 }
\ No newline at end of file
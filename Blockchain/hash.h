@@ -73,6 +73,9 @@ public:
 	explicit CryptoHello(const CBlockHeader *pblock, uchar hash[OUTPUT_SIZE]);
 	CryptoHello& write(uchar *data, size_t len);
 	void finalize(uchar hash[OUTPUT_SIZE]);
+
+	//! Hash a serialized block header in place, using the thread's work memory
+	static void Hash(const uchar header[INPUT_LEN], uchar hash[OUTPUT_SIZE]);
 };
 
 /** A hasher class for Bitcoin's 160-bit hash (SHA-256 + RIPEMD-160). */
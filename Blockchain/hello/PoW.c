@@ -10,76 +10,57 @@
 #ifndef MAC_OSX
 #include <omp.h>
 #endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
 
 #include "my_time.h"
 #include "common.h"
 #include "my_rand48_r.h"
 #include "oneWayFunction.h"
-
-// #define SSE_VERSION
+#include "powKernels.h"
 
 /* 
  * Step 1: Initialize working memory.
 */
 void initWorkMemory(uint8_t *input, uint32_t inputLen, uint8_t *Maddr, const uint32_t K) {
-	uint32_t i, j;
+	uint32_t i;
 	uint8_t a[OUTPUT_LEN], b[OUTPUT_LEN];
+	const PowKernels *kernels = powKernels;
 
 	funcInfor[0].func(input, inputLen, a);
 
 	uint64_t randSeed[4] = {0, 0, 0, 0};
-#ifndef SSE_VERSION
 	struct my_rand48_data randBuffer[4];
-#else
-	struct vrand48_data randBuffer[2];
-#endif
 
 	const uint32_t iterNum = WORK_MEMORY_SIZE >> 5;
 	for (i = 0; i < iterNum; ++i) {
+		uint8_t *row = Maddr + (i << 5);
+		const uint8_t shift_num = fold_u32(i);
 		if (i % K) {
-#ifndef SSE_VERSION
-			uint64_t num = 0;
-			for (j = 0; j < 4; ++j) {
-				my_rand64_r(&randBuffer[j], &num);
-				memcpy(b + (j << 3), (uint8_t *)&num, 8*sizeof(uint8_t));
-			}
-#else
-			vrand64(b, randBuffer);
-#endif
-			
-			uint8_t shift_num;
-			uint8_t result[OUTPUT_LEN];
-			reduce_bit((uint8_t *)&i, 4, (uint8_t *)&shift_num, 8);
-			rrs(b, OUTPUT_LEN, result, shift_num);
-
-			memcpy(Maddr + (i << 5), result, OUTPUT_LEN*sizeof(uint8_t));
-			for (j = 0; j < 32; ++j) {
-				a[j] ^= result[j];
-			}
+			kernels->rand64x4(randBuffer, b);
+			kernels->rrs32(b, row, shift_num);
+			kernels->xor32(a, row);
 		} else {
-			uint8_t t = 0, shift_num = 0;
-			reduce_bit(a, 32, (uint8_t *)&t, 8);
+			uint8_t t = fold_32bytes(a);
 			t = (t & 0x0f) ^ (t >> 4);
-			reduce_bit((uint8_t *)&i, 4, (uint8_t *)&shift_num, 8);
 			
 			uint8_t a_rrs[INPUT_LEN];
-			rrs(a, OUTPUT_LEN, a_rrs, shift_num);
-			funcInfor[t].func(a_rrs, 32, a);
+			kernels->rrs32(a, a_rrs, shift_num);
+			funcInfor[t].func32(a_rrs, 32, a);
 			
 			reduce_bit(a,      8, (uint8_t *)&randSeed[0], 48);
 			reduce_bit(a +  8, 8, (uint8_t *)&randSeed[1], 48);
 			reduce_bit(a + 16, 8, (uint8_t *)&randSeed[2], 48);
 			reduce_bit(a + 24, 8, (uint8_t *)&randSeed[3], 48);
-#ifndef SSE_VERSION
 			my_seed48_r(randSeed[0], &randBuffer[0]);
 			my_seed48_r(randSeed[1], &randBuffer[1]);
 			my_seed48_r(randSeed[2], &randBuffer[2]);
 			my_seed48_r(randSeed[3], &randBuffer[3]);
-#else
-			vseed48(randSeed    , &randBuffer[0]);
-			vseed48(randSeed + 2, &randBuffer[1]);
-#endif
-			memcpy(Maddr + (i << 5), a, 32*sizeof(uint8_t));
+			memcpy(row, a, 32*sizeof(uint8_t));
 		}
 	}
 }
@@ -91,12 +72,12 @@ void modifyWorkMemory(uint8_t *Maddr, const uint32_t L, const uint32_t C,
 		uint8_t *result) {
 	uint32_t i, j;
 	uint8_t a[OUTPUT_LEN], b[64];
+	const PowKernels *kernels = powKernels;
 	
-	funcInfor[0].func(Maddr + WORK_MEMORY_SIZE - 32, 32, a);
+	funcInfor[0].func32(Maddr + WORK_MEMORY_SIZE - 32, 32, a);
 	memcpy(result, a, OUTPUT_LEN*sizeof(uint8_t));
 	
-	uint64_t r = 0;
-	reduce_bit(a, 32, (uint8_t *)&r, 64);
+	uint64_t r = fold_32bytes_u64(a);
 	
 	const uint32_t iterNum = L << 6;
 	for (i = 0; i < C; ++i) {
@@ -109,12 +90,10 @@ void modifyWorkMemory(uint8_t *Maddr, const uint32_t L, const uint32_t C,
 		uint8_t t1, t2, s;
 		uint64_t randNum = 0, base = 0;
 		for (j = 0; j < iterNum; ++j) {
-			my_rand48_r(&randBuffer, &randNum);
+			MY_RAND48_R(&randBuffer, &randNum);
 			base = randNum + r;
 			
-			uint64_t offset = 0;
-			reduce_bit((uint8_t *)&r, 8, (uint8_t *)&offset, 8);
-			offset = (offset << 8) + 1;
+			uint64_t offset = ((uint64_t)fold_u64(r) << 8) + 1;
 			
 			uint64_t addr1 = (base + WORK_MEMORY_SIZE - offset) % WORK_MEMORY_SIZE;
 			uint64_t addr2 = (base + offset) % WORK_MEMORY_SIZE;
@@ -130,23 +109,20 @@ void modifyWorkMemory(uint8_t *Maddr, const uint32_t L, const uint32_t C,
 			r = r + s + t1 + t2;
 		}
 		
-		uint8_t t = 0;
-		reduce_bit((uint8_t *)&r, 8, (uint8_t *)&t, 8);
+		uint8_t t = fold_u64(r);
 		t = (t & 0x0f) ^ (t >> 4);
 		
-		reduce_bit(b, 64, a, 256);
+		// reduce_bit(b, 64, a, 256)
+		memcpy(a, b, OUTPUT_LEN*sizeof(uint8_t));
+		kernels->xor32(a, b + 32);
 		
-		uint8_t shift_num = 0;
-		uint64_t ir = r + i;
-		reduce_bit((uint8_t *)&ir, 8, (uint8_t *)&shift_num, 8);
+		uint8_t shift_num = fold_u64(r + i);
 
 		uint8_t a_rrs[INPUT_LEN];
-		rrs(a, OUTPUT_LEN, a_rrs, shift_num);
-		funcInfor[t].func(a_rrs, 32, a);
+		kernels->rrs32(a, a_rrs, shift_num);
+		funcInfor[t].func32(a_rrs, 32, a);
 		
-		for (j = 0; j < OUTPUT_LEN; ++j) {
-			result[j] ^= a[j];
-		}
+		kernels->xor32(result, a);
 	}
 }
 
@@ -154,44 +130,38 @@ void modifyWorkMemory(uint8_t *Maddr, const uint32_t L, const uint32_t C,
  * Step 3: Calculate the final result.
 */
 void calculateFinalResult(uint8_t *Maddr, uint8_t *c, const uint32_t D, uint8_t *result) {
-	uint32_t i = 0, j = 0, k = 0;
+	uint32_t i = 0, j = 0;
+	const PowKernels *kernels = powKernels;
 	memcpy(result, c, OUTPUT_LEN*sizeof(uint8_t));
 	
 	const uint32_t num = (WORK_MEMORY_SIZE >> 5) - 1;
 	
-	uint32_t it = 0;
 	uint8_t result_rrs[OUTPUT_LEN];
 	while(1) {
-		uint8_t t = 0, shift_num = 0;
+		uint8_t t = fold_32bytes(result), shift_num = 0;
 		uint32_t d = 0;
-		reduce_bit(result, 32, (uint8_t *)&t, 8);
 		t = (t & 0x0f) ^ (t >> 4);
 		
 		reduce_bit(result, 32, (uint8_t *)&d, D);
 		++d;
 		
 		for (j = 0; j < d; ++j) {
-			uint32_t index = i << 5;
-			for (k = 0; k < 32; ++k) {
-				result[k] ^= Maddr[index + k];
-			}
+			kernels->xor32(result, Maddr + (i << 5));
 			++i;
 
 			if (i == num) {
-				it = i + t;
-				reduce_bit((uint8_t *)&it, 4, (uint8_t *)&shift_num, 8);
+				shift_num = fold_u32(i + t);
 
-				rrs(result, OUTPUT_LEN, result_rrs, shift_num);
-				funcInfor[0].func(result_rrs, 32, result);
+				kernels->rrs32(result, result_rrs, shift_num);
+				funcInfor[0].func32(result_rrs, 32, result);
 				
 				return;
 			}
 		}
-		it = t + i;
-		reduce_bit((uint8_t *)&it, 4, (uint8_t *)&shift_num, 8);
+		shift_num = fold_u32(t + i);
 
-		rrs(result, OUTPUT_LEN, result_rrs, shift_num);
-		funcInfor[t].func(result_rrs, 32, result);
+		kernels->rrs32(result, result_rrs, shift_num);
+		funcInfor[t].func32(result_rrs, 32, result);
 	}
 }
                                                                                                                                                                                                                                                                                                        
@@ -220,55 +190,69 @@ void testPowFunction(uint8_t *mess, uint32_t messLen, const int64_t iterNum) {
 	view_data_u8("PoW", output, OUTPUT_LEN);
 	printf("*********************************************************************************************\n");
 
-	/*	
+#ifdef _OPENMP
 	printf("*************************************************** Performance test (PoW function) ***************************************************\n");
 	uint8_t *result = (uint8_t *)malloc(iterNum * OUTPUT_LEN * sizeof(uint8_t));
 	assert(NULL != result);
 	memset(result, 0, iterNum * OUTPUT_LEN * sizeof(uint8_t));
-	
-	uint32_t threadNumArr[] = {1, 4, 8, 12, 16, 20, 24, 32, 48, 64};
+
+	uint8_t header[INPUT_LEN];
+	memset(header, 0, INPUT_LEN*sizeof(uint8_t));
+	memcpy(header, mess, messLen*sizeof(char));
+	uint8_t expected[OUTPUT_LEN];
+	helloHash(header, INPUT_LEN, expected);
+
+	uint32_t threadNumArr[] = {1, 2, 4, 8, 12, 16, 24, 32, 48, 64};
 	uint32_t threadNumTypes = sizeof(threadNumArr) / sizeof(uint32_t);
+	const uint32_t maxThreads = (uint32_t)omp_get_num_procs();
 	printf("   %-18s", "Algorithm");
-	for (uint32_t ix = 0; ix < threadNumTypes; ++ix)
+	for (uint32_t ix = 0; ix < threadNumTypes && threadNumArr[ix] <= maxThreads; ++ix)
 		printf("%12d", threadNumArr[ix]);
 	printf("\n");
-	
-	printf("00 %-18s\t", "PoW");
-	for (uint32_t ix = 0; ix < threadNumTypes; ++ix) {
-		omp_set_num_threads(threadNumArr[ix]);
-		double startTime = get_wall_time();
-		if (threadNumArr[ix] == 1) {
-			for (j = 0; j < iterNum; ++j) {
-				powFunction(input, inputLen, Maddr, result + j * OUTPUT_LEN);
-			}
-		} else {
-			#pragma omp parallel for firstprivate(input), private(j) shared(result)
+
+	// 00: work memory allocated and cleared per hash (the former helloHash)
+	// 01: per-thread work memory arena
+	for (int arena = 0; arena < 2; ++arena) {
+		printf("%02d %-18s\t", arena, arena ? "helloHash(arena)" : "helloHash(malloc)");
+		for (uint32_t ix = 0; ix < threadNumTypes && threadNumArr[ix] <= maxThreads; ++ix) {
+			omp_set_num_threads(threadNumArr[ix]);
+			double startTime = get_wall_time();
+			#pragma omp parallel for private(j) shared(result, header)
 			for (j = 0; j < iterNum; ++j) {
-				powFunction(input, inputLen, Maddr + omp_get_thread_num() * WORK_MEMORY_SIZE, result + j * OUTPUT_LEN);
+				if (arena) {
+					helloHash(header, INPUT_LEN, result + j * OUTPUT_LEN);
+				} else {
+					uint8_t *mem = (uint8_t *)malloc(WORK_MEMORY_SIZE*sizeof(uint8_t));
+					assert(NULL != mem);
+					memset(mem, 0, WORK_MEMORY_SIZE*sizeof(uint8_t));
+					powFunction(header, INPUT_LEN, mem, result + j * OUTPUT_LEN);
+					free(mem);
+				}
 			}
-		}
-		double endTime = get_wall_time();
-		double costTime = endTime - startTime;
-		printf("%5.0f bps   ", iterNum / costTime); fflush(stdout);
-		
-		// Check result
-		for (j = 0; j < iterNum; j += 1) {
-			if (memcmp(output, result + j * OUTPUT_LEN, OUTPUT_LEN)) {
-				printf("Thread num: %d, j: %ld\n", threadNumArr[ix], j);
-				view_data_u8("output", output, OUTPUT_LEN);
-				view_data_u8("result", result + j * OUTPUT_LEN, OUTPUT_LEN);
-				abort();
+			double endTime = get_wall_time();
+			double costTime = endTime - startTime;
+			printf("%7.0f hps ", iterNum / costTime); fflush(stdout);
+
+			// Check result
+			for (j = 0; j < iterNum; j += 1) {
+				if (memcmp(expected, result + j * OUTPUT_LEN, OUTPUT_LEN)) {
+					printf("Thread num: %d, j: %ld\n", threadNumArr[ix], (long)j);
+					view_data_u8("expected", expected, OUTPUT_LEN);
+					view_data_u8("result", result + j * OUTPUT_LEN, OUTPUT_LEN);
+					abort();
+				}
 			}
 		}
+		printf("\n");
 	}
-	printf("\n");
+
 	printf("***************************************************************************************************************************************\n");
-	
+
 	if (NULL != result) {
 		free(result);
 		result = NULL;
 	}
-	*/
+#endif
 
 	if (NULL != Maddr) {
 		free(Maddr);
@@ -353,6 +337,86 @@ void powNistTest(const char *outFileName) {
 }
 
 
+/*
+ * Per-thread work memory arena.
+ * Every row of Maddr is written by initWorkMemory before it is read, so the
+ * buffer needs no clearing between hashes and can live as long as its thread.
+*/
+#define HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+typedef struct {
+	uint8_t *addr;
+	size_t len;
+} WorkMemoryArena;
+
+static int allocWorkMemory(WorkMemoryArena *arena) {
+#ifdef _WIN32
+	arena->len = WORK_MEMORY_SIZE;
+	arena->addr = (uint8_t *)VirtualAlloc(NULL, arena->len, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	return NULL != arena->addr;
+#else
+	void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	// Explicit huge pages, if the administrator reserved any
+	arena->len = HUGE_PAGE_SIZE;
+	p = mmap(NULL, arena->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (MAP_FAILED == p) {
+		// Otherwise ask for a transparent huge page
+		arena->len = HUGE_PAGE_SIZE;
+		p = mmap(NULL, arena->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == p)
+			return 0;
+#ifdef MADV_HUGEPAGE
+		madvise(p, arena->len, MADV_HUGEPAGE);
+#endif
+	}
+	arena->addr = (uint8_t *)p;
+	return 1;
+#endif
+}
+
+#ifdef _WIN32
+// Freed by the OS at process exit; threads hashing PoW live as long as the process.
+static __declspec(thread) WorkMemoryArena threadArena;
+
+uint8_t *getThreadWorkMemory() {
+	if (NULL == threadArena.addr && !allocWorkMemory(&threadArena))
+		return NULL;
+	return threadArena.addr;
+}
+#else
+static pthread_key_t arenaKey;
+static pthread_once_t arenaKeyOnce = PTHREAD_ONCE_INIT;
+
+static void freeWorkMemory(void *p) {
+	WorkMemoryArena *arena = (WorkMemoryArena *)p;
+	munmap(arena->addr, arena->len);
+	free(arena);
+}
+
+static void makeArenaKey() {
+	pthread_key_create(&arenaKey, freeWorkMemory);
+}
+
+uint8_t *getThreadWorkMemory() {
+	pthread_once(&arenaKeyOnce, makeArenaKey);
+
+	WorkMemoryArena *arena = (WorkMemoryArena *)pthread_getspecific(arenaKey);
+	if (NULL == arena) {
+		arena = (WorkMemoryArena *)malloc(sizeof(WorkMemoryArena));
+		if (NULL == arena)
+			return NULL;
+		if (!allocWorkMemory(arena)) {
+			free(arena);
+			return NULL;
+		}
+		pthread_setspecific(arenaKey, arena);
+	}
+	return arena->addr;
+}
+#endif
+
 void helloHash(const uint8_t *mess, size_t messLen, uint8_t output[OUTPUT_LEN]) {
     if(messLen != INPUT_LEN)
     {
@@ -360,24 +424,43 @@ void helloHash(const uint8_t *mess, size_t messLen, uint8_t output[OUTPUT_LEN])
 	printf("helloHash:Invalid message length %d\n", messLen);
 	return;
     }
-    int64_t j;
-    size_t inputLen =messLen; 
-    uint8_t input[INPUT_LEN];
-    memset(input, 0, INPUT_LEN*sizeof(uint8_t));
-    memcpy(input, mess, inputLen*sizeof(char));      //operation: input
 
-    uint8_t *Maddr = (uint8_t *)malloc(WORK_MEMORY_SIZE*sizeof(uint8_t));  //1024*1024*1
+    uint8_t *Maddr = getThreadWorkMemory();
     assert(NULL != Maddr);
-    memset(Maddr, 0, WORK_MEMORY_SIZE*sizeof(uint8_t));
 
-    //printf("Test message: %s\n", mess);
-    powFunction(input, inputLen,Maddr, output);
-    //view_data_u8("PoW", output, OUTPUT_LEN);        //output
-    
-    if (NULL != Maddr) {
-        free(Maddr);
-        Maddr = NULL;
-    }
+    // The one-way functions only read their input, hash the caller's buffer in place
+    powFunction((uint8_t *)mess, messLen, Maddr, output);
+}
+
+void selectFastestPowKernels() {
+	uint8_t *Maddr = getThreadWorkMemory();
+	if (NULL == Maddr)
+		return;
+
+	uint8_t input[INPUT_LEN], output[OUTPUT_LEN];
+	memset(input, 0, INPUT_LEN*sizeof(uint8_t));
+
+	int bestId = -1;
+	double bestTime = 0;
+	for (int id = POW_KERNELS_GENERIC; id < POW_KERNELS_NUM; ++id) {
+		if (!selectPowKernels(id))
+			continue;
+		// Best of a few hashes, the first one also faults the work memory in
+		double minTime = 0;
+		for (int i = 0; i < 3; ++i) {
+			double startTime = get_wall_time();
+			powFunction(input, INPUT_LEN, Maddr, output);
+			double costTime = get_wall_time() - startTime;
+			if (0 == i || costTime < minTime)
+				minTime = costTime;
+		}
+		if (bestId < 0 || minTime < bestTime) {
+			bestId = id;
+			bestTime = minTime;
+		}
+	}
+	if (bestId >= 0)
+		selectPowKernels(bestId);
 }
 
 int my_rand64_r (struct my_rand48_data *buffer, uint64_t *result)
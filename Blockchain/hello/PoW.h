@@ -10,6 +10,9 @@
 #define WORK_MEMORY_SIZE (1024*1024)
 #define OUTPUT_LEN	32
 
+// Offset of the 256-bit nonce in the serialized block header
+#define POW_NONCE_OFFSET	108
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -39,6 +42,19 @@ extern "C" {
      * hash function
     */
     void helloHash(const uint8_t *mess, size_t messLen, uint8_t output[OUTPUT_LEN]);
+
+	/*
+	 * Time a hash under each kernel set the CPU supports and keep the
+	 * fastest. Wider isn't always faster: AVX2 has measured slower than
+	 * SSE4.2. Call after initOneWayFunction(), before hashing on other threads.
+	*/
+	void selectFastestPowKernels();
+
+	/*
+	 * Work memory of the calling thread, allocated on first use (huge pages
+	 * where available) and released when the thread exits.
+	*/
+	uint8_t *getThreadWorkMemory();
 	
 
 
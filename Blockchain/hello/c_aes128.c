@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <openssl/md5.h>
@@ -9,6 +10,21 @@
 #include <openssl/aes.h>
 
 #include "common.h"
+#include "c_digest_block.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define AES128_NI
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AES __attribute__((target("aes,sse2")))
+#else
+#define TARGET_AES
+#endif
 
 /*
  * 功能：单向函数 AES128
@@ -48,3 +64,89 @@ void crypto_aes128(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 
 	memcpy(output, result, OUTPUT_LEN*sizeof(uint8_t));
 }
+
+// Fixed 32-byte input: sha256 and md5 are single blocks
+void crypto_aes128_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t sha256Digest[SHA256_DIGEST_LENGTH], md5Digest[MD5_DIGEST_LENGTH];
+	assert(32 == inputLen);
+	sha256_md5_block(input, 32, sha256Digest, md5Digest);
+
+	AES_KEY akey;
+	if(AES_set_encrypt_key(md5Digest, 128, &akey) < 0) {
+		fprintf(stderr, "AES_set_encrypt_key failed in crypt!\n");
+		abort();
+	}
+	AES_encrypt(sha256Digest, output, &akey);
+	AES_encrypt(sha256Digest + AES_BLOCK_SIZE, output + AES_BLOCK_SIZE, &akey);
+}
+
+#ifdef AES128_NI
+
+// One round of the AES-128 key schedule, rcon folded in by aeskeygenassist
+TARGET_AES static inline __m128i aes128_expand(__m128i key, __m128i assist) {
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+#define AES128_EXPAND(k, i, rcon) \
+	k[i] = aes128_expand(k[i - 1], _mm_aeskeygenassist_si128(k[i - 1], rcon))
+
+/*
+ * crypto_aes128_32 with the key schedule and both block encryptions on
+ * AES-NI. The OpenSSL AES_* API stays on its table implementation.
+*/
+TARGET_AES void crypto_aes128_32_ni(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t sha256Digest[SHA256_DIGEST_LENGTH], md5Digest[MD5_DIGEST_LENGTH];
+	assert(32 == inputLen);
+	sha256_md5_block(input, 32, sha256Digest, md5Digest);
+
+	__m128i k[11];
+	k[0] = _mm_loadu_si128((const __m128i *)md5Digest);
+	AES128_EXPAND(k,  1, 0x01);
+	AES128_EXPAND(k,  2, 0x02);
+	AES128_EXPAND(k,  3, 0x04);
+	AES128_EXPAND(k,  4, 0x08);
+	AES128_EXPAND(k,  5, 0x10);
+	AES128_EXPAND(k,  6, 0x20);
+	AES128_EXPAND(k,  7, 0x40);
+	AES128_EXPAND(k,  8, 0x80);
+	AES128_EXPAND(k,  9, 0x1b);
+	AES128_EXPAND(k, 10, 0x36);
+
+	__m128i b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)sha256Digest), k[0]);
+	__m128i b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(sha256Digest + AES_BLOCK_SIZE)), k[0]);
+	for (int i = 1; i < 10; ++i) {
+		b0 = _mm_aesenc_si128(b0, k[i]);
+		b1 = _mm_aesenc_si128(b1, k[i]);
+	}
+	_mm_storeu_si128((__m128i *)output, _mm_aesenclast_si128(b0, k[10]));
+	_mm_storeu_si128((__m128i *)(output + AES_BLOCK_SIZE), _mm_aesenclast_si128(b1, k[10]));
+}
+
+int crypto_aes128_ni_supported() {
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("aes");
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] >> 25) & 1;
+#else
+	return 0;
+#endif
+}
+
+#else
+
+void crypto_aes128_32_ni(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	crypto_aes128_32(input, inputLen, output);
+}
+
+int crypto_aes128_ni_supported() {
+	return 0;
+}
+
+#endif // AES128_NI
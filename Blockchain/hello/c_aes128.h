@@ -14,6 +14,17 @@ extern "C" {
 	*/
 	void crypto_aes128(uint8_t *input, uint32_t inputLen, uint8_t *output);
 
+	/*
+	 * Same as above for the fixed 32-byte inputs of the PoW loops
+	*/
+	void crypto_aes128_32(uint8_t *input, uint32_t inputLen, uint8_t *output);
+
+	/*
+	 * AES-NI version of crypto_aes128_32, when crypto_aes128_ni_supported()
+	*/
+	void crypto_aes128_32_ni(uint8_t *input, uint32_t inputLen, uint8_t *output);
+	int crypto_aes128_ni_supported();
+
 #ifdef __cplusplus
 }
 #endif
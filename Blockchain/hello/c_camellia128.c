@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <openssl/md5.h>
@@ -9,6 +10,7 @@
 #include <openssl/camellia.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 
 /*
  * 功能：单向函数 Camellia(128bits)
@@ -48,3 +50,18 @@ void crypto_camellia128(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 
 	memcpy(output, result, OUTPUT_LEN*sizeof(uint8_t));
 }
+
+// Fixed 32-byte input: sha256 and md5 are single blocks
+void crypto_camellia128_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t sha256Digest[SHA256_DIGEST_LENGTH], md5Digest[MD5_DIGEST_LENGTH];
+	assert(32 == inputLen);
+	sha256_md5_block(input, 32, sha256Digest, md5Digest);
+
+	CAMELLIA_KEY akey;
+	if(Camellia_set_key(md5Digest, 128, &akey) < 0) {
+		fprintf(stderr, "Camellia_set_key failed in crypt!\n");
+		abort();
+	}
+	Camellia_encrypt(sha256Digest, output, &akey);
+	Camellia_encrypt(sha256Digest + CAMELLIA_BLOCK_SIZE, output + CAMELLIA_BLOCK_SIZE, &akey);
+}
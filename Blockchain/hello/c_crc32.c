@@ -2,11 +2,13 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <openssl/sha.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 #include "jtr_crc32.h"
 
 /*
@@ -32,4 +34,18 @@ void crypto_crc32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 		CRC32_Update(&crc, &sha256Digest[i], 4);
 		CRC32_Final(&output[i], crc);
 	}
-}
\ No newline at end of file
+}
+
+// Fixed 32-byte input: sha256 is a single block
+void crypto_crc32_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t sha256Digest[SHA256_DIGEST_LENGTH];
+	assert(32 == inputLen);
+	sha256_block(input, 32, sha256Digest);
+
+	CRC32_t crc;
+	for (uint32_t i = 0; i < SHA256_DIGEST_LENGTH; i += 4) {
+		CRC32_Init(&crc);
+		CRC32_Update(&crc, &sha256Digest[i], 4);
+		CRC32_Final(&output[i], crc);
+	}
+}
@@ -15,6 +15,11 @@ extern "C" {
 	void CRC32_Table_Init();
 	void crypto_crc32(uint8_t *input, uint32_t inputLen, uint8_t *output);
 
+	/*
+	 * Same as above for the fixed 32-byte inputs of the PoW loops
+	*/
+	void crypto_crc32_32(uint8_t *input, uint32_t inputLen, uint8_t *output);
+
 #ifdef __cplusplus
 }
 #endif
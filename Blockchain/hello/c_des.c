@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <openssl/md5.h>
@@ -9,6 +10,7 @@
 #include <openssl/des.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 
 #define DES_BLOCK_SIZE 8
 
@@ -52,3 +54,15 @@ void crypto_des(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 
 	memcpy(output, result, OUTPUT_LEN*sizeof(uint8_t));
 }
+
+// Fixed 32-byte input: sha256 and md5 are single blocks
+void crypto_des_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t sha256Digest[SHA256_DIGEST_LENGTH], md5Digest[MD5_DIGEST_LENGTH];
+	assert(32 == inputLen);
+	sha256_md5_block(input, 32, sha256Digest, md5Digest);
+
+	DES_key_schedule akey;
+	DES_set_key_unchecked((const_DES_cblock *)md5Digest, &akey);
+	for (uint32_t i = 0; i < OUTPUT_LEN; i += DES_BLOCK_SIZE)
+		DES_ecb_encrypt((const_DES_cblock *)(sha256Digest + i), (const_DES_cblock *)(output + i), &akey, DES_ENCRYPT);
+}
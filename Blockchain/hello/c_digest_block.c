@@ -0,0 +1,142 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+#include "c_digest_block.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+#include <openssl/ripemd.h>
+
+/*
+ * Digest words are stored whole: byte-wise stores of the output stall the
+ * vector loads the PoW loops then issue on it.
+*/
+#if defined(_MSC_VER)
+#define digest_bswap32(x)	_byteswap_ulong(x)
+#define digest_bswap64(x)	_byteswap_uint64(x)
+#else
+#define digest_bswap32(x)	__builtin_bswap32(x)
+#define digest_bswap64(x)	__builtin_bswap64(x)
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define DIGEST_HOST_BIG_ENDIAN	1
+#else
+#define DIGEST_HOST_BIG_ENDIAN	0
+#endif
+
+static inline void store_be32(uint8_t *p, uint32_t v) {
+	if (!DIGEST_HOST_BIG_ENDIAN)
+		v = digest_bswap32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline void store_le32(uint8_t *p, uint32_t v) {
+	if (DIGEST_HOST_BIG_ENDIAN)
+		v = digest_bswap32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline void store_be64(uint8_t *p, uint64_t v) {
+	if (!DIGEST_HOST_BIG_ENDIAN)
+		v = digest_bswap64(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline void store_le64(uint8_t *p, uint64_t v) {
+	if (DIGEST_HOST_BIG_ENDIAN)
+		v = digest_bswap64(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+/*
+ * Merkle-Damgard padding of a single block: 0x80, zeros and the 64-bit
+ * bit length at the end of the block.
+*/
+static inline void pad_block(uint8_t *block, uint32_t blockLen, const uint8_t *input,
+		uint32_t inputLen, int bigEndian) {
+	const uint64_t bits = (uint64_t)inputLen << 3;
+	memcpy(block, input, inputLen);
+	memset(block + inputLen, 0, blockLen - inputLen);
+	block[inputLen] = 0x80;
+	if (bigEndian)
+		store_be64(block + blockLen - 8, bits);
+	else
+		store_le64(block + blockLen - 8, bits);
+}
+
+void md5_block(const uint8_t *input, uint32_t inputLen, uint8_t output[16]) {
+	assert(inputLen <= DIGEST_BLOCK_MAX_LEN);
+	uint8_t block[MD5_CBLOCK];
+	pad_block(block, MD5_CBLOCK, input, inputLen, 0);
+
+	MD5_CTX ctx;
+	MD5_Init(&ctx);
+	MD5_Transform(&ctx, block);
+	store_le32(output,      ctx.A);
+	store_le32(output +  4, ctx.B);
+	store_le32(output +  8, ctx.C);
+	store_le32(output + 12, ctx.D);
+}
+
+void sha1_block(const uint8_t *input, uint32_t inputLen, uint8_t output[20]) {
+	assert(inputLen <= DIGEST_BLOCK_MAX_LEN);
+	uint8_t block[SHA_CBLOCK];
+	pad_block(block, SHA_CBLOCK, input, inputLen, 1);
+
+	SHA_CTX ctx;
+	SHA1_Init(&ctx);
+	SHA1_Transform(&ctx, block);
+	store_be32(output,      ctx.h0);
+	store_be32(output +  4, ctx.h1);
+	store_be32(output +  8, ctx.h2);
+	store_be32(output + 12, ctx.h3);
+	store_be32(output + 16, ctx.h4);
+}
+
+void ripemd160_block(const uint8_t *input, uint32_t inputLen, uint8_t output[20]) {
+	assert(inputLen <= DIGEST_BLOCK_MAX_LEN);
+	uint8_t block[RIPEMD160_CBLOCK];
+	pad_block(block, RIPEMD160_CBLOCK, input, inputLen, 0);
+
+	RIPEMD160_CTX ctx;
+	RIPEMD160_Init(&ctx);
+	RIPEMD160_Transform(&ctx, block);
+	store_le32(output,      ctx.A);
+	store_le32(output +  4, ctx.B);
+	store_le32(output +  8, ctx.C);
+	store_le32(output + 12, ctx.D);
+	store_le32(output + 16, ctx.E);
+}
+
+void sha256_block(const uint8_t *input, uint32_t inputLen, uint8_t output[32]) {
+	assert(inputLen <= DIGEST_BLOCK_MAX_LEN);
+	uint8_t block[SHA256_CBLOCK];
+	pad_block(block, SHA256_CBLOCK, input, inputLen, 1);
+
+	SHA256_CTX ctx;
+	SHA256_Init(&ctx);
+	SHA256_Transform(&ctx, block);
+	for (uint32_t i = 0; i < 8; ++i)
+		store_be32(output + (i << 2), ctx.h[i]);
+}
+
+void sha512_block(const uint8_t *input, uint32_t inputLen, uint8_t output[64]) {
+	assert(inputLen <= DIGEST512_BLOCK_MAX_LEN);
+	uint8_t block[SHA512_CBLOCK];
+	pad_block(block, SHA512_CBLOCK, input, inputLen, 1);
+
+	SHA512_CTX ctx;
+	SHA512_Init(&ctx);
+	SHA512_Transform(&ctx, block);
+	for (uint32_t i = 0; i < 8; ++i)
+		store_be64(output + (i << 3), ctx.h[i]);
+}
+
+void sha256_md5_block(const uint8_t *input, uint32_t inputLen,
+		uint8_t sha256Digest[32], uint8_t md5Digest[16]) {
+	sha256_block(input, inputLen, sha256Digest);
+	md5_block(sha256Digest, SHA256_DIGEST_LENGTH, md5Digest);
+}
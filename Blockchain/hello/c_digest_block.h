@@ -0,0 +1,37 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+#ifndef C_DIGEST_BLOCK_H
+#define C_DIGEST_BLOCK_H
+
+#include <stdint.h>
+
+/*
+ * Digests of messages that fit in a single compression block once padded,
+ * as the fixed 32-byte inputs of the PoW loops do. The block is padded
+ * in place and compressed directly, skipping the CTX buffering of the
+ * Update/Final API. Results are identical to the OpenSSL one-shot digests.
+*/
+#define DIGEST_BLOCK_MAX_LEN	55		// 64-byte block minus padding
+#define DIGEST512_BLOCK_MAX_LEN	111		// 128-byte block minus padding
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	void md5_block(const uint8_t *input, uint32_t inputLen, uint8_t output[16]);
+	void sha1_block(const uint8_t *input, uint32_t inputLen, uint8_t output[20]);
+	void ripemd160_block(const uint8_t *input, uint32_t inputLen, uint8_t output[20]);
+	void sha256_block(const uint8_t *input, uint32_t inputLen, uint8_t output[32]);
+	void sha512_block(const uint8_t *input, uint32_t inputLen, uint8_t output[64]);
+
+	/*
+	 * sha256($input) and md5(sha256($input)), the key derivation shared by
+	 * the AES, DES, RC4 and Camellia one-way functions.
+	*/
+	void sha256_md5_block(const uint8_t *input, uint32_t inputLen,
+			uint8_t sha256Digest[32], uint8_t md5Digest[16]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
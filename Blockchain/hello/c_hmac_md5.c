@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <openssl/md5.h>
@@ -10,6 +11,7 @@
 #include <openssl/opensslv.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 
 /*
  * 功能：单向函数 HMAC MD5
@@ -48,3 +50,34 @@ void crypto_hmac_md5(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 	
 	memcpy(output, sha256Digest, OUTPUT_LEN*sizeof(uint8_t));
 }
+
+/*
+ * Fixed 32-byte input. The key fits in one MD5 block, so HMAC reduces to
+ * md5((key ^ opad) || md5((key ^ ipad) || input)) on stack contexts,
+ * without the heap-allocated EVP HMAC_CTX.
+*/
+void crypto_hmac_md5_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t hmacMd5Digest[MD5_DIGEST_LENGTH];
+	uint8_t ipad[MD5_CBLOCK], opad[MD5_CBLOCK];
+	assert(32 == inputLen);
+
+	memset(ipad, 0x36, MD5_CBLOCK);
+	memset(opad, 0x5c, MD5_CBLOCK);
+	for (uint32_t i = 0; i < 32; ++i) {
+		ipad[i] ^= input[i];
+		opad[i] ^= input[i];
+	}
+
+	MD5_CTX ctx;
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, ipad, MD5_CBLOCK);
+	MD5_Update(&ctx, input, 32);
+	MD5_Final(hmacMd5Digest, &ctx);
+
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, opad, MD5_CBLOCK);
+	MD5_Update(&ctx, hmacMd5Digest, MD5_DIGEST_LENGTH);
+	MD5_Final(hmacMd5Digest, &ctx);
+
+	sha256_block(hmacMd5Digest, MD5_DIGEST_LENGTH, output);
+}
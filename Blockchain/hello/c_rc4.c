@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <openssl/md5.h>
@@ -10,6 +11,7 @@
 #include <openssl/rc4.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 
 /*
  * 功能：单向函数 RC4
@@ -44,3 +46,14 @@ void crypto_rc4(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 
 	memcpy(output, result, OUTPUT_LEN*sizeof(uint8_t));
 }
+
+// Fixed 32-byte input: sha256 and md5 are single blocks
+void crypto_rc4_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t sha256Digest[SHA256_DIGEST_LENGTH], md5Digest[MD5_DIGEST_LENGTH];
+	assert(32 == inputLen);
+	sha256_md5_block(input, 32, sha256Digest, md5Digest);
+
+	RC4_KEY akey;
+	RC4_set_key(&akey, MD5_DIGEST_LENGTH, md5Digest);
+	RC4(&akey, SHA256_DIGEST_LENGTH, sha256Digest, output);
+}
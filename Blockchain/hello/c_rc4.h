@@ -9,6 +9,11 @@ extern "C" {
 
 	void crypto_rc4(uint8_t *input, uint32_t inputLen, uint8_t *output) ;
 
+	/*
+	 * Same as above for the fixed 32-byte inputs of the PoW loops
+	*/
+	void crypto_rc4_32(uint8_t *input, uint32_t inputLen, uint8_t *output);
+
 #ifdef __cplusplus
 }
 #endif	
@@ -2,9 +2,11 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <assert.h>
 #include <openssl/ripemd.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 
 /*
  * 功能：单向函数 RIPE-MD160
@@ -28,3 +30,17 @@ void crypto_ripemd160(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 	
 	reduce_bit(result, (RIPEMD160_DIGEST_LENGTH) << 1, output, 256);
 }
+
+// Fixed 32-byte input: both digests are a single RIPEMD-160 block
+void crypto_ripemd160_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t result[(RIPEMD160_DIGEST_LENGTH) << 1];
+	assert(32 == inputLen);
+
+	uint8_t inputStr[32];
+	for(uint32_t i = 0; i < 32; ++i)
+		inputStr[i] = ~(input[i]);
+	ripemd160_block(input, 32, result);
+	ripemd160_block(inputStr, 32, result + RIPEMD160_DIGEST_LENGTH);
+
+	reduce_bit(result, (RIPEMD160_DIGEST_LENGTH) << 1, output, 256);
+}
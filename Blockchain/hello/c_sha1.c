@@ -1,10 +1,12 @@
 ﻿#include "c_sha1.h"
 
 #include <stdint.h>
+#include <assert.h>
 #include <string.h>
 #include <openssl/sha.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 
 /*
  * 功能：单向函数 SHA1
@@ -29,3 +31,18 @@ void crypto_sha1(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 
 	reduce_bit(result, (SHA_DIGEST_LENGTH) << 1, output, 256);
 }
+
+// Fixed 32-byte input: both digests are a single SHA1 block
+void crypto_sha1_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint32_t i;
+	uint8_t result[(SHA_DIGEST_LENGTH) << 1];
+	assert(32 == inputLen);
+
+	uint8_t inputStr[32];
+	for(i = 0; i < 32; ++i)
+		inputStr[i] = ~(input[i]);
+	sha1_block(input, 32, result);
+	sha1_block(inputStr, 32, result + SHA_DIGEST_LENGTH);
+
+	reduce_bit(result, (SHA_DIGEST_LENGTH) << 1, output, 256);
+}
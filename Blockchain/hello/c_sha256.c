@@ -2,9 +2,11 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <assert.h>
 #include <openssl/sha.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 
 /*
  * 功能：单向函数 SHA256
@@ -20,4 +22,10 @@ void crypto_sha256(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 	SHA256_Final(result, &ctx);
 	
 	memcpy(output, result, OUTPUT_LEN*sizeof(uint8_t));
-}
\ No newline at end of file
+}
+
+// Fixed 32-byte input: a single SHA256 block
+void crypto_sha256_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	assert(32 == inputLen);
+	sha256_block(input, 32, output);
+}
@@ -1,6 +1,7 @@
 ﻿#include "c_sha3_256.h"
 
 #include <stdint.h>
+#include <assert.h>
 #include <string.h>
 
 #include "keccak1600.h"
@@ -97,3 +98,20 @@ int sha3_final(KECCAK1600_CTX *ctx, unsigned char *md)
 
     return 1;
 }
+
+// Fixed 32-byte input: one padded rate block absorbed without the CTX buffer
+void crypto_sha3_256_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	const size_t bsz = (1600-512)/8;
+	uint64_t A[5][5];
+	unsigned char block[(1600-512)/8];
+	assert(32 == inputLen);
+
+	memset(A, 0, sizeof(A));
+	memcpy(block, input, 32);
+	memset(block + 32, 0, bsz - 32);
+	block[32] = '\x06';
+	block[bsz - 1] |= 0x80;
+
+	(void)SHA3_absorb(A, block, bsz, bsz);
+	SHA3_squeeze(A, output, 256/8, bsz);
+}
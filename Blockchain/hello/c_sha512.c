@@ -2,9 +2,11 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <assert.h>
 #include <openssl/sha.h>
 
 #include "common.h"
+#include "c_digest_block.h"
 
 /*
  * 功能：单向函数 SHA512
@@ -20,4 +22,14 @@ void crypto_sha512(uint8_t *input, uint32_t inputLen, uint8_t *output) {
 	SHA512_Final(result, &ctx);
 	
 	reduce_bit(result, SHA512_DIGEST_LENGTH, output, 256);
-}
\ No newline at end of file
+}
+
+// Fixed 32-byte input: a single SHA512 block
+void crypto_sha512_32(uint8_t *input, uint32_t inputLen, uint8_t *output) {
+	uint8_t result[SHA512_DIGEST_LENGTH];
+	assert(32 == inputLen);
+
+	sha512_block(input, 32, result);
+
+	reduce_bit(result, SHA512_DIGEST_LENGTH, output, 256);
+}
@@ -35,16 +35,41 @@ static inline void reduce_bit_2(uint8_t *input, uint32_t inputLen,
 	}
 }
 
-void reduce_bit(uint8_t *input, uint32_t inputLen, 
-		uint8_t *output, uint32_t bits);
+/* 
+ * XOR of all bytes: reduce_bit(input, inputLen, output, 8) for the
+ * 4/8/32-byte inputs of the PoW loops, without the per-byte modulo.
+*/
+static inline uint8_t fold_u32(uint32_t x) {
+	x ^= x >> 16;
+	x ^= x >> 8;
+	return (uint8_t)x;
+}
+
+static inline uint8_t fold_u64(uint64_t x) {
+	return fold_u32((uint32_t)(x ^ (x >> 32)));
+}
+
+/* reduce_bit(input, 32, output, 64), as a native-endian word */
+static inline uint64_t fold_32bytes_u64(const uint8_t *input) {
+	uint64_t w[4];
+	memcpy(w, input, sizeof(w));
+	return w[0] ^ w[1] ^ w[2] ^ w[3];
+}
 
-void rrs(uint8_t *input, uint32_t inputLen, 
-		uint8_t *output, uint32_t bits);
+static inline uint8_t fold_32bytes(const uint8_t *input) {
+	return fold_u64(fold_32bytes_u64(input));
+}
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+	void reduce_bit(uint8_t *input, uint32_t inputLen, 
+			uint8_t *output, uint32_t bits);
+
+	void rrs(uint8_t *input, uint32_t inputLen, 
+			uint8_t *output, uint32_t bits);
+
 	void view_data_u8(const char *mess, uint8_t *data, uint32_t len);
 	void view_data_u32(const char *mess, uint32_t *data, uint32_t len);
 
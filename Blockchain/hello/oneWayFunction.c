@@ -12,6 +12,7 @@
 
 #include "my_time.h"
 #include "common.h"
+#include "powKernels.h"
 
 // OpenSSL Library
 #include "c_sha1.h"
@@ -34,37 +35,86 @@
 #include "c_skein512_256.h"
 
 OneWayFunctionInfor funcInfor[FUNCTION_NUM] = {
-	"SHA3-256", 			crypto_sha3_256,
-	"SHA1", 				crypto_sha1,
-	"SHA256", 				crypto_sha256,
-	"SHA512", 				crypto_sha512,
-	"Whirlpool", 			crypto_whirlpool,
-	"RIPEMD-160", 			crypto_ripemd160,
-	"BLAKE2s(256bits)", 	crypto_blake2s256,
-	"AES(128bits)", 		crypto_aes128,
-	"DES", 					crypto_des,
-	"RC4", 					crypto_rc4,
-	"Camellia(128bits)", 	crypto_camellia128,
-	"CRC32", 				crypto_crc32,
-	"HMAC(MD5)", 			crypto_hmac_md5,
-	"GOST R 34.11-94", 		crypto_gost, 
-	"HAVAL-256/5", 			crypto_haval5_256,
-	"Skein-512(256bits)", 	crypto_skein512_256
+	"SHA3-256", 			crypto_sha3_256,		crypto_sha3_256_32,
+	"SHA1", 				crypto_sha1,			crypto_sha1_32,
+	"SHA256", 				crypto_sha256,			crypto_sha256_32,
+	"SHA512", 				crypto_sha512,			crypto_sha512_32,
+	"Whirlpool", 			crypto_whirlpool,		crypto_whirlpool,
+	"RIPEMD-160", 			crypto_ripemd160,		crypto_ripemd160_32,
+	"BLAKE2s(256bits)", 	crypto_blake2s256,		crypto_blake2s256,
+	"AES(128bits)", 		crypto_aes128,			crypto_aes128_32,
+	"DES", 					crypto_des,				crypto_des_32,
+	"RC4", 					crypto_rc4,				crypto_rc4_32,
+	"Camellia(128bits)", 	crypto_camellia128,		crypto_camellia128_32,
+	"CRC32", 				crypto_crc32,			crypto_crc32_32,
+	"HMAC(MD5)", 			crypto_hmac_md5,		crypto_hmac_md5_32,
+	"GOST R 34.11-94", 		crypto_gost,			crypto_gost,
+	"HAVAL-256/5", 			crypto_haval5_256,		crypto_haval5_256,
+	"Skein-512(256bits)", 	crypto_skein512_256,	crypto_skein512_256
 };
 
 void initOneWayFunction() {
 	gost_init_table();
 	CRC32_Table_Init();
+	initPowKernels();
+
+	if (crypto_aes128_ni_supported()) {
+		for (int i = 0; i < FUNCTION_NUM; ++i) {
+			if (crypto_aes128_32 == funcInfor[i].func32)
+				funcInfor[i].func32 = crypto_aes128_32_ni;
+		}
+	}
 }
 
-void testOneWayFunction(const char *mess, uint32_t messLen, const int64_t iterNum) {
-	/*
+/*
+ * Runs func on the same input iterNum times, on threadNum threads when
+ * OpenMP is available. Returns the wall time in seconds.
+*/
+static double timeOneWayFunction(OneWayFunction func, uint8_t *input, uint32_t inputLen,
+		const int64_t iterNum, uint32_t threadNum, uint8_t *result) {
 	int64_t j;
-	uint32_t messLen = (uint32_t)strlen(mess);
+	double startTime = get_wall_time();
+#ifdef _OPENMP
+	if (threadNum > 1) {
+		omp_set_num_threads(threadNum);
+		#pragma omp parallel for firstprivate(input), private(j) shared(result)
+		for (j = 0; j < iterNum; ++j) {
+			func(input, inputLen, result + j * OUTPUT_LEN);
+		}
+		return get_wall_time() - startTime;
+	}
+#endif
+	for (j = 0; j < iterNum; ++j) {
+		func(input, inputLen, result + j * OUTPUT_LEN);
+	}
+	return get_wall_time() - startTime;
+}
+
+static void checkOneWayFunction(const char *funcName, uint8_t *expected,
+		uint8_t *result, const int64_t iterNum) {
+	for (int64_t j = 0; j < iterNum; ++j) {
+		if (memcmp(expected, result + j * OUTPUT_LEN, OUTPUT_LEN)) {
+			printf("%s, j: %ld\n", funcName, (long)j);
+			view_data_u8("expected", expected, OUTPUT_LEN);
+			view_data_u8("result", result + j * OUTPUT_LEN, OUTPUT_LEN);
+			abort();
+		}
+	}
+}
 
+/*
+ * Correctness & Performance test for the one-way functions, on the
+ * 32-byte inputs the PoW loops feed them: generic vs fixed-length
+ * entry, then the fixed-length entry across thread counts.
+*/
+void testOneWayFunction(const char *mess, uint32_t messLen, const int64_t iterNum) {
 	uint8_t input[INPUT_LEN], output[FUNCTION_NUM][OUTPUT_LEN];
 	memset(input, 0, INPUT_LEN*sizeof(uint8_t));
+	if (messLen > INPUT_LEN)
+		messLen = INPUT_LEN;
 	memcpy(input, mess, messLen*sizeof(char));
+
+	initOneWayFunction();
 	
 	printf("**************************** Correctness test (One way function) ****************************\n");
 	printf("Test message: %s\n", mess);
@@ -73,55 +123,56 @@ void testOneWayFunction(const char *mess, uint32_t messLen, const int64_t iterNu
 		funcInfor[i].func(input, messLen, output[i]);
 		view_data_u8(funcInfor[i].funcName, output[i], OUTPUT_LEN);
 	}
+	// The fixed-length entries must agree with the generic ones
+	for (int i = 0; i < FUNCTION_NUM; ++i) {
+		uint8_t expected[OUTPUT_LEN], fixed[OUTPUT_LEN];
+		funcInfor[i].func(input, 32, expected);
+		funcInfor[i].func32(input, 32, fixed);
+		checkOneWayFunction(funcInfor[i].funcName, expected, fixed, 1);
+		memcpy(output[i], expected, OUTPUT_LEN*sizeof(uint8_t));
+	}
 	printf("*********************************************************************************************\n");
 	
 	printf("************************************************* Performance test (One way function) *************************************************\n");
 	uint8_t *result = (uint8_t *)malloc(iterNum * OUTPUT_LEN * sizeof(uint8_t));
 	assert(NULL != result);
 	memset(result, 0, iterNum * OUTPUT_LEN * sizeof(uint8_t));
-	
-	uint32_t threadNumArr[] = {1, 4, 8, 12, 16, 20, 24, 32, 48, 64};
+
+	printf("   %-18s\t%12s%12s\n", "Algorithm", "generic", "fixed32");
+	for (int i = 0; i < FUNCTION_NUM; ++i) {
+		printf("%02d %-18s\t", i, funcInfor[i].funcName);
+		double costTime = timeOneWayFunction(funcInfor[i].func, input, 32, iterNum, 1, result);
+		printf("%7.0f Kps ", iterNum / 1000 / costTime);
+		checkOneWayFunction(funcInfor[i].funcName, output[i], result, iterNum);
+		costTime = timeOneWayFunction(funcInfor[i].func32, input, 32, iterNum, 1, result);
+		printf("%7.0f Kps ", iterNum / 1000 / costTime);
+		checkOneWayFunction(funcInfor[i].funcName, output[i], result, iterNum);
+		printf("\n"); fflush(stdout);
+	}
+
+#ifdef _OPENMP
+	uint32_t threadNumArr[] = {1, 2, 4, 8, 12, 16, 24, 32, 48, 64};
 	uint32_t threadNumTypes = sizeof(threadNumArr) / sizeof(uint32_t);
-	printf("   %-18s", "Algorithm");
-	for (uint32_t ix = 0; ix < threadNumTypes; ++ix)
+	const uint32_t maxThreads = (uint32_t)omp_get_num_procs();
+	printf("\n   %-18s\t", "fixed32 / threads");
+	for (uint32_t ix = 0; ix < threadNumTypes && threadNumArr[ix] <= maxThreads; ++ix)
 		printf("%12d", threadNumArr[ix]);
 	printf("\n");
 	
 	for (int i = 0; i < FUNCTION_NUM; ++i) {
 		printf("%02d %-18s\t", i, funcInfor[i].funcName);
-		for (uint32_t ix = 0; ix < threadNumTypes; ++ix) {
-			omp_set_num_threads(threadNumArr[ix]);
-			double startTime = get_wall_time();
-			if (threadNumArr[ix] == 1) {
-				for (j = 0; j < iterNum; ++j) {
-					funcInfor[i].func(input, messLen, result + j * OUTPUT_LEN);
-				}
-			} else {
-				#pragma omp parallel for firstprivate(input), private(j) shared(result)
-				for (j = 0; j < iterNum; ++j) {
-					funcInfor[i].func(input, messLen, result + j * OUTPUT_LEN);
-				}
-			}
-			double endTime = get_wall_time();
-			double costTime = endTime - startTime;
-			printf("%5.0f Kps   ", iterNum / 1000 / costTime); fflush(stdout);
-			
-			// Check result
-			for (j = 0; j < iterNum; j += 1) {
-				if (memcmp(output[i], result + j * OUTPUT_LEN, OUTPUT_LEN)) {
-					printf("Thread num: %u, j: %ld\n", threadNumArr[ix], j);
-					view_data_u8("output", output[i], OUTPUT_LEN);
-					view_data_u8("result", result + j * OUTPUT_LEN, OUTPUT_LEN);
-					abort();
-				}
-			}
+		for (uint32_t ix = 0; ix < threadNumTypes && threadNumArr[ix] <= maxThreads; ++ix) {
+			double costTime = timeOneWayFunction(funcInfor[i].func32, input, 32, iterNum, threadNumArr[ix], result);
+			printf("%7.0f Kps ", iterNum / 1000 / costTime); fflush(stdout);
+			checkOneWayFunction(funcInfor[i].funcName, output[i], result, iterNum);
 		}
 		printf("\n");
 	}
+#endif
+
 	if (NULL != result) {
 		free(result);
 		result = NULL;
 	}
-	*/
 	printf("***************************************************************************************************************************************\n");
 }
@@ -9,6 +9,7 @@ typedef void (*OneWayFunction)(uint8_t *, uint32_t, uint8_t *);
 typedef struct {
 	const char *funcName;
 	OneWayFunction func;
+	OneWayFunction func32;	// same result, only for the 32-byte inputs of the PoW loops
 } OneWayFunctionInfor;
 
 #define FUNCTION_NUM	16
@@ -0,0 +1,282 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+#include "powKernels.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define POW_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE42
+#define TARGET_AVX2
+#endif
+
+// my_seed48_r constants
+#define RAND48_A	0x5deece66dULL
+#define RAND48_C	0xbULL
+#define RAND48_MASK	0xffffffffffffULL
+
+/*
+ * Reference: the original byte-wise code.
+*/
+static void rrs32_reference(const uint8_t *input, uint8_t *output, uint32_t bits) {
+	rrs((uint8_t *)input, 32, output, bits);
+}
+
+static void xor32_reference(uint8_t *dst, const uint8_t *src) {
+	for (uint32_t j = 0; j < 32; ++j) {
+		dst[j] ^= src[j];
+	}
+}
+
+static void rand64x4_reference(struct my_rand48_data *buffer, uint8_t *output) {
+	uint64_t num = 0;
+	for (uint32_t j = 0; j < 4; ++j) {
+		my_rand64_r(&buffer[j], &num);
+		memcpy(output + (j << 3), (uint8_t *)&num, 8*sizeof(uint8_t));
+	}
+}
+
+/*
+ * Generic: rrs treats the row as a 256-bit big-endian number and rotates it
+ * right, so it can work on four 64-bit words instead of bytes.
+*/
+static inline uint64_t load64_be(const uint8_t *p) {
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+		((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+static inline void store64_be(uint8_t *p, uint64_t v) {
+	for (int i = 7; i >= 0; --i) {
+		p[i] = (uint8_t)v;
+		v >>= 8;
+	}
+}
+
+static void rrs32_generic(const uint8_t *input, uint8_t *output, uint32_t bits) {
+	const uint32_t ws = (bits >> 6) & 3, bs = bits & 63;
+	uint64_t w[4];
+	for (uint32_t k = 0; k < 4; ++k)
+		w[k] = load64_be(input + (k << 3));
+
+	for (uint32_t k = 0; k < 4; ++k) {
+		uint64_t hi = w[(k - ws) & 3], lo = w[(k - ws - 1) & 3];
+		store64_be(output + (k << 3), bs ? (hi >> bs) | (lo << (64 - bs)) : hi);
+	}
+}
+
+static void xor32_generic(uint8_t *dst, const uint8_t *src) {
+	uint64_t d[4], s[4];
+	memcpy(d, dst, sizeof(d));
+	memcpy(s, src, sizeof(s));
+	for (uint32_t k = 0; k < 4; ++k)
+		d[k] ^= s[k];
+	memcpy(dst, d, sizeof(d));
+}
+
+static void rand64x4_generic(struct my_rand48_data *buffer, uint8_t *output) {
+	for (uint32_t j = 0; j < 4; ++j) {
+		uint64_t x = (buffer[j].__x * RAND48_A + RAND48_C) & RAND48_MASK;
+		buffer[j].__x = (x * RAND48_A + RAND48_C) & RAND48_MASK;
+		x ^= buffer[j].__x << 16;
+		memcpy(output + (j << 3), &x, 8);
+	}
+}
+
+#ifdef POW_KERNELS_X86
+
+/*
+ * SSE4.2
+*/
+TARGET_SSE42 static inline __m128i bswap64_sse(__m128i v) {
+	return _mm_shuffle_epi8(v, _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+}
+
+// Words (w[(0 - ws) & 3], w[(1 - ws) & 3]) and (w[(2 - ws) & 3], w[(3 - ws) & 3]) of p = (w0, w1), q = (w2, w3)
+TARGET_SSE42 static inline void rotate_words_sse(__m128i p, __m128i q, uint32_t ws, __m128i *r0, __m128i *r1) {
+	switch (ws & 3) {
+	case 0: *r0 = p; *r1 = q; break;
+	case 1: *r0 = _mm_alignr_epi8(p, q, 8); *r1 = _mm_alignr_epi8(q, p, 8); break;
+	case 2: *r0 = q; *r1 = p; break;
+	default: *r0 = _mm_alignr_epi8(q, p, 8); *r1 = _mm_alignr_epi8(p, q, 8); break;
+	}
+}
+
+TARGET_SSE42 static void rrs32_sse42(const uint8_t *input, uint8_t *output, uint32_t bits) {
+	const uint32_t ws = bits >> 6, bs = bits & 63;
+	__m128i p = bswap64_sse(_mm_loadu_si128((const __m128i *)input));
+	__m128i q = bswap64_sse(_mm_loadu_si128((const __m128i *)(input + 16)));
+
+	__m128i hi0, hi1, lo0, lo1;
+	rotate_words_sse(p, q, ws, &hi0, &hi1);
+	rotate_words_sse(p, q, ws + 1, &lo0, &lo1);
+
+	// A 64-bit shift by 64 yields zero, which covers bs == 0
+	const __m128i rcount = _mm_cvtsi32_si128(bs), lcount = _mm_cvtsi32_si128(64 - bs);
+	__m128i r0 = _mm_or_si128(_mm_srl_epi64(hi0, rcount), _mm_sll_epi64(lo0, lcount));
+	__m128i r1 = _mm_or_si128(_mm_srl_epi64(hi1, rcount), _mm_sll_epi64(lo1, lcount));
+
+	_mm_storeu_si128((__m128i *)output, bswap64_sse(r0));
+	_mm_storeu_si128((__m128i *)(output + 16), bswap64_sse(r1));
+}
+
+TARGET_SSE42 static void xor32_sse42(uint8_t *dst, const uint8_t *src) {
+	__m128i d0 = _mm_loadu_si128((const __m128i *)dst), d1 = _mm_loadu_si128((const __m128i *)(dst + 16));
+	__m128i s0 = _mm_loadu_si128((const __m128i *)src), s1 = _mm_loadu_si128((const __m128i *)(src + 16));
+	_mm_storeu_si128((__m128i *)dst, _mm_xor_si128(d0, s0));
+	_mm_storeu_si128((__m128i *)(dst + 16), _mm_xor_si128(d1, s1));
+}
+
+// (x * RAND48_A + RAND48_C) mod 2^48 per 64-bit lane; x < 2^48 so its high half has 16 bits
+TARGET_SSE42 static inline __m128i lcg48_sse(__m128i x) {
+	const __m128i al = _mm_set1_epi64x(RAND48_A & 0xffffffffULL), ah = _mm_set1_epi64x(RAND48_A >> 32);
+	__m128i xh = _mm_srli_epi64(x, 32);
+	__m128i lo = _mm_mul_epu32(x, al);
+	__m128i mid = _mm_add_epi64(_mm_mul_epu32(x, ah), _mm_mul_epu32(xh, al));
+	__m128i r = _mm_add_epi64(_mm_add_epi64(lo, _mm_slli_epi64(mid, 32)), _mm_set1_epi64x(RAND48_C));
+	return _mm_and_si128(r, _mm_set1_epi64x(RAND48_MASK));
+}
+
+TARGET_SSE42 static void rand64x4_sse42(struct my_rand48_data *buffer, uint8_t *output) {
+	for (uint32_t j = 0; j < 4; j += 2) {
+		__m128i x = _mm_set_epi64x(buffer[j + 1].__x, buffer[j].__x);
+		__m128i x1 = lcg48_sse(x);
+		__m128i x2 = lcg48_sse(x1);
+		buffer[j].__x = (uint64_t)_mm_cvtsi128_si64(x2);
+		buffer[j + 1].__x = (uint64_t)_mm_extract_epi64(x2, 1);
+		_mm_storeu_si128((__m128i *)(output + (j << 3)), _mm_xor_si128(x1, _mm_slli_epi64(x2, 16)));
+	}
+}
+
+/*
+ * AVX2
+*/
+TARGET_AVX2 static inline __m256i bswap64_avx2(__m256i v) {
+	return _mm256_shuffle_epi8(v, _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+}
+
+// vpermd indices taking 64-bit word (k - ws) & 3 into word k
+static const int32_t rotateIndex[4][8] = {
+	{0, 1, 2, 3, 4, 5, 6, 7},
+	{6, 7, 0, 1, 2, 3, 4, 5},
+	{4, 5, 6, 7, 0, 1, 2, 3},
+	{2, 3, 4, 5, 6, 7, 0, 1}
+};
+
+TARGET_AVX2 static void rrs32_avx2(const uint8_t *input, uint8_t *output, uint32_t bits) {
+	const uint32_t ws = bits >> 6, bs = bits & 63;
+	__m256i w = bswap64_avx2(_mm256_loadu_si256((const __m256i *)input));
+	__m256i hi = _mm256_permutevar8x32_epi32(w, _mm256_loadu_si256((const __m256i *)rotateIndex[ws & 3]));
+	__m256i lo = _mm256_permutevar8x32_epi32(w, _mm256_loadu_si256((const __m256i *)rotateIndex[(ws + 1) & 3]));
+
+	// A 64-bit shift by 64 yields zero, which covers bs == 0
+	__m256i r = _mm256_or_si256(_mm256_srl_epi64(hi, _mm_cvtsi32_si128(bs)), _mm256_sll_epi64(lo, _mm_cvtsi32_si128(64 - bs)));
+	_mm256_storeu_si256((__m256i *)output, bswap64_avx2(r));
+}
+
+TARGET_AVX2 static void xor32_avx2(uint8_t *dst, const uint8_t *src) {
+	__m256i d = _mm256_loadu_si256((const __m256i *)dst);
+	__m256i s = _mm256_loadu_si256((const __m256i *)src);
+	_mm256_storeu_si256((__m256i *)dst, _mm256_xor_si256(d, s));
+}
+
+TARGET_AVX2 static inline __m256i lcg48_avx2(__m256i x) {
+	const __m256i al = _mm256_set1_epi64x(RAND48_A & 0xffffffffULL), ah = _mm256_set1_epi64x(RAND48_A >> 32);
+	__m256i xh = _mm256_srli_epi64(x, 32);
+	__m256i lo = _mm256_mul_epu32(x, al);
+	__m256i mid = _mm256_add_epi64(_mm256_mul_epu32(x, ah), _mm256_mul_epu32(xh, al));
+	__m256i r = _mm256_add_epi64(_mm256_add_epi64(lo, _mm256_slli_epi64(mid, 32)), _mm256_set1_epi64x(RAND48_C));
+	return _mm256_and_si256(r, _mm256_set1_epi64x(RAND48_MASK));
+}
+
+TARGET_AVX2 static void rand64x4_avx2(struct my_rand48_data *buffer, uint8_t *output) {
+	__m256i x = _mm256_setr_epi64x(buffer[0].__x, buffer[1].__x, buffer[2].__x, buffer[3].__x);
+	__m256i x1 = lcg48_avx2(x);
+	__m256i x2 = lcg48_avx2(x1);
+
+	uint64_t state[4];
+	_mm256_storeu_si256((__m256i *)state, x2);
+	for (uint32_t j = 0; j < 4; ++j)
+		buffer[j].__x = state[j];
+	_mm256_storeu_si256((__m256i *)output, _mm256_xor_si256(x1, _mm256_slli_epi64(x2, 16)));
+}
+
+static int cpuSupports(int id) {
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	if (POW_KERNELS_SSE42 == id)
+		return __builtin_cpu_supports("sse4.2");
+	return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	const int sse42 = (info[2] >> 20) & 1;
+	const int osxsave = (info[2] >> 27) & 1, avx = (info[2] >> 28) & 1;
+	if (POW_KERNELS_SSE42 == id)
+		return sse42;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] >> 5) & 1;
+#else
+	return 0;
+#endif
+}
+
+#endif // POW_KERNELS_X86
+
+static const PowKernels kernelsTable[POW_KERNELS_NUM] = {
+	{"reference", rrs32_reference, xor32_reference, rand64x4_reference},
+	{"generic", rrs32_generic, xor32_generic, rand64x4_generic},
+#ifdef POW_KERNELS_X86
+	{"sse4.2", rrs32_sse42, xor32_sse42, rand64x4_sse42},
+	{"avx2", rrs32_avx2, xor32_avx2, rand64x4_avx2}
+#else
+	{"sse4.2", NULL, NULL, NULL},
+	{"avx2", NULL, NULL, NULL}
+#endif
+};
+
+const PowKernels *powKernels = &kernelsTable[POW_KERNELS_GENERIC];
+
+int powKernelsSupported(int id) {
+	if (id < 0 || id >= POW_KERNELS_NUM || NULL == kernelsTable[id].rrs32)
+		return 0;
+#ifdef POW_KERNELS_X86
+	if (POW_KERNELS_SSE42 == id || POW_KERNELS_AVX2 == id)
+		return cpuSupports(id);
+#endif
+	return 1;
+}
+
+int selectPowKernels(int id) {
+	if (!powKernelsSupported(id))
+		return 0;
+	powKernels = &kernelsTable[id];
+	return 1;
+}
+
+const PowKernels *getPowKernels(int id) {
+	return powKernelsSupported(id) ? &kernelsTable[id] : NULL;
+}
+
+void initPowKernels() {
+	// By measured speed, selectFastestPowKernels() refines this on the host
+	static const int preferred[] = {POW_KERNELS_SSE42, POW_KERNELS_AVX2, POW_KERNELS_GENERIC};
+	for (uint32_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); ++i) {
+		if (selectPowKernels(preferred[i]))
+			return;
+	}
+}
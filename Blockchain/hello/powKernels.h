@@ -0,0 +1,68 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+#ifndef POW_KERNELS_H
+#define POW_KERNELS_H
+
+#include <stdint.h>
+
+#include "my_rand48_r.h"
+
+/*
+ * rrs(input, 32, output, bits) on one 32-byte row.
+*/
+typedef void (*Rrs32Func)(const uint8_t *input, uint8_t *output, uint32_t bits);
+
+/*
+ * dst[i] ^= src[i] on one 32-byte row.
+*/
+typedef void (*Xor32Func)(uint8_t *dst, const uint8_t *src);
+
+/*
+ * my_rand64_r on four generators seeded by my_seed48_r, generator j
+ * writing its 8 bytes to output + 8 * j.
+*/
+typedef void (*Rand64x4Func)(struct my_rand48_data *buffer, uint8_t *output);
+
+typedef struct {
+	const char *name;
+	Rrs32Func rrs32;
+	Xor32Func xor32;
+	Rand64x4Func rand64x4;
+} PowKernels;
+
+enum {
+	POW_KERNELS_REFERENCE = 0,	// byte-wise common.c code
+	POW_KERNELS_GENERIC,		// portable 64-bit words
+	POW_KERNELS_SSE42,
+	POW_KERNELS_AVX2,
+	POW_KERNELS_NUM
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/*
+	 * Kernels used by the PoW phases. initPowKernels() picks by cpuid in
+	 * order of typical speed, selectFastestPowKernels() by timing.
+	*/
+	extern const PowKernels *powKernels;
+
+	void initPowKernels();
+
+	/*
+	 * Whether kernel set id is compiled in and supported by this CPU.
+	*/
+	int powKernelsSupported(int id);
+
+	/*
+	 * Switch to kernel set id, for tests and benchmarks. Returns 0 if unsupported.
+	*/
+	int selectPowKernels(int id);
+
+	const PowKernels *getPowKernels(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,6 +16,7 @@
 #include "claimtrie.h"  // added opt
 #include "addrman.h"
 #include "amount.h"
+#include "blockcache.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -217,6 +218,10 @@ void PrepareShutdown()
 #endif
     GenerateBitcoins(false, 0, Params());
     StopNode();
+    LOG_INFO("Block serve cache: {} hits, {} misses\n", blockPayloadCache.GetHits(), blockPayloadCache.GetMisses());
+    CSignatureCacheStats sigCacheStats = GetSignatureCacheStats();
+    LOG_INFO("Signature cache: {} hits, {} misses, {} inserts, {} evictions, {} contended\n",
+        sigCacheStats.nHits, sigCacheStats.nMisses, sigCacheStats.nInserts, sigCacheStats.nEvictions, sigCacheStats.nContended);
 
     // STORE DATA CACHES INTO SERIALIZED DAT FILES
     CFlatDB<CMasternodeMan> flatdb1("mncache.dat", "magicMasternodeCache");
@@ -248,6 +253,7 @@ void PrepareShutdown()
         }
         pcoinsTip.reset();
         pcoinscatcher.reset();
+        pcoinsflush.reset();
         pcoinsdbview.reset();
         pblocktree.reset();
         pclaimTrie.reset();
@@ -373,7 +379,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", fmt::format("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", fmt::format("Whether to operate in a blocks only mode (default: %u)", DEFAULT_BLOCKSONLY));
+    strUsage += HelpMessageOpt("-checkblockindexpow=<n>", fmt::format("How many randomly sampled block index entries have their proof of work recomputed at startup (default: {}, -1 = all)", DEFAULT_CHECKBLOCKINDEXPOW));
     strUsage += HelpMessageOpt("-checkblocks=<n>", fmt::format("How many blocks to check at startup (default: %u, 0 = all)", DEFAULT_CHECKBLOCKS));
+    strUsage += HelpMessageOpt("-checkclaimtrie", fmt::format("Verify every claim trie node hash at startup, even if the trie is unchanged since it was last flushed (default: {})", DEFAULT_CHECK_CLAIMTRIE));
     strUsage += HelpMessageOpt("-checklevel=<n>", fmt::format("How thorough the block verification of -checkblocks is (0-4, default: %u)", DEFAULT_CHECKLEVEL));
     strUsage += HelpMessageOpt("-conf=<file>", fmt::format("Specify configuration file (default: %s)", BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
@@ -390,6 +398,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", fmt::format("Do not keep transactions in the mempool longer than <n> hours (default: %u)", DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", fmt::format("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)",
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-parheaders=<n>", fmt::format("Set the number of threads hashing received block headers ({} to {}, 0 = auto, <0 = leave that many cores free, default: {})",
+        -GetNumCores(), MAX_POWHASH_THREADS, DEFAULT_POWHASH_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", fmt::format("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -420,8 +430,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-listen", fmt::format("Accept connections from outside (default: 1 if no -proxy or -connect)"));
     strUsage += HelpMessageOpt("-listenonion", fmt::format("Automatically create Tor hidden service (default: %d)", DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", fmt::format("Maintain at most <n> connections to peers (default: %u)", DEFAULT_MAX_PEER_CONNECTIONS));
+    strUsage += HelpMessageOpt("-msghandthreads=<n>", fmt::format("Set the number of threads handling peer messages ({} to {}, 0 = auto, <0 = leave that many cores free, default: {})",
+        -GetNumCores(), MAX_MSGHAND_THREADS, DEFAULT_MSGHAND_THREADS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", fmt::format("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)", DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", fmt::format("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)", DEFAULT_MAXSENDBUFFER));
+    strUsage += HelpMessageOpt("-blockservecache=<n>", fmt::format("Keep up to <n> MiB of blocks recently sent to peers in memory, 0 to disable (default: {})", DEFAULT_BLOCK_SERVE_CACHE));
     strUsage += HelpMessageOpt("-onion=<ip:port>", fmt::format("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)", "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", fmt::format("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", fmt::format("Relay non-P2SH multisig (default: %u)", DEFAULT_PERMIT_BAREMULTISIG));
@@ -432,6 +445,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", fmt::format("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", fmt::format("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)", DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", fmt::format("Connect to a node to retrieve peer addresses, and disconnect"));
+#ifdef USE_EPOLL
+    strUsage += HelpMessageOpt("-socketevents=<mode>", fmt::format("Wait for socket events with <mode>: select or epoll (default: {})", GetSocketEventsModeName(DEFAULT_SOCKETEVENTS)));
+#endif
     strUsage += HelpMessageOpt("-timeout=<n>", fmt::format("Specify connection timeout in milliseconds (minimum: 1, default: %d)", DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", fmt::format("Tor control port to use if onion listening enabled (default: %s)", DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", fmt::format("Tor control port password (default: empty)"));
@@ -954,13 +970,18 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     }
 
+    if (mapArgs.count("-socketevents") && !ParseSocketEventsMode(GetArg("-socketevents", ""), nSocketEventsMode))
+        return InitError(fmt::format("Unsupported -socketevents mode: '{}'", GetArg("-socketevents", "")));
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    // (select() cannot serve descriptors beyond FD_SETSIZE, epoll can)
+    if (nSocketEventsMode == SOCKETEVENTS_SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(fmt::format("Not enough file descriptors available."));
@@ -1016,6 +1037,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // -parheaders=0 means autodetect; the thread handling the headers message always hashes too
+    nPowHashThreads = GetArg("-parheaders", DEFAULT_POWHASH_THREADS);
+    if (nPowHashThreads <= 0)
+        nPowHashThreads += GetNumCores();
+    if (nPowHashThreads < 1)
+        nPowHashThreads = 1;
+    else if (nPowHashThreads > MAX_POWHASH_THREADS)
+        nPowHashThreads = MAX_POWHASH_THREADS;
+
+    // -msghandthreads=0 means autodetect
+    nMsgHandThreads = GetArg("-msghandthreads", DEFAULT_MSGHAND_THREADS);
+    if (nMsgHandThreads <= 0)
+        nMsgHandThreads += GetNumCores();
+    if (nMsgHandThreads < 1)
+        nMsgHandThreads = 1;
+    else if (nMsgHandThreads > MAX_MSGHAND_THREADS)
+        nMsgHandThreads = MAX_MSGHAND_THREADS;
+
+    blockPayloadCache.SetMaxBytes((size_t)std::max<int64_t>(0, GetArg("-blockservecache", DEFAULT_BLOCK_SERVE_CACHE)) << 20);
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
@@ -1182,12 +1223,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LOG_INFO("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    InitSignatureCache();
+    LOG_INFO("Using {:.1f} MiB for the signature cache\n", GetSignatureCacheStats().nBytes / 1048576.0);
     LOG_INFO("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadMempoolScriptCheck);
     }
 
+    LOG_INFO("Using {} threads for header PoW hashing", nPowHashThreads);
+    LOG_INFO("Using {} threads for peer messages", nMsgHandThreads);
+    for (int i=0; i<nPowHashThreads-1; i++)
+        threadGroup.create_thread(&ThreadPowHash);
+    // Importing blocks is dominated by the same PoW hashing
+    for (int i=0; i<nPowHashThreads-1; i++)
+        threadGroup.create_thread(&ThreadBlockImportCheck);
+
     if (mapArgs.count("-sporkkey")) // spork priv key
     {
         if (!sporkManager.SetPrivKey(GetArg("-sporkkey", "")))
@@ -1432,8 +1487,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 UnloadBlockIndex();
 
                 pblocktree = std::make_unique<CBlockTreeDB>(nBlockTreeDBCache, false, fReindex);
+                // The writer must be gone before the database it writes to
+                pcoinsflush.reset();
                 pcoinsdbview = std::make_unique<CCoinsViewDB>(nCoinDBCache, false, fReindex);
-                pcoinscatcher = std::make_unique<CCoinsViewErrorCatcher>(pcoinsdbview.get());
+                pcoinsflush = std::make_unique<CCoinsViewBackgroundFlush>(pcoinsdbview.get());
+                pcoinscatcher = std::make_unique<CCoinsViewErrorCatcher>(pcoinsflush.get());
                 pcoinsTip = std::make_unique<CCoinsViewCache>(pcoinscatcher.get());
                 pclaimTrie = std::make_unique<CClaimTrie>(false, fReindex); // claim
 
@@ -1465,7 +1523,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     strLoadError = fmt::format("You need to rebuild the database using -reindex to change -txindex");
                     break;
                 }
-                if (!pclaimTrie->ReadFromDisk(true)) 
+                if (!pclaimTrie->ReadFromDisk(true, GetBoolArg("-checkclaimtrie", DEFAULT_CHECK_CLAIMTRIE)))
                 {   
                     strLoadError = fmt::format("Error loading the claim trie from disk");
                     break;
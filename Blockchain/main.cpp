@@ -24,14 +24,18 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcache.h"
+#include "boundedqueue.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "powhashqueue.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "hash.h"
 #include "init.h"
+#include "mappedfile.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "policy/policy.h"
@@ -79,6 +83,7 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nPowHashThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
@@ -102,6 +107,8 @@ CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
 
 CTxMemPool mempool(::minRelayTxFee);
 
+CBlockPayloadCache blockPayloadCache((size_t)DEFAULT_BLOCK_SERVE_CACHE << 20);
+
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
@@ -117,6 +124,11 @@ void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
  */
 static bool IsSuperMajority(int minVersion, nonstd::observer_ptr<const CBlockIndex> pstart, unsigned nRequired, const Consensus::Params& consensusParams);
 static void CheckBlockIndex(const Consensus::Params& consensusParams);
+/**
+ * CheckInputs for a transaction entering the mempool, with the scripts of a
+ * multi-input transaction verified on the mempool script check threads.
+ */
+static CValidationState CheckInputsForMempool(const CTransaction& tx, const CCoinsViewCache& view, unsigned int flags);
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -619,6 +631,7 @@ nonstd::observer_ptr<CBlockIndex> FindForkInGlobalIndex(const CChain& chain, con
 }
 
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
+std::unique_ptr<CCoinsViewBackgroundFlush> pcoinsflush;
 std::unique_ptr<CClaimTrie> pclaimTrie; // claim operation
 std::unique_ptr<CBlockTreeDB> pblocktree;
 std::vector<std::string> v_banname;
@@ -1548,7 +1561,7 @@ CValidationState AcceptToMemoryPoolWorker(CTxMemPool& pool, const CTransaction &
 
 		// Check against previous transactions
 		// This is done last to help prevent CPU exhaustion denial-of-service attacks.
-		state = CheckInputs(tx, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true);
+		state = CheckInputsForMempool(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
 		if (!state.IsValid())
 			return state;
 
@@ -1561,7 +1574,7 @@ CValidationState AcceptToMemoryPoolWorker(CTxMemPool& pool, const CTransaction &
 		// There is a similar check in CreateNewBlock() to prevent creating
 		// invalid blocks, however allowing such transactions into the mempool
 		// can be exploited as a DoS attack.
-		state = CheckInputs(tx, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true);
+		state = CheckInputsForMempool(tx, view, MANDATORY_SCRIPT_VERIFY_FLAGS);
 		if (!state.IsValid())
 		{
 			LOG_ERROR("{}: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags {}, {}",
@@ -1578,7 +1591,7 @@ CValidationState AcceptToMemoryPoolWorker(CTxMemPool& pool, const CTransaction &
 				FormatMoney(nModifiedFees - nConflictingFees),
 				(int)nSize - (int)nConflictingSize);
 		}
-		pool.RemoveStaged(allConflicting);
+		pool.RemoveStaged(allConflicting, false);
 
 		// Store transaction in memory
 		pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
@@ -1787,11 +1800,59 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
+/** Block and undo files no longer appended to, mapped for reading */
+static CMappedFileCache mappedBlockFiles(MAX_MAPPED_BLOCK_FILES);
+
+/**
+ * Find the record WriteBlockToDisk or UndoWriteToDisk stored at pos, plus
+ * nTrailer bytes after it, in the mapping of its file. Only files before the
+ * one being written are mapped, as that one is still truncated when left.
+ * Returns NULL if the record has to be read from the file instead.
+ */
+static CMappedFileRef MapDiskRecord(const CDiskBlockPos& pos, const char* prefix, size_t nTrailer, const char*& pbegin, const char*& pend)
+{
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.IsNull() || pos.nFile >= nLastBlockFile)
+            return CMappedFileRef();
+    }
+    const size_t nHeaderSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return CMappedFileRef();
+
+    std::string strPath = GetBlockPosFilename(pos, prefix).string();
+    CMappedFileRef file = mappedBlockFiles.Get(strPath, pos.nPos);
+    if (!file)
+        return CMappedFileRef();
+    const char* pheader = file->data + pos.nPos - nHeaderSize;
+    if (memcmp(pheader, Params().MessageStart().data(), MESSAGE_START_SIZE) != 0)
+        return CMappedFileRef();
+    uint32_t nSize;
+    memcpy(&nSize, pheader + MESSAGE_START_SIZE, sizeof(nSize));
+    nSize = letoh32(nSize);
+    if (nSize > MAX_SIZE)
+        return CMappedFileRef();
+
+    size_t nEnd = pos.nPos + nSize + nTrailer;
+    if (file->size < nEnd) {
+        file = mappedBlockFiles.Get(strPath, nEnd);
+        if (!file)
+            return CMappedFileRef();
+    }
+    pbegin = file->data + pos.nPos;
+    pend = pbegin + nSize + nTrailer;
+    return file;
+}
+
 Opt<CBlock> ReadBlockFromDisk(const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
+    // Deserialize in place from a mapped file
+    const char *pbegin, *pend;
+    CMappedFileRef mapped = MapDiskRecord(pos, "blk", 0, pbegin, pend);
+
     // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
+    CAutoFile filein(mapped ? NULL : OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (!mapped && filein.IsNull()) {
 		LOG_ERROR("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
         return {};
     }
@@ -1800,7 +1861,12 @@ Opt<CBlock> ReadBlockFromDisk(const CDiskBlockPos& pos, const Consensus::Params&
     block.SetNull();
     // Read block
     try {
-        filein >> block;
+        if (mapped) {
+            CSpanReader spanin(pbegin, pend, SER_DISK, CLIENT_VERSION);
+            spanin >> block;
+        } else {
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
 		LOG_ERROR("{}: Deserialize or I/O error - {} at {}", __func__, e.what(), pos.ToString());
@@ -1819,6 +1885,44 @@ Opt<CBlock> ReadBlockFromDisk(const CDiskBlockPos& pos, const Consensus::Params&
     return block;
 }
 
+bool ReadRawBlockFromDisk(CSerializeData& vch, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    const char *pbegin, *pend;
+    if (messageStart == Params().MessageStart() && MapDiskRecord(pos, "blk", 0, pbegin, pend)) {
+        vch.assign(pbegin, pend);
+        return true;
+    }
+
+    // Open history file at the index header WriteBlockToDisk wrote before the block
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int)) {
+        LOG_ERROR("ReadRawBlockFromDisk: no block at {}", pos.ToString());
+        return false;
+    }
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(unsigned int));
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        LOG_ERROR("ReadRawBlockFromDisk: OpenBlockFile failed for {}", pos.ToString());
+        return false;
+    }
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+        if (blockStart != messageStart || nSize > MAX_SIZE) {
+            LOG_ERROR("ReadRawBlockFromDisk: Errors in index header at {}", pos.ToString());
+            return false;
+        }
+        vch.resize(nSize);
+        filein.read(vch.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        LOG_ERROR("{}: I/O error - {} at {}", __func__, e.what(), pos.ToString());
+        return false;
+    }
+    return true;
+}
+
 Opt<CBlock> ReadBlockFromDisk(const CBlockIndex &index, const Consensus::Params& consensusParams)
 {
     Opt<CBlock> block = ReadBlockFromDisk(index.GetBlockPos(), consensusParams);
@@ -2153,10 +2257,47 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 ScriptError CScriptCheck::Verify() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-	auto checker = CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore);
+	auto checker = CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore, pparsedKeys);
 	return VerifyScript(scriptSig, scriptPubKey, nFlags, checker);
 }
 
+/** Count the pushes of scriptSig shaped like public keys, and those of the redeem script it pushes last */
+static void CountPubKeyPushes(const CScript& scriptSig, std::map<CPubKey, unsigned int>& mapCount, bool fRedeemScript)
+{
+    CScript::const_iterator pc = scriptSig.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vchPush;
+    bool fLastIsKey = false;
+    while (pc < scriptSig.end()) {
+        if (!scriptSig.GetOp(pc, opcode, vchPush))
+            return;
+        CPubKey pubkey(vchPush);
+        fLastIsKey = opcode <= OP_PUSHDATA4 && pubkey.IsValid();
+        if (fLastIsKey)
+            mapCount[pubkey]++;
+    }
+    if (fRedeemScript && !fLastIsKey && !vchPush.empty())
+        CountPubKeyPushes(CScript(vchPush.begin(), vchPush.end()), mapCount, false);
+}
+
+void ParseRepeatedPubKeys(const CBlock& block, CParsedPubKeys& parsedKeys)
+{
+    // Keys are pushed by the scriptSig of pay-to-pubkey-hash inputs, and sit
+    // in the redeem script of pay-to-script-hash multisig ones
+    std::map<CPubKey, unsigned int> mapCount;
+    for (const CTransaction& tx : block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx.vin)
+            CountPubKeyPushes(txin.scriptSig, mapCount, true);
+    }
+    // Parsing is serial, so a block padded with key-shaped data gets a bounded amount
+    for (std::map<CPubKey, unsigned int>::const_iterator it = mapCount.begin(); it != mapCount.end() && parsedKeys.size() < MAX_BLOCK_PARSED_PUBKEYS; ++it) {
+        if (it->second > 1)
+            parsedKeys.Add(it->first);
+    }
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2221,7 +2362,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-CValidationState CheckInputs(const CTransaction& tx, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+CValidationState CheckInputs(const CTransaction& tx, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks, const CParsedPubKeys *pparsedKeys)
 {
 	CValidationState state;
     if (!tx.IsCoinBase())
@@ -2246,7 +2387,7 @@ CValidationState CheckInputs(const CTransaction& tx, const CCoinsViewCache &inpu
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(*coins, tx, i, flags, cacheStore, pparsedKeys);
 				ScriptError error;
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
@@ -2260,7 +2401,7 @@ CValidationState CheckInputs(const CTransaction& tx, const CCoinsViewCache &inpu
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, pparsedKeys);
 						error = check2.Verify();
                         if (error != SCRIPT_ERR_OK) {
                             state.Invalid(REJECT_NONSTANDARD, fmt::format("non-mandatory-script-verify-flag ({})", ScriptErrorString(error)));
@@ -2320,19 +2461,30 @@ Opt<CDiskBlockPos> UndoWriteToDisk(const CBlockUndo& blockundo, const CDiskBlock
 
 Opt<CBlockUndo> UndoReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock)
 {
+    uint256 hashChecksum;
+    CBlockUndo blockundo;
+
+    // Deserialize in place from a mapped file; the checksum follows the undo data
+    const char *pbegin, *pend;
+    CMappedFileRef mapped = MapDiskRecord(pos, "rev", sizeof(uint256), pbegin, pend);
+
     // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
+    CAutoFile filein(mapped ? NULL : OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (!mapped && filein.IsNull()) {
 		LOG_ERROR("%s: OpenBlockFile failed", __func__);
         return {};
     }
 
     // Read block
-    uint256 hashChecksum;
-    CBlockUndo blockundo;
     try {
-        filein >> blockundo;
-        filein >> hashChecksum;
+        if (mapped) {
+            CSpanReader spanin(pbegin, pend, SER_DISK, CLIENT_VERSION);
+            spanin >> blockundo;
+            spanin >> hashChecksum;
+        } else {
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
     }
     catch (const std::exception& e) {
 		LOG_ERROR("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -2682,6 +2834,148 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Separate from scriptcheckqueue, so mempool admission never waits on a block's checks */
+static CCheckQueue<CScriptCheck> mempoolscriptcheckqueue(16);
+
+void ThreadMempoolScriptCheck() {
+    RenameThread("ulord-mpscript");
+    mempoolscriptcheckqueue.Thread();
+}
+
+static CValidationState CheckInputsForMempool(const CTransaction& tx, const CCoinsViewCache& view, unsigned int flags)
+{
+    // A single input is not worth waking the workers for
+    if (!nScriptCheckThreads || tx.vin.size() < 2)
+        return CheckInputs(tx, view, true, flags, true);
+
+    std::vector<CScriptCheck> vChecks;
+    CValidationState state = CheckInputs(tx, view, true, flags, true, &vChecks);
+    if (!state.IsValid())
+        return state;
+
+    bool fOk;
+    {
+        // The master must not leave while workers still run its checks
+        boost::this_thread::disable_interruption di;
+        CCheckQueueControl<CScriptCheck> control(&mempoolscriptcheckqueue);
+        control.Add(vChecks);
+        fOk = control.Wait();
+    }
+    if (fOk)
+        return state;
+    // The queue only says that some input failed; rerun serially for the
+    // reject reason and DoS score of the failing one
+    return CheckInputs(tx, view, true, flags, true);
+}
+
+static CPowHashQueue powhashqueue;
+
+void ThreadPowHash() {
+    RenameThread("ulord-powhash");
+    powhashqueue.Thread();
+}
+
+/**
+ * Context-free checks of a block read by LoadExternalBlockFile, run ahead of
+ * ProcessNewBlock. A block passing them is marked fChecked with its hash
+ * memoized, so the in-order connection skips both; a block failing them is
+ * left unmarked, and rejected in order as before.
+ */
+class CBlockImportCheck
+{
+private:
+    const CBlock* pblock;
+
+public:
+    CBlockImportCheck() : pblock(NULL) {}
+    explicit CBlockImportCheck(const CBlock* pblockIn) : pblock(pblockIn) {}
+
+    //! Never fails the batch: the verdict is left for ProcessNewBlock
+    ScriptError Verify()
+    {
+        CheckBlock(*pblock);
+        return SCRIPT_ERR_OK;
+    }
+
+    void swap(CBlockImportCheck& check)
+    {
+        std::swap(pblock, check.pblock);
+    }
+};
+
+static CCheckQueue<CBlockImportCheck> blockimportcheckqueue(1);
+
+void ThreadBlockImportCheck() {
+    RenameThread("ulord-importch");
+    blockimportcheckqueue.Thread();
+}
+
+/** Read of the coins of one txid from the base of pcoinsTip, see PrefetchBlockCoins */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView* pbase;
+    const uint256* ptxid;
+    Opt<CCoins>* pcoins;
+
+public:
+    CCoinsPrefetch() : pbase(NULL), ptxid(NULL), pcoins(NULL) {}
+    CCoinsPrefetch(const CCoinsView* pbaseIn, const uint256* ptxidIn, Opt<CCoins>* pcoinsIn)
+        : pbase(pbaseIn), ptxid(ptxidIn), pcoins(pcoinsIn) {}
+
+    ScriptError Verify()
+    {
+        *pcoins = pbase->GetCoins(*ptxid);
+        return SCRIPT_ERR_OK;
+    }
+
+    void swap(CCoinsPrefetch& check)
+    {
+        std::swap(pbase, check.pbase);
+        std::swap(ptxid, check.ptxid);
+        std::swap(pcoins, check.pcoins);
+    }
+};
+
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(4);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("ulord-prefetch");
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Compute the PoW hashes of a headers message on the hashing pool, before
+ * cs_main is taken; AcceptBlockHeader then finds them memoized.
+ * Only a message that connects to a block we know is hashed, and in chunks
+ * that double in size while every header in them meets its own target and
+ * is the parent of the next. Like the in-order validation, hashing stops at
+ * the first bad header, so garbage costs us at most one chunk beyond it.
+ */
+static void HashHeadersForSync(const std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams)
+{
+    if (headers.empty())
+        return;
+    {
+        LOCK(cs_main);
+        if (!mapBlockIndex.count(headers[0].hashPrevBlock))
+            return;
+    }
+
+    size_t nChunk = std::max(nPowHashThreads, 1);
+    for (size_t nStart = 0; nStart < headers.size(); nStart += nChunk, nChunk *= 2) {
+        size_t nEnd = std::min(headers.size(), nStart + nChunk);
+        powhashqueue.Hash(&headers[nStart], nEnd - nStart);
+        for (size_t n = nStart; n < nEnd; n++) {
+            uint256 hash = headers[n].GetHash();
+            if (!CheckProofOfWork(hash, headers[n].nBits, consensusParams))
+                return;
+            if (n + 1 < headers.size() && headers[n + 1].hashPrevBlock != hash)
+                return;
+        }
+    }
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -3027,6 +3321,13 @@ CValidationState ConnectBlock(const CBlock& block, nonstd::observer_ptr<CBlockIn
 
     CBlockUndo blockundo;
 
+    // Declared before control, so the checks are done before it goes. At the
+    // tip most signatures were cached when their transactions were accepted
+    // to the mempool, so the keys are only parsed up front while syncing.
+    CParsedPubKeys parsedKeys;
+    if (fScriptChecks && IsInitialBlockDownload())
+        ParseRepeatedPubKeys(block, parsedKeys);
+
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     CAmount nFees = 0;
@@ -3122,7 +3423,7 @@ CValidationState ConnectBlock(const CBlock& block, nonstd::observer_ptr<CBlockIn
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-			state = CheckInputs(tx, view, fScriptChecks, flags, fCacheResults, nScriptCheckThreads ? &vChecks : NULL);
+			state = CheckInputs(tx, view, fScriptChecks, flags, fCacheResults, nScriptCheckThreads ? &vChecks : NULL, parsedKeys.size() ? &parsedKeys : NULL);
 			if (!state.IsValid())
 			{
 				LOG_ERROR("ConnectBlock(): CheckInputs on {} failed with {}",
@@ -3493,9 +3794,15 @@ CValidationState static FlushStateToDisk(FlushStateMode mode) {
 				return state;
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
+        // Finally remove any pruned files. The coin database written in the
+        // background must not be left behind blocks that are going away.
+        if (fFlushForPrune) {
+            if (pcoinsflush && !pcoinsflush->Sync()) {
+                AbortNode(state, "Failed to write to coin database");
+                return state;
+            }
             UnlinkPrunedFiles(setFilesToPrune);
+        }
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -3509,15 +3816,40 @@ CValidationState static FlushStateToDisk(FlushStateMode mode) {
             state.Error("out of disk space");
             return state;
         }
-		if (!pclaimTrie->WriteToDisk()) {
-			AbortNode("Failed to write to claim trie database");
-			return state;
-		}
+        // The claim trie goes to disk after the coins it matches: with the
+        // coins written in the background, the writer commits it right after
+        // their best block. The rows of the claims batch before it are read
+        // from memory until that batch is on disk, so wait for it first.
+        if (pcoinsflush) {
+            if (!pcoinsflush->Sync()) {
+                AbortNode(state, "Failed to write to coin database");
+                return state;
+            }
+            CClaimTrie* ptrie = pclaimTrie.get();
+            std::shared_ptr<CDBBatch> pbatchClaims = ptrie->PrepareWrite();
+            pcoinsflush->WriteAfterNext([ptrie, pbatchClaims]() {
+                if (!ptrie->CommitWrite(*pbatchClaims)) {
+                    LOG_ERROR("Failed to write to claim trie database");
+                    return false;
+                }
+                return true;
+            });
+        }
         // Flush the chainstate (which may refer to block index entries).
 		if (!pcoinsTip->Flush()) {
 			AbortNode(state, "Failed to write to coin database");
 			return state;
 		}
+		if (!pcoinsflush && !pclaimTrie->WriteToDisk()) {
+			AbortNode("Failed to write to claim trie database");
+			return state;
+		}
+        // Flushes when the cache fills up or periodically are written in the
+        // background; those asked for explicitly are on disk when we return.
+        if (mode == FLUSH_STATE_ALWAYS && pcoinsflush && !pcoinsflush->Sync()) {
+            AbortNode(state, "Failed to write to coin database");
+            return state;
+        }
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -3599,7 +3931,7 @@ void static UpdateTip(nonstd::observer_ptr<CBlockIndex> pindexNew) {
     }
 }
 
-/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
+/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg after this, with cs_main held. */
 CValidationState static DisconnectTip(const Consensus::Params& consensusParams)
 {
     auto pindexDelete = chainActive.Tip();
@@ -3646,6 +3978,10 @@ CValidationState static DisconnectTip(const Consensus::Params& consensusParams)
     // UpdateTransactionsFromBlock finds descendants of any transactions in this
     // block that were added back and cleans up the mempool state.
     mempool.UpdateTransactionsFromBlock(vHashUpdate);
+    // Trim after every disconnected block rather than once after the reorg:
+    // the next block's re-adds walk all their in-mempool descendants, so the
+    // mempool limit is what bounds that work on a deep reorg.
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
@@ -4668,6 +5004,77 @@ static bool IsSuperMajority(int minVersion, nonstd::observer_ptr<const CBlockInd
 }
 
 
+/** Only one block's coins are read at a time, as the queue takes one master */
+static CCriticalSection cs_coinsPrefetch;
+static int64_t nTimePrefetch = 0;
+
+/**
+ * Read the coins spent by a block extending the tip into pcoinsTip, on the
+ * coinsprefetchqueue workers, so ConnectBlock does not wait on the database
+ * one input at a time. The reads are done without cs_main; their results
+ * are dropped if pcoinsTip was flushed meanwhile, as the database may then
+ * hold newer coins than were read.
+ */
+static void PrefetchBlockCoins(const CBlock& block)
+{
+    TRY_LOCK(cs_coinsPrefetch, lockPrefetch);
+    if (!lockPrefetch)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<uint256> vTxid;
+    const CCoinsView* pbase;
+    unsigned int nFlushes;
+    {
+        LOCK(cs_main);
+        if (!chainActive.Tip() || chainActive.Tip()->GetBlockHash() != block.hashPrevBlock)
+            return;
+        // Outputs created by the block itself are not in the database
+        std::set<uint256> setSkip;
+        for (const CTransaction& tx : block.vtx)
+            setSkip.insert(tx.GetHash());
+        for (const CTransaction& tx : block.vtx) {
+            if (tx.IsCoinBase())
+                continue;
+            for (const CTxIn& txin : tx.vin) {
+                if (setSkip.insert(txin.prevout.hash).second && !pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                    vTxid.push_back(txin.prevout.hash);
+            }
+        }
+        pbase = pcoinsTip->GetBackend();
+        nFlushes = pcoinsTip->GetFlushCount();
+    }
+    if (vTxid.empty())
+        return;
+
+    std::vector<Opt<CCoins> > vCoins(vTxid.size());
+    {
+        // The master of a CCheckQueue must not leave before its workers are done
+        boost::this_thread::disable_interruption di;
+        CCheckQueueControl<CCoinsPrefetch> control(&coinsprefetchqueue);
+        std::vector<CCoinsPrefetch> vReads;
+        vReads.reserve(vTxid.size());
+        for (size_t i = 0; i < vTxid.size(); i++)
+            vReads.push_back(CCoinsPrefetch(pbase, &vTxid[i], &vCoins[i]));
+        control.Add(vReads);
+        control.Wait();
+    }
+
+    LOCK(cs_main);
+    if (pcoinsTip->GetFlushCount() != nFlushes)
+        return;
+    size_t nFound = 0;
+    for (size_t i = 0; i < vTxid.size(); i++) {
+        if (vCoins[i]) {
+            pcoinsTip->AddCoinsFromBase(vTxid[i], *vCoins[i]);
+            nFound++;
+        }
+    }
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    nTimePrefetch += nTime;
+    LOG_INFO("  - Prefetch {} of {} txins' coins: {:.2f}ms [{:.2f}s]", nFound, vTxid.size(), nTime * 0.001, nTimePrefetch * 0.000001);
+}
+
 CValidationState ProcessNewBlock(const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, Opt<CDiskBlockPos> dbp)
 {
     // Preliminary checks
@@ -4695,6 +5102,8 @@ CValidationState ProcessNewBlock(const CChainParams& chainparams, const CNode* p
 		}
     }
 
+    PrefetchBlockCoins(*pblock);
+
 	state = ActivateBestChain(chainparams, pblock);
 	if (!state.IsValid()) {
 		LOG_ERROR("{}: ActivateBestChain failed", __func__);
@@ -4792,6 +5201,8 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        mappedBlockFiles.Erase(GetBlockPosFilename(pos, "blk").string());
+        mappedBlockFiles.Erase(GetBlockPosFilename(pos, "rev").string());
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LOG_INFO("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4916,7 +5327,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts())
+    if (!pblocktree->LoadBlockIndexGuts(GetArg("-checkblockindexpow", DEFAULT_CHECKBLOCKINDEXPOW)))
         return false;
 
     boost::this_thread::interruption_point();
@@ -5185,6 +5596,7 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    mappedBlockFiles.Clear();
     nBlockSequenceId = 1;
     mapBlockSource.clear();
     mapBlocksInFlight.clear();
@@ -5276,19 +5688,70 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, Opt<CDiskBlockPos> dbp)
+/** A block read by the import pipeline, with where it was found */
+struct CImportBlock
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    CBlock block;
+    Opt<CDiskBlockPos> dbp;
+    unsigned int nSize;
+};
 
-    int nLoaded = 0;
+typedef std::vector<CImportBlock> CImportBatch;
+
+/** Blocks handed from one import stage to the next at once */
+static const size_t IMPORT_BATCH_BLOCKS = 64;
+/** ...unless they take more bytes than this */
+static const size_t IMPORT_BATCH_BYTES = 8 * 1024 * 1024;
+/** Batches queued between two import stages */
+static const size_t IMPORT_QUEUE_BATCHES = 2;
+/** Milliseconds between import progress reports */
+static const int64_t IMPORT_REPORT_INTERVAL = 30 * 1000;
+
+/** Work done by one stage of LoadExternalBlockFile */
+struct CImportStageStats
+{
+    std::atomic<uint64_t> nBlocks;
+    std::atomic<uint64_t> nBytes;
+    //! Time spent working, not waiting for the neighbouring stages
+    std::atomic<int64_t> nTimeMicros;
+
+    CImportStageStats() : nBlocks(0), nBytes(0), nTimeMicros(0) {}
+
+    void Add(uint64_t nBlocksIn, uint64_t nBytesIn, int64_t nTimeMicrosIn)
+    {
+        nBlocks += nBlocksIn;
+        nBytes += nBytesIn;
+        nTimeMicros += nTimeMicrosIn;
+    }
+
+    void Add(const CImportBatch& batch, int64_t nTimeMicrosIn)
+    {
+        uint64_t nBatchBytes = 0;
+        for (const CImportBlock& item : batch)
+            nBatchBytes += item.nSize;
+        Add(batch.size(), nBatchBytes, nTimeMicrosIn);
+    }
+
+    std::string ToString(const char* pszStage) const
+    {
+        double dSeconds = std::max<int64_t>(nTimeMicros, 1) * 0.000001;
+        return fmt::format("{} {} blocks in {:.1f}s ({:.1f} blocks/s, {:.2f} MB/s)", pszStage,
+            (uint64_t)nBlocks, dSeconds, nBlocks / dSeconds, nBytes / dSeconds / 1000000);
+    }
+};
+
+/** First import stage: locate and deserialize the blocks of blkdat, in file order */
+static void ImportReadBlocks(const CChainParams& chainparams, CBufferedFile& blkdat, Opt<CDiskBlockPos> dbp,
+                             CBoundedQueue<CImportBatch>& queueOut, CImportStageStats& stats)
+{
+    RenameThread("ulord-importrd");
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        CImportBatch batch;
+        size_t nBatchBytes = 0;
         uint64_t nRewind = blkdat.GetPos();
         while (!blkdat.eof()) {
             boost::this_thread::interruption_point();
+            int64_t nTimeStart = GetTimeMicros();
 
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
@@ -5317,63 +5780,198 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, Opt<CD
                     dbp->nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
+                batch.emplace_back();
+                CImportBlock& item = batch.back();
+                try {
+                    blkdat >> item.block;
+                } catch (...) {
+                    batch.pop_back();
+                    throw;
+                }
+                item.dbp = dbp;
+                item.nSize = nSize;
+                nBatchBytes += nSize;
                 nRewind = blkdat.GetPos();
+                stats.Add(1, nSize, GetTimeMicros() - nTimeStart);
+            } catch (const std::exception& e) {
+                LOG_INFO("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-					LOG_INFO("%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+            if (batch.size() >= IMPORT_BATCH_BLOCKS || nBatchBytes >= IMPORT_BATCH_BYTES) {
+                if (!queueOut.Push(batch))
+                    break;
+                batch.clear();
+                nBatchBytes = 0;
+            }
+        }
+        if (!batch.empty())
+            queueOut.Push(batch);
+    } catch (const boost::thread_interrupted&) {
+        // the connecting stage is shutting the pipeline down
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    queueOut.Close();
+}
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-					CValidationState state = ProcessNewBlock(chainparams, NULL, &block, true, dbp);
-                    if (state.IsValid())
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LOG_INFO("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+/** Second import stage: CheckBlock every block of a batch in parallel */
+static void ImportCheckBlocks(CBoundedQueue<CImportBatch>& queueIn, CBoundedQueue<CImportBatch>& queueOut,
+                              CImportStageStats& stats)
+{
+    RenameThread("ulord-importck");
+    // The master of a CCheckQueue must not leave before its workers are done;
+    // this stage stops when its queues are closed instead
+    boost::this_thread::disable_interruption di;
+    CImportBatch batch;
+    while (queueIn.Pop(batch)) {
+        int64_t nTimeStart = GetTimeMicros();
+        {
+            CCheckQueueControl<CBlockImportCheck> control(&blockimportcheckqueue);
+            std::vector<CBlockImportCheck> vChecks;
+            vChecks.reserve(batch.size());
+            for (const CImportBlock& item : batch)
+                vChecks.push_back(CBlockImportCheck(&item.block));
+            control.Add(vChecks);
+            control.Wait();
+        }
+        stats.Add(batch, GetTimeMicros() - nTimeStart);
+        if (!queueOut.Push(batch))
+            break;
+    }
+    queueOut.Close();
+}
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        Opt<CBlock> rangeblock = ReadBlockFromDisk(it->second, chainparams.GetConsensus());
-                        if (rangeblock)
-                        {
-                            LOG_INFO("%s: Processing out of order child %s of %s\n", __func__, rangeblock->GetHash().ToString(),
-                                    head.ToString());
-							CValidationState dummy = ProcessNewBlock(chainparams, NULL, &rangeblock.get(), true, it->second);
-                            if (dummy.IsValid())
-                            {
+/** Stops and joins the first two import stages however the last one ends */
+class CImportPipelineStop
+{
+private:
+    CBoundedQueue<CImportBatch>& queueRead;
+    CBoundedQueue<CImportBatch>& queueChecked;
+    boost::thread& threadRead;
+    boost::thread& threadCheck;
+
+public:
+    CImportPipelineStop(CBoundedQueue<CImportBatch>& queueReadIn, CBoundedQueue<CImportBatch>& queueCheckedIn,
+                        boost::thread& threadReadIn, boost::thread& threadCheckIn)
+        : queueRead(queueReadIn), queueChecked(queueCheckedIn), threadRead(threadReadIn), threadCheck(threadCheckIn) {}
+
+    ~CImportPipelineStop()
+    {
+        // Joining is an interruption point, and we may be unwinding from one
+        boost::this_thread::disable_interruption di;
+        queueChecked.Close();
+        queueRead.Close();
+        threadRead.interrupt();
+        threadRead.join();
+        threadCheck.join();
+    }
+};
+
+/**
+ * Import the blocks of fileIn through a three stage pipeline:
+ * - a reader thread locates and deserializes the blocks, in file order;
+ * - a checking thread runs CheckBlock (PoW, merkle root, transactions) on
+ *   each batch of them in parallel, on the blockimportcheckqueue workers;
+ * - this thread processes them in file order with ProcessNewBlock, which
+ *   finds them checked and only has to store and connect them.
+ * The stages are connected by queues of a few batches, so memory stays
+ * bounded and the slowest stage sets the pace.
+ */
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, Opt<CDiskBlockPos> dbp)
+{
+    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    CImportStageStats statsRead, statsCheck, statsConnect;
+    {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        CBoundedQueue<CImportBatch> queueRead(IMPORT_QUEUE_BATCHES);
+        CBoundedQueue<CImportBatch> queueChecked(IMPORT_QUEUE_BATCHES);
+        boost::thread threadRead([&] { ImportReadBlocks(chainparams, blkdat, dbp, queueRead, statsRead); });
+        boost::thread threadCheck([&] { ImportCheckBlocks(queueRead, queueChecked, statsCheck); });
+        CImportPipelineStop stop(queueRead, queueChecked, threadRead, threadCheck);
+
+        int64_t nLastReport = GetTimeMillis();
+        try {
+            CImportBatch batch;
+            bool fError = false;
+            while (!fError && queueChecked.Pop(batch)) {
+                int64_t nTimeStart = GetTimeMicros();
+                for (CImportBlock& item : batch) {
+                    boost::this_thread::interruption_point();
+                    const CBlock& block = item.block;
+                    try {
+                        // detect out of order blocks, and store them for later
+                        uint256 hash = block.GetHash();
+                        if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                            LOG_INFO("%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                                    block.hashPrevBlock.ToString());
+                            if (item.dbp)
+                                mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *item.dbp));
+                            continue;
+                        }
+
+                        // process in case the block isn't known yet
+                        if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                            CValidationState state = ProcessNewBlock(chainparams, NULL, &block, true, item.dbp);
+                            if (state.IsValid())
                                 nLoaded++;
-                                queue.push_back(rangeblock->GetHash());
+                            if (state.IsError()) {
+                                fError = true;
+                                break;
+                            }
+                        } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                            LOG_INFO("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                        }
+
+                        // Recursively process earlier encountered successors of this block
+                        deque<uint256> queue;
+                        queue.push_back(hash);
+                        while (!queue.empty()) {
+                            uint256 head = queue.front();
+                            queue.pop_front();
+                            std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                            while (range.first != range.second) {
+                                std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                                Opt<CBlock> rangeblock = ReadBlockFromDisk(it->second, chainparams.GetConsensus());
+                                if (rangeblock)
+                                {
+                                    LOG_INFO("%s: Processing out of order child %s of %s\n", __func__, rangeblock->GetHash().ToString(),
+                                            head.ToString());
+                                    CValidationState dummy = ProcessNewBlock(chainparams, NULL, &rangeblock.get(), true, it->second);
+                                    if (dummy.IsValid())
+                                    {
+                                        nLoaded++;
+                                        queue.push_back(rangeblock->GetHash());
+                                    }
+                                }
+                                range.first++;
+                                mapBlocksUnknownParent.erase(it);
                             }
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
+                    } catch (const std::exception& e) {
+                        LOG_INFO("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                     }
                 }
-            } catch (const std::exception& e) {
-                LOG_INFO("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                statsConnect.Add(batch, GetTimeMicros() - nTimeStart);
+
+                if (GetTimeMillis() - nLastReport >= IMPORT_REPORT_INTERVAL) {
+                    nLastReport = GetTimeMillis();
+                    LOG_INFO("Block import: {}; {}; {}; {} batches waiting to be checked, {} to be connected",
+                        statsRead.ToString("read"), statsCheck.ToString("checked"), statsConnect.ToString("connected"),
+                        queueRead.Size(), queueChecked.Size());
+                }
             }
+        } catch (const std::runtime_error& e) {
+            AbortNode(std::string("System error: ") + e.what());
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
     }
+    if (statsRead.nBlocks > 0)
+        LOG_INFO("Block import: {}; {}; {}", statsRead.ToString("read"), statsCheck.ToString("checked"),
+            statsConnect.ToString("connected"));
     if (nLoaded > 0)
         LOG_INFO("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
@@ -5775,18 +6373,28 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    Opt<CBlock> block = ReadBlockFromDisk(*((*mi).second), consensusParams);
-                    if (!block)
-                        assert(!"cannot load block from disk");
+                    // Send block from the cache, or else as stored on disk. It
+                    // was fully checked before it was stored, so it isn't
+                    // deserialized and its PoW isn't checked again.
+                    CSharedPayloadRef payload = blockPayloadCache.Get(inv.hash);
+                    if (!payload) {
+                        CSerializeData vch;
+                        if (!ReadRawBlockFromDisk(vch, mi->second->GetBlockPos(), Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        payload = std::make_shared<const CSharedPayload>(std::move(vch));
+                        blockPayloadCache.Insert(inv.hash, payload);
+                    }
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage(NetMsgType::BLOCK, *block);
+                        pfrom->PushSharedMessage(NetMsgType::BLOCK, payload);
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
-                            CMerkleBlock merkleBlock(*block, *pfrom->pfilter);
+                            CBlock block;
+                            CDataStream ssBlock(payload->vch, SER_NETWORK, PROTOCOL_VERSION);
+                            ssBlock >> block;
+                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
                             pfrom->PushMessage(NetMsgType::MERKLEBLOCK, merkleBlock);
                             // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
                             // This avoids hurting performance by pointlessly requiring a round-trip
@@ -5796,7 +6404,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             for (PairType& pair : merkleBlock.vMatchedTxn)
-                                pfrom->PushMessage(NetMsgType::TX, block->vtx[pair.first]);
+                                pfrom->PushMessage(NetMsgType::TX, block.vtx[pair.first]);
                         }
                         // else
                             // no response
@@ -5820,17 +6428,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // Send stream from relay memory
                 bool pushed = false;
                 {
-                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    CSharedPayloadRef payload;
                     {
                         LOCK(cs_mapRelay);
-                        map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                        map<CInv, CSharedPayloadRef>::iterator mi = mapRelay.find(inv);
                         if (mi != mapRelay.end()) {
-                            ss += (*mi).second;
+                            payload = (*mi).second;
                             pushed = true;
                         }
                     }
                     if(pushed)
-                        pfrom->PushMessage(inv.GetCommand(), ss);
+                        pfrom->PushSharedMessage(inv.GetCommand(), payload);
                 }
 
                 if (!pushed && inv.type == MSG_TX) {
@@ -6012,6 +6620,31 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
+/**
+ * Held by the message handler thread running a handler that is not
+ * IsConcurrentMessage(), so those run one at a time as they did when a
+ * single thread handled all nodes.
+ */
+static CCriticalSection cs_serialMessages;
+/** Set when a message was left queued because cs_serialMessages was taken */
+static std::atomic<bool> fSerialMessagesWanted(false);
+
+/**
+ * Messages whose handlers only touch the sending node, managers with their
+ * own locks and state they take cs_main for, so message handler threads may
+ * run them for different nodes at once.
+ */
+static bool IsConcurrentMessage(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::PING ||
+           strCommand == NetMsgType::PONG ||
+           strCommand == NetMsgType::ADDR ||
+           strCommand == NetMsgType::GETADDR ||
+           strCommand == NetMsgType::INV ||
+           strCommand == NetMsgType::MNPING ||
+           strCommand == NetMsgType::MNGOVERNANCEOBJECTVOTE;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
@@ -6200,6 +6833,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         if (vAddr.size() > 1000)
         {
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
 			LOG_ERROR("message addr size() = %u", vAddr.size());
 			return false;
@@ -6224,9 +6858,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
                     // at a time so the addrKnowns of the chosen nodes prevent repeats
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
+                    // Initialized once even with several message handler threads
+                    static const uint256 hashSalt = GetRandHash();
                     uint64_t hashAddr = addr.GetHash();
                     uint256 hashRand = ArithToUint256(UintToArith256(hashSalt) ^ (hashAddr<<32) ^ ((GetTime()+hashAddr)/(24*60*60)));
                     hashRand = Hash(BEGIN(hashRand), END(hashRand));
@@ -6270,6 +6903,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ)
         {
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
 			LOG_ERROR("message inv size() = %u", vInv.size());
 			return false;
@@ -6695,6 +7329,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        HashHeadersForSync(headers, chainparams.GetConsensus());
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -6846,7 +7482,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_inventory);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         for (const CAddress &addr : vAddr)
             pfrom->PushAddress(addr);
@@ -7076,7 +7715,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
         }
 
-        if (found)
+        // Handled concurrently, see IsConcurrentMessage(), so only the
+        // manager that owns them may see them
+        if (strCommand == NetMsgType::MNPING)
+        {
+            mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
+        }
+        else if (strCommand == NetMsgType::MNGOVERNANCEOBJECTVOTE)
+        {
+            governance.ProcessMessage(pfrom, strCommand, vRecv);
+        }
+        else if (found)
         {
             //probably one the extensions
             privSendPool.ProcessMessage(pfrom, strCommand, vRecv);
@@ -7113,6 +7762,7 @@ bool ProcessMessages(CNode* pfrom)
     //  (x) data
     //
     bool fOk = true;
+    bool fSerialTurn = false;
 
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom, chainparams.GetConsensus());
@@ -7138,6 +7788,26 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // Leave the message queued while another node's serialized message is
+        // handled, so this thread can serve other nodes meanwhile
+        bool fConcurrent = IsConcurrentMessage(msg.hdr.GetCommand());
+        Opt<CCriticalBlock> serialBlock;
+        if (!fConcurrent) {
+            serialBlock.emplace(cs_serialMessages, "cs_serialMessages", __FILE__, __LINE__, true);
+            if (!*serialBlock) {
+                // Ask the holder to wake us, then look again: it checks the
+                // flag after letting go of the lock, so either it sees the
+                // flag or the lock is free by now
+                fSerialMessagesWanted = true;
+                serialBlock.emplace(cs_serialMessages, "cs_serialMessages", __FILE__, __LINE__, true);
+                if (!*serialBlock) {
+                    pfrom->nMsgDeferred++;
+                    break;
+                }
+            }
+        }
+        fSerialTurn = !fConcurrent;
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -7208,9 +7878,15 @@ bool ProcessMessages(CNode* pfrom)
         if (!fRet)
             LOG_INFO("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
 
+        pfrom->nMsgProcessed++;
         break;
     }
 
+    // Wake the threads of nodes whose messages waited for this one; the
+    // lock was released when the loop was left
+    if (fSerialTurn && fSerialMessagesWanted.exchange(false))
+        WakeMessageHandler();
+
     // In case the connection got shut down, its receive buffer was wiped
     if (!pfrom->fDisconnect)
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
@@ -7272,6 +7948,7 @@ bool SendMessages(CNode* pto)
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_inventory);
             vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend)
@@ -7476,9 +8153,7 @@ bool SendMessages(CNode* pto)
                 if (inv.type == MSG_TX && !fSendTrickle)
                 {
                     // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
+                    static const uint256 hashSalt = GetRandHash();
                     uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
                     hashRand = Hash(BEGIN(hashRand), END(hashRand));
                     bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
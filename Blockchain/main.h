@@ -36,10 +36,13 @@
 #include "observer_ptr.h"
 
 class CBlockIndex;
+class CBlockPayloadCache;
 class CBlockTreeDB;
+class CCoinsViewBackgroundFlush;
 class CBloomFilter;
 class CChainParams;
 class CInv;
+class CParsedPubKeys;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
@@ -83,12 +86,20 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Most finalized block and undo files kept mapped for reading at once */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 64;
+/** Most public keys parsed ahead of a block's script checks */
+static const unsigned int MAX_BLOCK_PARSED_PUBKEYS = 5000;
 /** Maximum number of Bytes message allowed*/
 static const unsigned int MAX_MESSAGE_SIZE = 80;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads hashing received headers */
+static const int MAX_POWHASH_THREADS = 64;
+/** -parheaders default (number of header hashing threads, 0 = auto) */
+static const int DEFAULT_POWHASH_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -147,6 +158,8 @@ struct BlockHasher
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
+/** Serialized blocks recently sent to peers (-blockservecache) */
+extern CBlockPayloadCache blockPayloadCache;
 typedef std::unordered_map<uint256, std::unique_ptr<CBlockIndex>, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
@@ -157,6 +170,7 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nPowHashThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -243,6 +257,14 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the mempool script checking thread */
+void ThreadMempoolScriptCheck();
+/** Run an instance of the header PoW hashing thread */
+void ThreadPowHash();
+/** Run an instance of the block import checking thread */
+void ThreadBlockImportCheck();
+/** Run an instance of the coins prefetching thread */
+void ThreadCoinsPrefetch();
 
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
@@ -646,10 +668,15 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. Signatures by keys in pparsedKeys use the parsed keys, which
+ * must outlive the checks.
  */
 CValidationState CheckInputs(const CTransaction& tx, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL,
+                 const CParsedPubKeys *pparsedKeys = NULL);
+
+/** Parse the public keys that more than one input of the block presents, for its script checks */
+void ParseRepeatedPubKeys(const CBlock& block, CParsedPubKeys& parsedKeys);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight);
@@ -708,12 +735,13 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     bool cacheStore;
+    const CParsedPubKeys *pparsedKeys;
 
 public:
-    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), pparsedKeys(0) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, const CParsedPubKeys* pparsedKeysIn = NULL) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), pparsedKeys(pparsedKeysIn) { }
 
 	ScriptError Verify();
 
@@ -723,6 +751,7 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
+        std::swap(pparsedKeys, check.pparsedKeys);
     }
 };
 
@@ -738,6 +767,8 @@ bool GetAddressUnspent(uint160 addressHash, int type,
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 Opt<CBlock> ReadBlockFromDisk(const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 Opt<CBlock> ReadBlockFromDisk(const CBlockIndex &index, const Consensus::Params& consensusParams);
+/** Read the block at pos as stored, without deserializing or checking it */
+bool ReadRawBlockFromDisk(CSerializeData& vch, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -843,6 +874,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
+/** Background writer of the coin database under pcoinsTip (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewBackgroundFlush> pcoinsflush;
+
 /** Global variable that points to the active CClaimTrie (protected by cs_main) */                                                                                                                                                                                            
 extern std::unique_ptr<CClaimTrie> pclaimTrie;
 
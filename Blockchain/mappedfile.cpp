@@ -0,0 +1,83 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap((void*)data, size);
+#endif
+}
+
+/** Map the whole file at strPath if it holds at least nEnd bytes */
+static CMappedFileRef MapFile(const std::string& strPath, size_t nEnd)
+{
+#ifdef WIN32
+    return CMappedFileRef();
+#else
+    int fd = open(strPath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return CMappedFileRef();
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (size_t)st.st_size < nEnd) {
+        close(fd);
+        return CMappedFileRef();
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return CMappedFileRef();
+    return std::make_shared<const CMappedFile>((const char*)p, (size_t)st.st_size);
+#endif
+}
+
+CMappedFileRef CMappedFileCache::Get(const std::string& strPath, size_t nEnd)
+{
+    LOCK(cs);
+    std::map<std::string, list_t::iterator>::iterator it = mapIndex.find(strPath);
+    if (it != mapIndex.end()) {
+        listItems.splice(listItems.begin(), listItems, it->second);
+        if (it->second->second->size >= nEnd)
+            return it->second->second;
+        // The file grew since it was mapped
+        listItems.erase(it->second);
+        mapIndex.erase(it);
+    }
+
+    CMappedFileRef file = MapFile(strPath, nEnd);
+    if (!file || nMaxFiles == 0)
+        return file;
+    listItems.push_front(std::make_pair(strPath, file));
+    mapIndex[strPath] = listItems.begin();
+    while (listItems.size() > nMaxFiles) {
+        mapIndex.erase(listItems.back().first);
+        listItems.pop_back();
+    }
+    return file;
+}
+
+void CMappedFileCache::Erase(const std::string& strPath)
+{
+    LOCK(cs);
+    std::map<std::string, list_t::iterator>::iterator it = mapIndex.find(strPath);
+    if (it == mapIndex.end())
+        return;
+    listItems.erase(it->second);
+    mapIndex.erase(it);
+}
+
+void CMappedFileCache::Clear()
+{
+    LOCK(cs);
+    mapIndex.clear();
+    listItems.clear();
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+/** A whole file mapped read-only, unmapped once the last reference is gone */
+class CMappedFile
+{
+private:
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    const char* data;
+    size_t size;
+
+    CMappedFile(const char* dataIn, size_t sizeIn) : data(dataIn), size(sizeIn) {}
+    ~CMappedFile();
+};
+
+typedef std::shared_ptr<const CMappedFile> CMappedFileRef;
+
+/**
+ * Read-only mappings of the most recently used files.
+ *
+ * Files may grow while mapped; a mapping that is too short for the caller is
+ * replaced with one of the current file size. They must not shrink, as
+ * reading mapped pages past the end of a file faults. Readers holding a
+ * mapping keep it valid after it is dropped from the cache.
+ */
+class CMappedFileCache
+{
+private:
+    typedef std::list<std::pair<std::string, CMappedFileRef> > list_t;
+
+    //! Most recently used first
+    list_t listItems;
+
+    std::map<std::string, list_t::iterator> mapIndex;
+
+    size_t nMaxFiles;
+
+    CCriticalSection cs;
+
+public:
+    explicit CMappedFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) {}
+
+    //! Mapping of the file at strPath covering at least its first nEnd bytes,
+    //! or NULL if the file is shorter or cannot be mapped
+    CMappedFileRef Get(const std::string& strPath, size_t nEnd);
+
+    void Erase(const std::string& strPath);
+
+    void Clear();
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
@@ -35,7 +35,7 @@
 
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
-#include <queue>
+#include <algorithm>
 
 //#define KDEBUG
 
@@ -49,23 +49,12 @@ using namespace std;
 //
 // Unconfirmed transactions in the memory pool often depend on other
 // transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
+// pool, we select by highest priority or fee rate with ancestors, and add
+// each together with its ancestors that aren't yet in the block.
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-class ScoreCompare
-{
-public:
-    ScoreCompare() {}
-
-    bool operator()(const CTxMemPool::txiter a, const CTxMemPool::txiter b)
-    {
-        return CompareTxMemPoolEntryByScore()(*b,*a); // Convert to less than
-    }
-};
-
 int64_t UpdateTime(CBlockHeader *pblock, const Consensus::Params& consensusParams, nonstd::observer_ptr<const CBlockIndex> pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -84,6 +73,166 @@ int64_t UpdateTime(CBlockHeader *pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
+/** Outputs created by transactions already in the block, by outpoint */
+typedef std::map<COutPoint, const CTxOut*> blockoutputs_t;
+
+class CompareTxIterByAncestorCount
+{
+public:
+	bool operator()(const CTxMemPool::txiter a, const CTxMemPool::txiter b) const
+	{
+		if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+			return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+		return CTxMemPool::CompareIteratorByHash()(a, b);
+	}
+};
+
+/** Order a package so every transaction follows its in-package parents, which have fewer ancestors */
+static void SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries)
+{
+	sortedEntries.assign(package.begin(), package.end());
+	std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+}
+
+/** Apply the claim operations tx spends and creates to trieCache, as connecting the block will */
+static void UpdateClaimTrieForTx(CClaimTrieCache& trieCache, const CCoinsViewCache& view, const blockoutputs_t& mapBlockOutputs, const CTransaction& tx, int nHeight)
+{
+	typedef std::vector<std::pair<std::string, uint160> > spentClaimsType;
+	spentClaimsType spentClaims;
+
+	for (const CTxIn& txin : tx.vin)
+	{
+		const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+		int nTxinHeight = 0;
+		CScript scriptPubKey;
+		bool fGotCoins = false;
+		if (coins)
+		{
+			if (txin.prevout.n < coins->vout.size())
+			{
+				nTxinHeight = coins->nHeight;
+				scriptPubKey = coins->vout[txin.prevout.n].scriptPubKey;
+				fGotCoins = true;
+			}
+		}
+		else // must be in block or else
+		{
+			blockoutputs_t::const_iterator itOut = mapBlockOutputs.find(txin.prevout);
+			if (itOut != mapBlockOutputs.end())
+			{
+				nTxinHeight = nHeight;
+				scriptPubKey = itOut->second->scriptPubKey;
+				fGotCoins = true;
+			}
+		}
+		if (!fGotCoins)
+		{
+			LOG_INFO("Tried to include a transaction but could not find the txout it was spending. This is bad. Please send this log file to the maintainers of this program.\n");
+			throw std::runtime_error("Tried to include a transaction but could not find the txout it was spending.");
+		}
+
+		std::vector<std::vector<unsigned char> > vvchParams;
+		int op;
+
+		if (DecodeClaimScript(scriptPubKey, op, vvchParams))
+		{
+			if (op == OP_CLAIM_NAME || op == OP_UPDATE_CLAIM)
+			{
+				uint160 claimId;
+				if (op == OP_CLAIM_NAME)
+				{
+					assert(vvchParams.size() == 2);
+					claimId = ClaimIdHash(txin.prevout.hash, txin.prevout.n);
+				}
+				else if (op == OP_UPDATE_CLAIM)
+				{
+					assert(vvchParams.size() == 3);
+					claimId = uint160(vvchParams[1]);
+				}
+				std::string name(vvchParams[0].begin(), vvchParams[0].end());
+				int throwaway;
+				if (trieCache.spendClaim(name, COutPoint(txin.prevout.hash, txin.prevout.n), nTxinHeight, throwaway))
+				{
+					std::pair<std::string, uint160> entry(name, claimId);
+					spentClaims.push_back(entry);
+				}
+				else
+				{
+					LOG_INFO("%s(): The claim was not found in the trie or queue and therefore can't be updated\n", __func__);
+				}
+			}
+			else if (op == OP_SUPPORT_CLAIM)
+			{
+				assert(vvchParams.size() == 2);
+				std::string name(vvchParams[0].begin(), vvchParams[0].end());
+				int throwaway;
+				if (!trieCache.spendSupport(name, COutPoint(txin.prevout.hash, txin.prevout.n), nTxinHeight, throwaway))
+				{
+					LOG_INFO("%s(): The support was not found in the trie or queue\n", __func__);
+				}
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < tx.vout.size(); ++i)
+	{
+		const CTxOut& txout = tx.vout[i];
+
+		std::vector<std::vector<unsigned char> > vvchParams;
+		int op;
+		if (DecodeClaimScript(txout.scriptPubKey, op, vvchParams))
+		{
+			if (op == OP_CLAIM_NAME)
+			{
+				assert(vvchParams.size() == 2);
+				std::string name(vvchParams[0].begin(), vvchParams[0].end());
+				std::string addr(vvchParams[1].begin(), vvchParams[1].end());
+				if (!trieCache.addClaim(name, COutPoint(tx.GetHash(), i), ClaimIdHash(tx.GetHash(), i), txout.nValue, nHeight, addr))
+				{
+					LOG_INFO("%s: Something went wrong inserting the name\n", __func__);
+				}
+			}
+			else if (op == OP_UPDATE_CLAIM)
+			{
+				assert(vvchParams.size() == 3);
+				std::string name(vvchParams[0].begin(), vvchParams[0].end());
+				std::string addr(vvchParams[2].begin(), vvchParams[2].end());
+				uint160 claimId(vvchParams[1]);
+				spentClaimsType::iterator itSpent;
+				for (itSpent = spentClaims.begin(); itSpent != spentClaims.end(); ++itSpent)
+				{
+					if (itSpent->first == name && itSpent->second == claimId)
+					{
+						break;
+					}
+				}
+				if (itSpent != spentClaims.end())
+				{
+					spentClaims.erase(itSpent);
+					if (!trieCache.addClaim(name, COutPoint(tx.GetHash(), i), claimId, txout.nValue, nHeight, addr))
+					{
+						LOG_INFO("%s: Something went wrong updating a claim\n", __func__);
+					}
+				}
+				else
+				{
+					LOG_INFO("%s(): This update refers to a claim that was not found in the trie or queue, and therefore cannot be updated. The claim may have expired or it may have never existed.\n", __func__);
+				}
+			}
+			else if (op == OP_SUPPORT_CLAIM)
+			{
+				assert(vvchParams.size() == 2);
+				std::string name(vvchParams[0].begin(), vvchParams[0].end());
+				uint160 supportedClaimId(vvchParams[1]);
+				if (!trieCache.addSupport(name, COutPoint(tx.GetHash(), i), txout.nValue, supportedClaimId, nHeight))
+				{
+					LOG_INFO("%s: Something went wrong inserting the claim support\n", __func__);
+				}
+			}
+		}
+	}
+}
+
 std::unique_ptr<CBlockTemplate> CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
 {
 	// Create new block
@@ -114,22 +263,20 @@ std::unique_ptr<CBlockTemplate> CreateNewBlock(const CChainParams& chainparams,
 
 	// Collect memory pool transactions into the block
 	CTxMemPool::setEntries inBlock;
-	CTxMemPool::setEntries waitSet;
+	blockoutputs_t mapBlockOutputs;
 
 	// This vector will be sorted into a priority queue:
 	vector<TxCoinAgePriority> vecPriority;
 	TxCoinAgePriorityCompare pricomparer;
-	std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
-	typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
 	double actualPriority = -1;
 
-	std::priority_queue<CTxMemPool::txiter, std::vector<CTxMemPool::txiter>, ScoreCompare> clearedTxs;
 	bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
 	uint64_t nBlockSize = 1000;
 	uint64_t nBlockTx = 0;
 	unsigned int nBlockSigOps = 100;
 	int lastFewTxs = 0;
 	CAmount nFees = 0;
+	const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
 
 	{
 		LOCK2(cs_main, mempool.cs);
@@ -172,10 +319,14 @@ std::unique_ptr<CBlockTemplate> CreateNewBlock(const CChainParams& chainparams,
 			std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
 		}
 
-		CTxMemPool::indexed_transaction_set::nth_index<3>::type::iterator mi = mempool.mapTx.get<3>().begin();
+		// Candidates come by fee rate with ancestors, which the mempool keeps
+		// sorted as transactions enter and leave it; each goes in together
+		// with whichever of its ancestors are not in the block yet.
+		CTxMemPool::indexed_transaction_set::nth_index<4>::type::iterator mi = mempool.mapTx.get<4>().begin();
 		CTxMemPool::txiter iter;
+		std::string errString;
 
-		while (mi != mempool.mapTx.get<3>().end() || !clearedTxs.empty())
+		while (mi != mempool.mapTx.get<4>().end())
 		{
 			bool priorityTx = false;
 			if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
@@ -185,47 +336,44 @@ std::unique_ptr<CBlockTemplate> CreateNewBlock(const CChainParams& chainparams,
 				std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
 				vecPriority.pop_back();
 			}
-			else if (clearedTxs.empty()) { // add tx with next highest score
+			else { // add package with next highest score
 				iter = mempool.mapTx.project<0>(mi);
 				mi++;
 			}
-			else {  // try to add a previously postponed child tx
-				iter = clearedTxs.top();
-				clearedTxs.pop();
-			}
 
 			if (inBlock.count(iter))
-				continue; // could have been added to the priorityBlock
+				continue; // could have been added to the priorityBlock or as an ancestor
 
-			const CTransaction& tx = iter->GetTx();
-
-			bool fOrphan = false;
-			for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(iter))
-			{
-				if (!inBlock.count(parent)) {
-					fOrphan = true;
-					break;
-				}
-			}
-			if (fOrphan) {
-				if (priorityTx)
-					waitPriMap.insert(std::make_pair(iter, actualPriority));
+			CTxMemPool::setEntries package;
+			mempool.CalculateMemPoolAncestors(*iter, package, nNoLimit, nNoLimit, nNoLimit, nNoLimit, errString, false);
+			for (CTxMemPool::setEntries::iterator it = package.begin(); it != package.end(); ) {
+				if (inBlock.count(*it))
+					it = package.erase(it);
 				else
-					waitSet.insert(iter);
-				continue;
+					++it;
+			}
+			package.insert(iter);
+
+			uint64_t nPackageSize = 0;
+			CAmount nPackageFees = 0;
+			unsigned int nPackageSigOps = 0;
+			bool fFinal = true;
+			for (CTxMemPool::txiter it : package) {
+				nPackageSize += it->GetTxSize();
+				nPackageFees += it->GetModifiedFee();
+				nPackageSigOps += it->GetSigOpCount();
+				fFinal = fFinal && IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff);
 			}
 
-			unsigned int nTxSize = iter->GetTxSize();
 			if (fPriorityBlock &&
-				(nBlockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
+				(nBlockSize + nPackageSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
 				fPriorityBlock = false;
-				waitPriMap.clear();
 			}
 			if (!priorityTx &&
-				(iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && nBlockSize >= nBlockMinSize)) {
+				(nPackageFees < ::minRelayTxFee.GetFee(nPackageSize) && nBlockSize >= nBlockMinSize)) {
 				break;
 			}
-			if (nBlockSize + nTxSize >= nBlockMaxSize) {
+			if (nBlockSize + nPackageSize >= nBlockMaxSize) {
 				if (nBlockSize > nBlockMaxSize - 100 || lastFewTxs > 50) {
 					break;
 				}
@@ -237,197 +385,47 @@ std::unique_ptr<CBlockTemplate> CreateNewBlock(const CChainParams& chainparams,
 				continue;
 			}
 
-			if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
+			if (!fFinal)
 				continue;
 
-			typedef std::vector<std::pair<std::string, uint160> > spentClaimsType;
-			spentClaimsType spentClaims;
-
-			for (const CTxIn& txin : tx.vin)
-			{
-				const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-				int nTxinHeight = 0;
-				CScript scriptPubKey;
-				bool fGotCoins = false;
-				if (coins)
-				{
-					if (txin.prevout.n < coins->vout.size())
-					{
-						nTxinHeight = coins->nHeight;
-						scriptPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-						fGotCoins = true;
-					}
-				}
-				else // must be in block or else
-				{
-					for (CTxMemPool::txiter inBlockEntry : inBlock)
-					{
-						CTransaction inBlockTx = inBlockEntry->GetTx();
-						if (inBlockTx.GetHash() == txin.prevout.hash)
-						{
-							if (inBlockTx.vout.size() >= txin.prevout.n)
-							{
-								nTxinHeight = nHeight;
-								scriptPubKey = inBlockTx.vout[txin.prevout.n].scriptPubKey;
-								fGotCoins = true;
-							}
-						}
-					}
-				}
-				if (!fGotCoins)
-				{
-					LOG_INFO("Tried to include a transaction but could not find the txout it was spending. This is bad. Please send this log file to the maintainers of this program.\n");
-					throw std::runtime_error("Tried to include a transaction but could not find the txout it was spending.");
-				}
-
-				std::vector<std::vector<unsigned char> > vvchParams;
-				int op;
-
-				if (DecodeClaimScript(scriptPubKey, op, vvchParams))
-				{
-					if (op == OP_CLAIM_NAME || op == OP_UPDATE_CLAIM)
-					{
-						uint160 claimId;
-						if (op == OP_CLAIM_NAME)
-						{
-							assert(vvchParams.size() == 2);
-							claimId = ClaimIdHash(txin.prevout.hash, txin.prevout.n);
-						}
-						else if (op == OP_UPDATE_CLAIM)
-						{
-							assert(vvchParams.size() == 3);
-							claimId = uint160(vvchParams[1]);
-						}
-						std::string name(vvchParams[0].begin(), vvchParams[0].end());
-						int throwaway;
-						if (trieCache.spendClaim(name, COutPoint(txin.prevout.hash, txin.prevout.n), nTxinHeight, throwaway))
-						{
-							std::pair<std::string, uint160> entry(name, claimId);
-							spentClaims.push_back(entry);
-						}
-						else
-						{
-							LOG_INFO("%s(): The claim was not found in the trie or queue and therefore can't be updated\n", __func__);
-						}
-					}
-					else if (op == OP_SUPPORT_CLAIM)
-					{
-						assert(vvchParams.size() == 2);
-						std::string name(vvchParams[0].begin(), vvchParams[0].end());
-						int throwaway;
-						if (!trieCache.spendSupport(name, COutPoint(txin.prevout.hash, txin.prevout.n), nTxinHeight, throwaway))
-						{
-							LOG_INFO("%s(): The support was not found in the trie or queue\n", __func__);
-						}
-					}
-				}
-			}
-
-			for (unsigned int i = 0; i < tx.vout.size(); ++i)
-			{
-				const CTxOut& txout = tx.vout[i];
-
-				std::vector<std::vector<unsigned char> > vvchParams;
-				int op;
-				if (DecodeClaimScript(txout.scriptPubKey, op, vvchParams))
-				{
-					if (op == OP_CLAIM_NAME)
-					{
-						assert(vvchParams.size() == 2);
-						std::string name(vvchParams[0].begin(), vvchParams[0].end());
-						std::string addr(vvchParams[1].begin(), vvchParams[1].end());
-						if (!trieCache.addClaim(name, COutPoint(tx.GetHash(), i), ClaimIdHash(tx.GetHash(), i), txout.nValue, nHeight, addr))
-						{
-							LOG_INFO("%s: Something went wrong inserting the name\n", __func__);
-						}
-					}
-					else if (op == OP_UPDATE_CLAIM)
-					{
-						assert(vvchParams.size() == 3);
-						std::string name(vvchParams[0].begin(), vvchParams[0].end());
-						std::string addr(vvchParams[2].begin(), vvchParams[2].end());
-						uint160 claimId(vvchParams[1]);
-						spentClaimsType::iterator itSpent;
-						for (itSpent = spentClaims.begin(); itSpent != spentClaims.end(); ++itSpent)
-						{
-							if (itSpent->first == name && itSpent->second == claimId)
-							{
-								break;
-							}
-						}
-						if (itSpent != spentClaims.end())
-						{
-							spentClaims.erase(itSpent);
-							if (!trieCache.addClaim(name, COutPoint(tx.GetHash(), i), claimId, txout.nValue, nHeight, addr))
-							{
-								LOG_INFO("%s: Something went wrong updating a claim\n", __func__);
-							}
-						}
-						else
-						{
-							LOG_INFO("%s(): This update refers to a claim that was not found in the trie or queue, and therefore cannot be updated. The claim may have expired or it may have never existed.\n", __func__);
-						}
-					}
-					else if (op == OP_SUPPORT_CLAIM)
-					{
-						assert(vvchParams.size() == 2);
-						std::string name(vvchParams[0].begin(), vvchParams[0].end());
-						uint160 supportedClaimId(vvchParams[1]);
-						if (!trieCache.addSupport(name, COutPoint(tx.GetHash(), i), txout.nValue, supportedClaimId, nHeight))
-						{
-							LOG_INFO("%s: Something went wrong inserting the claim support\n", __func__);
-						}
-					}
-				}
-			}
-			CValidationState state;
-
-			unsigned int nTxSigOps = iter->GetSigOpCount();
-			if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS) {
+			if (nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS) {
 				if (nBlockSigOps > MAX_BLOCK_SIGOPS - 2) {
 					break;
 				}
 				continue;
 			}
 
-			CAmount nTxFees = iter->GetFee();
-			// Added
-			pblock->vtx.push_back(tx);
-			pblocktemplate->vTxFees.push_back(nTxFees);
-			pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-			nBlockSize += nTxSize;
-			++nBlockTx;
-			nBlockSigOps += nTxSigOps;
-			nFees += nTxFees;
-
-			if (fPrintPriority)
-			{
-				double dPriority = iter->GetPriority(nHeight);
-				CAmount dummy;
-				mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
-				LOG_INFO("priority %.1f fee %s txid %s\n",
-					dPriority, CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
-			}
-
-			inBlock.insert(iter);
-
-			// Add transactions that depend on this one to the priority queue
-			for (CTxMemPool::txiter child : mempool.GetMemPoolChildren(iter))
+			std::vector<CTxMemPool::txiter> sortedEntries;
+			SortForBlock(package, sortedEntries);
+			for (CTxMemPool::txiter it : sortedEntries)
 			{
-				if (fPriorityBlock) {
-					waitPriIter wpiter = waitPriMap.find(child);
-					if (wpiter != waitPriMap.end()) {
-						vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
-						std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-						waitPriMap.erase(wpiter);
-					}
-				}
-				else {
-					if (waitSet.count(child)) {
-						clearedTxs.push(child);
-						waitSet.erase(child);
-					}
+				const CTransaction& tx = it->GetTx();
+				UpdateClaimTrieForTx(trieCache, view, mapBlockOutputs, tx, nHeight);
+
+				unsigned int nTxSize = it->GetTxSize();
+				unsigned int nTxSigOps = it->GetSigOpCount();
+				CAmount nTxFees = it->GetFee();
+				// Added
+				pblock->vtx.push_back(tx);
+				pblocktemplate->vTxFees.push_back(nTxFees);
+				pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+				nBlockSize += nTxSize;
+				++nBlockTx;
+				nBlockSigOps += nTxSigOps;
+				nFees += nTxFees;
+
+				if (fPrintPriority)
+				{
+					double dPriority = it->GetPriority(nHeight);
+					CAmount dummy;
+					mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
+					LOG_INFO("priority %.1f fee %s txid %s\n",
+						dPriority, CFeeRate(it->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
 				}
+
+				inBlock.insert(it);
+				for (unsigned int i = 0; i < tx.vout.size(); i++)
+					mapBlockOutputs[COutPoint(tx.GetHash(), i)] = &tx.vout[i];
 			}
 		}
 
@@ -534,13 +532,15 @@ static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainpar
 }
 
 // ***TODO*** that part changed in bitcoin, we are using a mix with old one here for now
-void static BitcoinMiner(const CChainParams& chainparams)
+void static BitcoinMiner(const CChainParams& chainparams, int nThreadId)
 {
     LOG_INFO("UlordMiner -- started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
     RenameThread("ulord-miner");
 
     unsigned int nExtraNonce = 0;
+    uint64_t nHashesDone = 0;
+    int64_t nHashRateStart = GetTimeMillis();
 
     boost::shared_ptr<CReserveScript> coinbaseScript;
     GetMainSignals().ScriptForMining(coinbaseScript);
@@ -597,10 +597,16 @@ void static BitcoinMiner(const CChainParams& chainparams)
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
             while (true)
             {
+                // Serialize the header once, only the nonce changes below.
+                // One nonce at a time: interleaving several measured slower,
+                // their work memories don't fit in cache
+                unsigned char header[CBlockHeader::HEADER_SIZE];
+                pblock->SerializeHeader(header);
                 uint256 hash;
                 while (true) 
 		        { 
-		            hash = pblock->GetHash();
+		            CryptoHello::Hash(header, hash.begin());
+                    nHashesDone++;
                     if (UintToArith256(hash) <= hashTarget)
                     {
                         // Found a solution
@@ -618,6 +624,7 @@ void static BitcoinMiner(const CChainParams& chainparams)
                         break;
                     }
                     pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
+                    memcpy(header + POW_NONCE_OFFSET, pblock->nNonce.begin(), pblock->nNonce.size());
                     if ((UintToArith256(pblock->nNonce) & 0xFF) == 0)
 		            {
 			            //LOG_INFO("UlordMiner: %d   nExtraNonce: %d\n", pblock->nNonce, nExtraNonce);    
@@ -625,6 +632,15 @@ void static BitcoinMiner(const CChainParams& chainparams)
                     }
                 }
 
+                // Report this thread's hashrate
+                int64_t nNow = GetTimeMillis();
+                if (nNow - nHashRateStart >= MINER_HASHRATE_INTERVAL * 1000)
+                {
+                    LOG_INFO("UlordMiner -- thread {}: {:.2f} hash/s", nThreadId, nHashesDone * 1000.0 / (nNow - nHashRateStart));
+                    nHashRateStart = nNow;
+                    nHashesDone = 0;
+                }
+
                 // Check for stop or if block needs to be rebuilt
                 boost::this_thread::interruption_point();
                 // Regtest mode doesn't require peers
@@ -680,5 +696,5 @@ void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainpar
 
     minerThreads = new boost::thread_group();
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(std::bind(&BitcoinMiner, boost::cref(chainparams)));
+        minerThreads->create_thread(std::bind(&BitcoinMiner, boost::cref(chainparams), i));
 }
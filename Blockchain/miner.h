@@ -19,6 +19,8 @@ namespace Consensus { struct Params; };
 
 static const bool DEFAULT_GENERATE = false;
 static const int DEFAULT_GENERATE_THREADS = 1;
+/** Seconds between per-thread hashrate reports */
+static const int64_t MINER_HASHRATE_INTERVAL = 60;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
 
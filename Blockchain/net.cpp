@@ -34,6 +34,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -95,12 +99,14 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+SocketEventsMode nSocketEventsMode = DEFAULT_SOCKETEVENTS;
+int nMsgHandThreads = DEFAULT_MSGHAND_THREADS;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSharedPayloadRef> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -120,6 +126,7 @@ CCriticalSection cs_nLastNodeId;
 static CSemaphore *semOutbound = NULL;
 static CSemaphore *semMasternodeOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+static std::atomic<size_t> nMsgHandlerPass(0);
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -389,6 +396,56 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+#ifdef USE_EPOLL
+static int epollfd = -1;
+#endif
+
+bool ParseSocketEventsMode(const std::string& strMode, SocketEventsMode& mode)
+{
+    if (strMode == "select") {
+        mode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef USE_EPOLL
+    if (strMode == "epoll") {
+        mode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string GetSocketEventsModeName(SocketEventsMode mode)
+{
+    switch (mode) {
+    case SOCKETEVENTS_SELECT: return "select";
+    case SOCKETEVENTS_EPOLL: return "epoll";
+    }
+    return "unknown";
+}
+
+bool IsServiceableSocket(SOCKET hSocket)
+{
+    return nSocketEventsMode == SOCKETEVENTS_EPOLL || IsSelectableSocket(hSocket);
+}
+
+/** Have epoll report readiness of pnode's socket to the socket handler, cs_vNodes held */
+static void RegisterNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (epollfd == -1)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0)
+    {
+        LOG_INFO("epoll_ctl() failed for peer={}: {}", pnode->id, NetworkErrorString(WSAGetLastError()));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fConnectToMasternode)
 {
     if (pszDest == NULL) {
@@ -423,7 +480,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fConnectToMas
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsServiceableSocket(hSocket)) {
             LOG_INFO("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -442,6 +499,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fConnectToMas
 
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterNodeSocket(pnode);
 
         return pnode;
     } else if (!proxyConnectionFailed) {
@@ -459,6 +517,12 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LOG_INFO("disconnecting peer=%d\n", id);
+#ifdef USE_EPOLL
+        // Deregister explicitly: a forked child holding the descriptor
+        // would keep the registration, and its CNode pointer, alive
+        if (epollfd != -1)
+            epoll_ctl(epollfd, EPOLL_CTL_DEL, hSocket, NULL);
+#endif
         CloseSocket(hSocket);
     }
 
@@ -669,6 +733,11 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    X(nMsgProcessed);
+    X(nMsgDeferred);
+    X(nMsgHandlerUsec);
+    X(nMsgQueueDepth);
 }
 #undef X
 
@@ -680,7 +749,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, nRecvVersion));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, nRecvVersion);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -711,26 +780,107 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
     return true;
 }
 
+/**
+ * Receive buffers of processed messages. Messages are received on the socket
+ * handler thread but released on the message handler threads, so the pool is
+ * shared rather than kept per thread.
+ *
+ * Only buffers of MIN_POOLED_RECV_BUFFER up to MAX_PROTOCOL_MESSAGE_LENGTH
+ * bytes are kept, by size class: class k holds buffers of at least
+ * MIN_POOLED_RECV_BUFFER << k bytes, so taking or returning one looks at a
+ * class or two rather than at every pooled buffer.
+ */
+static const int RECV_BUFFER_CLASSES = 6;
+static_assert((MIN_POOLED_RECV_BUFFER << (RECV_BUFFER_CLASSES - 1)) == MAX_PROTOCOL_MESSAGE_LENGTH, "the largest class holds the largest message");
+static std::vector<CSerializeData> vRecvBufferPool[RECV_BUFFER_CLASSES];
+static size_t nRecvBufferPoolSize = 0;
+static size_t nRecvBufferPoolCount = 0;
+static CCriticalSection cs_vRecvBufferPool;
+
+/** Take an empty buffer that holds nSize bytes without reallocating */
+static void TakeRecvBuffer(CSerializeData& vch, size_t nSize)
+{
+    vch.clear();
+    if (nSize < MIN_POOLED_RECV_BUFFER || nSize > MAX_PROTOCOL_MESSAGE_LENGTH) {
+        vch.reserve(nSize);
+        return;
+    }
+
+    // Smallest class whose buffers all hold nSize bytes
+    int nClass = 0;
+    while ((MIN_POOLED_RECV_BUFFER << nClass) < nSize)
+        nClass++;
+    {
+        LOCK(cs_vRecvBufferPool);
+        for (int k = nClass; k < std::min(nClass + 2, RECV_BUFFER_CLASSES); k++) {
+            std::vector<CSerializeData>& vPool = vRecvBufferPool[k];
+            if (!vPool.empty()) {
+                vch.swap(vPool.back());
+                vPool.pop_back();
+                nRecvBufferPoolSize -= vch.capacity();
+                nRecvBufferPoolCount--;
+                break;
+            }
+        }
+    }
+    vch.clear();
+    // A new buffer gets the size of its class, so any message of the class fits it later
+    vch.reserve(MIN_POOLED_RECV_BUFFER << nClass);
+}
+
+/** Return a buffer to the pool, or free it if it is not worth keeping or the pool is full */
+static void GiveRecvBuffer(CSerializeData& vch)
+{
+    size_t nCapacity = vch.capacity();
+    if (nCapacity < MIN_POOLED_RECV_BUFFER || nCapacity >= 2 * MAX_PROTOCOL_MESSAGE_LENGTH)
+        return;
+    int nClass = 0;
+    while (nClass + 1 < RECV_BUFFER_CLASSES && (MIN_POOLED_RECV_BUFFER << (nClass + 1)) <= nCapacity)
+        nClass++;
+    LOCK(cs_vRecvBufferPool);
+    if (nRecvBufferPoolSize + nCapacity > MAX_RECV_BUFFER_POOL_SIZE || nRecvBufferPoolCount >= MAX_RECV_BUFFER_POOL_COUNT)
+        return;
+    nRecvBufferPoolSize += nCapacity;
+    nRecvBufferPoolCount++;
+    vRecvBufferPool[nClass].emplace_back();
+    vRecvBufferPool[nClass].back().swap(vch);
+}
+
+void CSharedPayload::SetChecksum()
+{
+    uint256 hash = Hash(vch.begin(), vch.end());
+    nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+}
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData vch;
+    vRecv.swap(vch);
+    GiveRecvBuffer(vch);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
-    // deserialize to CMessageHeader
-    try {
-        hdrbuf >> hdr;
-    }
-    catch (const std::exception&) {
-        return -1;
-    }
+    // deserialize to CMessageHeader, in the layout of its SerializationOp
+    uint32_t nSizeLE, nChecksumLE;
+    memcpy(hdr.pchMessageStart.data(), hdrbuf, MESSAGE_START_SIZE);
+    memcpy(hdr.pchCommand, hdrbuf + MESSAGE_START_SIZE, CMessageHeader::COMMAND_SIZE);
+    memcpy(&nSizeLE, hdrbuf + CMessageHeader::MESSAGE_SIZE_OFFSET, CMessageHeader::MESSAGE_SIZE_SIZE);
+    memcpy(&nChecksumLE, hdrbuf + CMessageHeader::CHECKSUM_OFFSET, CMessageHeader::CHECKSUM_SIZE);
+    hdr.nMessageSize = letoh32(nSizeLE);
+    hdr.nChecksum = letoh32(nChecksumLE);
 
     // reject messages larger than MAX_SIZE
     if (hdr.nMessageSize > MAX_SIZE)
@@ -747,12 +897,15 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    // The caller has checked hdr.nMessageSize by now, so the whole payload
+    // is received into one buffer that is never reallocated
+    if (nDataPos == 0) {
+        CSerializeData vch;
+        TakeRecvBuffer(vch, hdr.nMessageSize);
+        vRecv.swap(vch);
     }
 
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    vRecv.insert(vRecv.end(), pch, pch + nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -769,23 +922,50 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    while (!pnode->vSendMsg.empty()) {
+        // Gather the front of the queue, skipping what was sent already
+        struct iovec iov[MAX_SEND_IOV];
+        int nIov = 0;
+        size_t nGathered = 0;
+        size_t nSkip = pnode->nSendOffset;
+        for (std::deque<CSendMessage>::const_iterator it = pnode->vSendMsg.begin(); it != pnode->vSendMsg.end() && nIov + 2 <= MAX_SEND_IOV; ++it) {
+            const CSerializeData* parts[2] = { &it->vch, it->payload ? &it->payload->vch : NULL };
+            for (const CSerializeData* part : parts) {
+                if (!part || part->size() <= nSkip) {
+                    nSkip -= part ? part->size() : 0;
+                    continue;
+                }
+                iov[nIov].iov_base = (void*)(part->data() + nSkip);
+                iov[nIov].iov_len = part->size() - nSkip;
+                nGathered += iov[nIov].iov_len;
+                nIov++;
+                nSkip = 0;
+            }
+        }
+        assert(nGathered > 0);
 
-    while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+        int nBytes = send(pnode->hSocket, (const char*)iov[0].iov_base, iov[0].iov_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        nGathered = iov[0].iov_len;
+#else
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
             pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
-                pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                it++;
-            } else {
-                // could not send full message; stop sending more
+            while (!pnode->vSendMsg.empty() && pnode->nSendOffset >= pnode->vSendMsg.front().size()) {
+                size_t nSize = pnode->vSendMsg.front().size();
+                pnode->nSendOffset -= nSize;
+                pnode->nSendSize -= nSize;
+                pnode->vSendMsg.pop_front();
+            }
+            if ((size_t)nBytes < nGathered) {
+                // could not send everything gathered; stop sending more
                 break;
             }
         } else {
@@ -803,11 +983,10 @@ void SocketSendData(CNode *pnode)
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
+    if (pnode->vSendMsg.empty()) {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
 }
 
 static list<CNode*> vNodesDisconnected;
@@ -994,7 +1173,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsServiceableSocket(hSocket))
     {
         LOG_INFO("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1035,278 +1214,457 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterNodeSocket(pnode);
     }
 }
 
-void ThreadSocketHandler()
+#ifdef USE_EPOLL
+/** Nodes with readiness left to serve, only used by the socket handler thread */
+static std::vector<CNode*> vNodesReady;
+#endif
+
+static void DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
             {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
-                {
-                    LOG_INFO("ThreadSocketHandler -- removing node: peer=%d addr=%s nRefCount=%d fNetworkNode=%d fInbound=%d fMasternode=%d, fDisconnect=%d\n",
-                              pnode->id, pnode->addr.ToString(), pnode->GetRefCount(), pnode->fNetworkNode, pnode->fInbound, pnode->fMasternode, pnode->fDisconnect);
+                LOG_INFO("ThreadSocketHandler -- removing node: peer=%d addr=%s nRefCount=%d fNetworkNode=%d fInbound=%d fMasternode=%d, fDisconnect=%d\n",
+                          pnode->id, pnode->addr.ToString(), pnode->GetRefCount(), pnode->fNetworkNode, pnode->fInbound, pnode->fMasternode, pnode->fDisconnect);
 
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
-                    pnode->grantMasternodeOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
+                pnode->grantMasternodeOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
-
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    if (pnode->fMasternode)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+#ifdef USE_EPOLL
+                if (pnode->fSocketReady)
+                {
+                    vNodesReady.erase(remove(vNodesReady.begin(), vNodesReady.end(), pnode), vNodesReady.end());
+                    pnode->fSocketReady = false;
                 }
+#endif
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                if (pnode->fMasternode)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        for (CNode* pnode : vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            for (CNode* pnode : vNodesDisconnectedCopy)
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0)
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                bool fDelete = false;
                 {
-                    bool fDelete = false;
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
                     {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend)
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv)
                         {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv)
-                            {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete)
-                    {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete)
+                {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
                 }
             }
         }
-        if(vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-        }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+/** Whether pnode may receive more before its queued messages are processed, cs_vRecvMsg held */
+static bool ReceiveBufferHasRoom(CNode* pnode)
+{
+    return pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+           pnode->GetTotalRecvSize() <= ReceiveFloodSize();
+}
 
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+/**
+ * Receive once from pnode's socket, cs_vRecvMsg held. Returns false once
+ * the socket would block or is closed, true if data may be left.
+ */
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return pnode->hSocket != INVALID_SOCKET;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LOG_INFO("socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LOG_INFO("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
         }
+        else if (nErr == WSAEINTR)
+            return true;
+    }
+    return false;
+}
 
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
         {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
+            LOG_INFO("socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LOG_INFO("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LOG_INFO("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LOG_INFO("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+static void SocketHandlerSelect()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = SOCKET_SWEEP_INTERVAL * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+        {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is no (complete) message in the receive buffer,
+            //   or there is space left in the buffer, select() for receiving data.
+            // * (if neither of the above applies, there is certainly one message
+            //   in the receiver buffer ready to be processed).
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
             {
-                if (pnode->hSocket == INVALID_SOCKET)
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend && !pnode->vSendMsg.empty()) {
+                    FD_SET(pnode->hSocket, &fdsetSend);
                     continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
+            {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && ReceiveBufferHasRoom(pnode))
+                    FD_SET(pnode->hSocket, &fdsetRecv);
+            }
         }
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LOG_INFO("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            int nErr = WSAGetLastError();
+            LOG_INFO("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec/1000);
+    }
+
+    //
+    // Accept new connections
+    //
+    for (const ListenSocket& hListenSocket : vhListenSocket)
+    {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+        {
+            AcceptConnection(hListenSocket);
         }
+    }
+
+    //
+    // Service each socket
+    //
+    vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
+            pnode->AddRef();
+    }
+    for (CNode* pnode : vNodesCopy)
+    {
+        boost::this_thread::interruption_point();
 
         //
-        // Accept new connections
+        // Receive
         //
-        for (const ListenSocket& hListenSocket : vhListenSocket)
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+                SocketRecvData(pnode);
         }
 
         //
-        // Service each socket
+        // Send
         //
-        vector<CNode*> vNodesCopy;
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetSend))
         {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
-                pnode->AddRef();
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend)
+                SocketSendData(pnode);
         }
+
+        //
+        // Inactivity checking
+        //
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
         for (CNode* pnode : vNodesCopy)
-        {
-            boost::this_thread::interruption_point();
+            pnode->Release();
+    }
+}
 
-            //
-            // Receive
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+#ifdef USE_EPOLL
+/**
+ * Serve sockets as epoll reports them ready until the next sweep is due,
+ * then check every node for inactivity. Unlike select(), a wakeup costs
+ * nothing for idle peers and descriptors are not limited to FD_SETSIZE.
+ */
+static void SocketHandlerEpoll()
+{
+    struct epoll_event events[256];
+    int64_t nSweepTime = GetTimeMillis() + SOCKET_SWEEP_INTERVAL;
+    int nTimeout = 0;
+    while (true)
+    {
+        int nEvents = epoll_wait(epollfd, events, ARRAYLEN(events), nTimeout);
+        boost::this_thread::interruption_point();
+        if (nEvents == SOCKET_ERROR)
+        {
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR)
             {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LOG_INFO("socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LOG_INFO("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                LOG_INFO("socket epoll_wait error {}", NetworkErrorString(nErr));
+                MilliSleep(SOCKET_SWEEP_INTERVAL);
             }
+            nEvents = 0;
+        }
 
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
+        for (int i = 0; i < nEvents; i++)
+        {
+            const ListenSocket* pListenSocket = NULL;
+            for (const ListenSocket& hListenSocket : vhListenSocket)
+                if (events[i].data.ptr == &hListenSocket)
+                    pListenSocket = &hListenSocket;
+            if (pListenSocket)
+            {
+                // Level-triggered, so one accept per wakeup drains the backlog
+                AcceptConnection(*pListenSocket);
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            }
+
+            // Nodes are only deleted by this thread, after CloseSocketDisconnect()
+            // removed them from epoll, so the pointer is alive
+            CNode* pnode = static_cast<CNode*>(events[i].data.ptr);
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                pnode->fSocketReadable = true;
+            if (events[i].events & EPOLLOUT)
+                pnode->fSocketWritable = true;
+            if (!pnode->fSocketReady)
             {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
+                pnode->fSocketReady = true;
+                vNodesReady.push_back(pnode);
             }
+        }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
+        // Same rules as the select() path: drain pending sends before
+        // receiving more, and stop receiving while the buffer is flooded.
+        bool fBusy = false;
+        bool fRetry = false;
+        for (size_t i = 0; i < vNodesReady.size(); )
+        {
+            CNode* pnode = vNodesReady[i];
+            bool fPending = false;
+            bool fSendPending = false;
+            if (pnode->hSocket != INVALID_SOCKET)
             {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LOG_INFO("socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LOG_INFO("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend)
                 {
-                    LOG_INFO("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
+                    if (pnode->fSocketWritable && !pnode->vSendMsg.empty())
+                    {
+                        SocketSendData(pnode);
+                        // A partial send means the socket buffer is full, wait for EPOLLOUT
+                        if (!pnode->vSendMsg.empty())
+                            pnode->fSocketWritable = false;
+                    }
+                    fSendPending = !pnode->vSendMsg.empty();
                 }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+                else if (pnode->fSocketWritable)
+                    fRetry = fPending = true;
+            }
+            if (pnode->hSocket != INVALID_SOCKET && pnode->fSocketReadable)
+            {
+                fPending = true;
+                if (!fSendPending)
                 {
-                    LOG_INFO("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
+                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                    if (!lockRecv)
+                        fRetry = true;
+                    else if (ReceiveBufferHasRoom(pnode))
+                    {
+                        pnode->fSocketReadable = SocketRecvData(pnode);
+                        fPending = pnode->fSocketReadable;
+                        fBusy |= pnode->fSocketReadable;
+                    }
                 }
             }
+            if (fPending && pnode->hSocket != INVALID_SOCKET)
+            {
+                i++;
+                continue;
+            }
+            pnode->fSocketReady = false;
+            vNodesReady[i] = vNodesReady.back();
+            vNodesReady.pop_back();
         }
+
+        int64_t nNow = GetTimeMillis();
+        if (nNow >= nSweepTime)
+            break;
+        nTimeout = fBusy ? 0 : fRetry ? 1 : nSweepTime - nNow;
+    }
+
+    //
+    // Inactivity checking
+    //
+    vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
+            pnode->AddRef();
+    }
+    for (CNode* pnode : vNodesCopy)
+    {
+        if (pnode->hSocket != INVALID_SOCKET)
+            InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodesCopy)
+            pnode->Release();
+    }
+}
+#endif
+
+void ThreadSocketHandler()
+{
+    while (true)
+    {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes();
+
+#ifdef USE_EPOLL
+        if (nSocketEventsMode == SOCKETEVENTS_EPOLL)
         {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodesCopy)
-                pnode->Release();
+            SocketHandlerEpoll();
+            continue;
         }
+#endif
+        SocketHandlerSelect();
     }
 }
 
@@ -1773,6 +2131,11 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
+void WakeMessageHandler()
+{
+    messageHandlerCondition.notify_all();
+}
+
 void ThreadMessageHandler()
 {
     boost::mutex condition_mutex;
@@ -1792,29 +2155,45 @@ void ThreadMessageHandler()
 
         bool fSleep = true;
 
-        for (CNode* pnode : vNodesCopy)
+        // Every pass starts one node further on, so the threads spread over
+        // the list and no node is always served first.
+        size_t nFirst = nMsgHandlerPass++;
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[(nFirst + i) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
+            // Another thread is serving this node
+            if (pnode->fMsgHandlerBusy.exchange(true))
+                continue;
+
+            int64_t nStart = GetTimeMicros();
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
                 {
+                    uint64_t nDeferred = pnode->nMsgDeferred;
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->fDisconnect = true;
 
-                    if (pnode->nSendSize < SendBufferSize())
+                    // A deferred message is retried once the serialized one
+                    // it waits for wakes us, not by spinning
+                    if (pnode->nSendSize < SendBufferSize() && pnode->nMsgDeferred == nDeferred)
                     {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
                             fSleep = false;
                         }
                     }
+
+                    pnode->nMsgQueueDepth = pnode->vRecvMsg.size();
+                    if (!pnode->vRecvMsg.empty() && !pnode->vRecvMsg.back().complete())
+                        pnode->nMsgQueueDepth--;
                 }
             }
-            boost::this_thread::interruption_point();
 
             // Send messages
             {
@@ -1822,6 +2201,9 @@ void ThreadMessageHandler()
                 if (lockSend)
                     g_signals.SendMessages(pnode);
             }
+
+            pnode->nMsgHandlerUsec += GetTimeMicros() - nStart;
+            pnode->fMsgHandlerBusy = false;
             boost::this_thread::interruption_point();
         }
 
@@ -2042,6 +2424,38 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Map ports with UPnP
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
+#ifdef USE_EPOLL
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL)
+    {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        for (const ListenSocket& hListenSocket : vhListenSocket)
+        {
+            if (epollfd == -1)
+                break;
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = const_cast<ListenSocket*>(&hListenSocket);
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+            {
+                close(epollfd);
+                epollfd = -1;
+            }
+        }
+        if (epollfd == -1)
+        {
+            LOG_ERROR("Could not set up epoll ({}), falling back to select()", NetworkErrorString(WSAGetLastError()));
+            nSocketEventsMode = SOCKETEVENTS_SELECT;
+        }
+        else
+        {
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vNodes)
+                RegisterNodeSocket(pnode);
+        }
+    }
+#endif
+    LOG_INFO("Using {} for socket events", GetSocketEventsModeName(nSocketEventsMode));
+
     // Send and receive from sockets, accept connections
     threadGroup.create_thread(std::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
@@ -2055,7 +2469,8 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(std::bind(&TraceThread<void (*)()>, "mnbcon", &ThreadMnbRequestConnections));
 
     // Process messages
-    threadGroup.create_thread(std::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMsgHandThreads; i++)
+        threadGroup.create_thread(std::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
@@ -2098,6 +2513,14 @@ public:
                 if (!CloseSocket(hListenSocket.socket))
                     LOG_INFO("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
 
+#ifdef USE_EPOLL
+        if (epollfd != -1)
+        {
+            close(epollfd);
+            epollfd = -1;
+        }
+#endif
+
         // clean up some globals (to help leak detection)
         for (CNode *pnode : vNodes)
             delete pnode;
@@ -2161,7 +2584,7 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
         }
 
         // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        mapRelay.insert(std::make_pair(inv, std::make_shared<const CSharedPayload>(CSerializeData(ss.begin(), ss.end()))));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -2481,6 +2904,14 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fSocketReadable = false;
+    fSocketWritable = true;
+    fSocketReady = false;
+    fMsgHandlerBusy = false;
+    nMsgProcessed = 0;
+    nMsgDeferred = 0;
+    nMsgHandlerUsec = 0;
+    nMsgQueueDepth = 0;
     hashContinue = uint256();
     nStartingHeight = -1;
     filterInventoryKnown.reset();
@@ -2591,6 +3022,11 @@ void CNode::AbortMessage() UNLOCK_FUNCTION(cs_vSend)
 }
 
 void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
+{
+    EndMessage(CSharedPayloadRef());
+}
+
+void CNode::EndMessage(const CSharedPayloadRef& payload) UNLOCK_FUNCTION(cs_vSend)
 {
     // The -*messagestest options are intentionally not documented in the help message,
     // since they are only used during development to debug the networking code and are
@@ -2601,7 +3037,8 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         AbortMessage();
         return;
     }
-    if (mapArgs.count("-fuzzmessagestest"))
+    // A shared payload is never fuzzed, other nodes send it too
+    if (mapArgs.count("-fuzzmessagestest") && !payload)
         Fuzz(GetArg("-fuzzmessagestest", 10));
 
     if (ssSend.size() == 0)
@@ -2611,20 +3048,28 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     }
     // Set the size
     unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
+    if (payload)
+        nSize += payload->vch.size();
     *(uint32_t *)((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET]) = htole32(nSize);
 
     // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
     unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    if (payload) {
+        assert(ssSend.size() == CMessageHeader::HEADER_SIZE);
+        nChecksum = payload->nChecksum;
+    } else {
+        uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
+        memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    }
     assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
     memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
 
     LOG_INFO("(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    std::deque<CSendMessage>::iterator it = vSendMsg.insert(vSendMsg.end(), CSendMessage());
+    ssSend.GetAndClear(it->vch);
+    it->payload = payload;
+    nSendSize += it->size();
 
     // If write queue empty, attempt "optimistic write"
     if (it == vSendMsg.begin())
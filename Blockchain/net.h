@@ -18,7 +18,9 @@
 #include "util.h"
 #include "Log.h"
 
+#include <atomic>
 #include <deque>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -31,6 +33,9 @@
 class CAddrMan;
 class CScheduler;
 class CNode;
+class CSharedPayload;
+
+typedef std::shared_ptr<const CSharedPayload> CSharedPayloadRef;
 
 namespace boost {
     class thread_group;
@@ -48,6 +53,14 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 2 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 2 * 1024 * 1024;
+/** Most memory kept in the receive buffers of processed messages for reuse by later ones */
+static const size_t MAX_RECV_BUFFER_POOL_SIZE = 16 * 1024 * 1024;
+/** Most receive buffers kept for reuse */
+static const size_t MAX_RECV_BUFFER_POOL_COUNT = 128;
+/** Smallest receive buffer kept for reuse; smaller messages are cheap to allocate */
+static const size_t MIN_POOLED_RECV_BUFFER = 64 * 1024;
+/** Most buffers of the send queue handed to one sendmsg() call */
+static const int MAX_SEND_IOV = 64;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** -listen default */
@@ -69,6 +82,23 @@ static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** Default for blocks only*/
 static const bool DEFAULT_BLOCKSONLY = false;
 
+/** How the socket handler thread waits for socket readiness (-socketevents) */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT = 0,
+    SOCKETEVENTS_EPOLL = 1,
+};
+#ifdef USE_EPOLL
+static const SocketEventsMode DEFAULT_SOCKETEVENTS = SOCKETEVENTS_EPOLL;
+#else
+static const SocketEventsMode DEFAULT_SOCKETEVENTS = SOCKETEVENTS_SELECT;
+#endif
+/** Longest the socket handler waits before it sweeps all nodes for disconnects and timeouts, in milliseconds */
+static const int SOCKET_SWEEP_INTERVAL = 50;
+/** Maximum number of message handler threads (-msghandthreads) */
+static const int MAX_MSGHAND_THREADS = 16;
+/** -msghandthreads default (0 = one per core) */
+static const int DEFAULT_MSGHAND_THREADS = 4;
+
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
@@ -95,6 +125,12 @@ bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+bool ParseSocketEventsMode(const std::string& strMode, SocketEventsMode& mode);
+std::string GetSocketEventsModeName(SocketEventsMode mode);
+/** Whether the socket handler can serve hSocket in the current -socketevents mode */
+bool IsServiceableSocket(SOCKET hSocket);
+/** Wake message handler threads waiting for work */
+void WakeMessageHandler();
 
 typedef int NodeId;
 
@@ -162,10 +198,13 @@ extern CAddrMan addrman;
 
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+extern SocketEventsMode nSocketEventsMode;
+/** Number of threads running ThreadMessageHandler */
+extern int nMsgHandThreads;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSharedPayloadRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<uint256, int64_t> mapAlreadyAskedFor;
@@ -209,6 +248,10 @@ public:
     double dPingWait;
     double dPingMin;
     std::string addrLocal;
+    uint64_t nMsgProcessed;
+    uint64_t nMsgDeferred;
+    int64_t nMsgHandlerUsec;
+    size_t nMsgQueueDepth;
 };
 
 
@@ -218,23 +261,26 @@ class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CDataStream vRecv;              // received message data, in a buffer taken from the receive buffer pool
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
 
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -244,7 +290,6 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -253,6 +298,46 @@ public:
 };
 
 
+/**
+ * A serialized message payload that can be queued for any number of nodes,
+ * which then all send from the same buffer. Immutable once made.
+ */
+class CSharedPayload
+{
+public:
+    CSerializeData vch;
+    unsigned int nChecksum;         // checksum field of the message header carrying it
+
+    explicit CSharedPayload(CSerializeData&& vchIn) : vch(std::move(vchIn)) {
+        SetChecksum();
+    }
+
+    template <typename T>
+    CSharedPayload(const T& obj, int nTypeIn, int nVersionIn) {
+        CDataStream ss(nTypeIn, nVersionIn);
+        ss << obj;
+        ss.swap(vch);
+        SetChecksum();
+    }
+
+private:
+    void SetChecksum();
+};
+
+
+/** A message queued for sending: its own bytes, followed by a shared payload if it has one */
+class CSendMessage {
+public:
+    CSerializeData vch;
+    CSharedPayloadRef payload;
+
+    size_t size() const
+    {
+        return vch.size() + (payload ? payload->vch.size() : 0);
+    }
+};
+
+
 typedef enum BanReason
 {
     BanReasonUnknown          = 0,
@@ -325,12 +410,24 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSendMessage> vSendMsg;
     CCriticalSection cs_vSend;
+    // Readiness last reported by epoll, only used by the socket handler thread.
+    // Edge-triggered, so each stays set until the socket would block.
+    bool fSocketReadable;
+    bool fSocketWritable;
+    bool fSocketReady; // in the socket handler's list of nodes to serve
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Set while one of the message handler threads serves this node, so that
+    // its messages are handled in order and by one thread at a time.
+    std::atomic<bool> fMsgHandlerBusy;
+    uint64_t nMsgProcessed; // messages handed to ProcessMessage
+    uint64_t nMsgDeferred; // times the next message waited for another node's serialized one
+    int64_t nMsgHandlerUsec; // time message handler threads spent on this node
+    size_t nMsgQueueDepth; // complete messages left in vRecvMsg after the last visit
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -389,7 +486,7 @@ public:
     uint256 hashContinue;
     int nStartingHeight;
 
-    // flood relay
+    // flood relay, vAddrToSend and addrKnown protected by cs_inventory
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -492,11 +589,13 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_inventory);
         addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
     {
+        LOCK(cs_inventory);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
@@ -548,9 +647,27 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    // Like EndMessage(), with payload queued by reference after the header in ssSend
+    void EndMessage(const CSharedPayloadRef& payload) UNLOCK_FUNCTION(cs_vSend);
+
     void PushVersion();
 
 
+    /** Push a message whose payload was serialized once, for any number of nodes */
+    void PushSharedMessage(const char* pszCommand, const CSharedPayloadRef& payload)
+    {
+        try
+        {
+            BeginMessage(pszCommand);
+            EndMessage(payload);
+        }
+        catch (...)
+        {
+            AbortMessage();
+            throw;
+        }
+    }
+
     void PushMessage(const char* pszCommand)
     {
         try
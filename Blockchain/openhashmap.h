@@ -0,0 +1,383 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_OPENHASHMAP_H
+#define BITCOIN_OPENHASHMAP_H
+
+#include "memusage.h"
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Hash map with open addressing (linear probing) over a flat array of slots,
+ * its entries allocated from pools owned by the map.
+ *
+ * A slot is 8 bytes: the low 32 bits of the key's hash, which place the key
+ * and rule out most mismatches without touching the entry, and the index of
+ * the entry in the pools. Each pool is twice the size of the previous one,
+ * and erased entries are reused before a new pool is added; the pools are
+ * only freed by clear() and destruction.
+ *
+ * As with std::unordered_map, entries never move, so pointers and
+ * references to them stay valid until they are erased. Iterators are
+ * invalidated by inserting a new key, which may rehash, and by clear().
+ * Erasing leaves a tombstone, so other iterators stay valid and
+ * "erase(it++)" loops work.
+ */
+template <typename K, typename T, typename Hash>
+class COpenHashMap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+
+private:
+    //! Slot states besides an entry index + 1
+    static const uint32_t SLOT_EMPTY = 0;
+    static const uint32_t SLOT_ERASED = 0xffffffff;
+
+    //! The first pool holds 2^POOL_BITS entries
+    static const unsigned int POOL_BITS = 6;
+
+    struct Slot
+    {
+        uint32_t nHash;
+        uint32_t nEntry;
+    };
+
+    union Entry
+    {
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type value;
+        //! Index + 1 of the next free entry, while this one is free
+        uint32_t nNextFree;
+    };
+
+    std::vector<Slot> vSlots;
+    std::vector<Entry*> vPools;
+    Hash hasher;
+
+    //! Entries in the map, and those plus tombstones
+    size_t nSize;
+    size_t nUsed;
+
+    //! Entries ever handed out from the pools, and their total capacity
+    uint32_t nAllocated;
+    uint32_t nCapacity;
+
+    //! Index + 1 of the first free entry
+    uint32_t nFreeHead;
+
+    static unsigned int BitLength(uint32_t x)
+    {
+#if defined(__GNUC__)
+        return x == 0 ? 0 : 32 - __builtin_clz(x);
+#else
+        unsigned int n = 0;
+        while (x) {
+            x >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    Entry& EntryAt(uint32_t n) const
+    {
+        // Pool p starts at entry (2^p - 1) << POOL_BITS
+        unsigned int p = BitLength((n >> POOL_BITS) + 1) - 1;
+        return vPools[p][n - ((((uint32_t)1 << p) - 1) << POOL_BITS)];
+    }
+
+    value_type& ValueAt(uint32_t n) const
+    {
+        return *reinterpret_cast<value_type*>(&EntryAt(n).value);
+    }
+
+    uint32_t AllocEntry()
+    {
+        if (nFreeHead != 0) {
+            uint32_t n = nFreeHead - 1;
+            nFreeHead = EntryAt(n).nNextFree;
+            return n;
+        }
+        if (nAllocated == nCapacity) {
+            uint32_t nPoolSize = (uint32_t)1 << (POOL_BITS + vPools.size());
+            vPools.push_back(static_cast<Entry*>(::operator new(sizeof(Entry) * nPoolSize)));
+            nCapacity += nPoolSize;
+        }
+        return nAllocated++;
+    }
+
+    void FreeEntry(uint32_t n)
+    {
+        ValueAt(n).~value_type();
+        EntryAt(n).nNextFree = nFreeHead;
+        nFreeHead = n + 1;
+    }
+
+    static bool IsEntry(const Slot& slot)
+    {
+        return slot.nEntry != SLOT_EMPTY && slot.nEntry != SLOT_ERASED;
+    }
+
+    //! Slot holding key, or vSlots.size()
+    size_t FindSlot(const K& key, uint32_t nHash) const
+    {
+        if (nSize == 0)
+            return vSlots.size();
+        size_t nMask = vSlots.size() - 1;
+        for (size_t i = nHash & nMask; ; i = (i + 1) & nMask) {
+            const Slot& slot = vSlots[i];
+            if (slot.nEntry == SLOT_EMPTY)
+                return vSlots.size();
+            if (slot.nEntry != SLOT_ERASED && slot.nHash == nHash && ValueAt(slot.nEntry - 1).first == key)
+                return i;
+        }
+    }
+
+    //! Rebuild the slots with room for nEntries at a load of at most 3/8
+    void Rehash(size_t nEntries)
+    {
+        size_t nSlots = 16;
+        while (nSlots * 3 < nEntries * 8)
+            nSlots *= 2;
+        std::vector<Slot> vOld(nSlots, Slot{0, SLOT_EMPTY});
+        vOld.swap(vSlots);
+        size_t nMask = nSlots - 1;
+        for (const Slot& slot : vOld) {
+            if (!IsEntry(slot))
+                continue;
+            size_t i = slot.nHash & nMask;
+            while (vSlots[i].nEntry != SLOT_EMPTY)
+                i = (i + 1) & nMask;
+            vSlots[i] = slot;
+        }
+        nUsed = nSize;
+    }
+
+    //! Slot for a new key known not to be in the map; grows the slots at a load of 3/4
+    size_t InsertSlot(uint32_t nHash)
+    {
+        if ((nUsed + 1) * 4 > vSlots.size() * 3)
+            Rehash(nSize + 1);
+        size_t nMask = vSlots.size() - 1;
+        size_t i = nHash & nMask;
+        while (IsEntry(vSlots[i]))
+            i = (i + 1) & nMask;
+        return i;
+    }
+
+    template <bool fConst>
+    class iterator_base
+    {
+    private:
+        friend class COpenHashMap;
+        friend class iterator_base<!fConst>;
+        typedef typename std::conditional<fConst, const COpenHashMap, COpenHashMap>::type map_type;
+
+        map_type* pmap;
+        size_t nSlot;
+
+        iterator_base(map_type* pmapIn, size_t nSlotIn) : pmap(pmapIn), nSlot(nSlotIn) {}
+
+        void SkipEmpty()
+        {
+            while (nSlot < pmap->vSlots.size() && !IsEntry(pmap->vSlots[nSlot]))
+                nSlot++;
+        }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename COpenHashMap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef typename std::conditional<fConst, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<fConst, const value_type&, value_type&>::type reference;
+
+        iterator_base() : pmap(NULL), nSlot(0) {}
+
+        //! iterator converts to const_iterator
+        template <bool fOtherConst, typename = typename std::enable_if<fConst && !fOtherConst>::type>
+        iterator_base(const iterator_base<fOtherConst>& it) : pmap(it.pmap), nSlot(it.nSlot) {}
+
+        reference operator*() const { return pmap->ValueAt(pmap->vSlots[nSlot].nEntry - 1); }
+        pointer operator->() const { return &**this; }
+
+        iterator_base& operator++()
+        {
+            nSlot++;
+            SkipEmpty();
+            return *this;
+        }
+
+        iterator_base operator++(int)
+        {
+            iterator_base it(*this);
+            ++*this;
+            return it;
+        }
+
+        friend bool operator==(const iterator_base& a, const iterator_base& b) { return a.nSlot == b.nSlot; }
+        friend bool operator!=(const iterator_base& a, const iterator_base& b) { return a.nSlot != b.nSlot; }
+    };
+
+public:
+    typedef iterator_base<false> iterator;
+    typedef iterator_base<true> const_iterator;
+
+    COpenHashMap() : nSize(0), nUsed(0), nAllocated(0), nCapacity(0), nFreeHead(0) {}
+
+    COpenHashMap(const COpenHashMap& other) : hasher(other.hasher), nSize(0), nUsed(0), nAllocated(0), nCapacity(0), nFreeHead(0)
+    {
+        for (const value_type& v : other)
+            insert(v);
+    }
+
+    COpenHashMap(COpenHashMap&& other) : COpenHashMap()
+    {
+        swap(other);
+    }
+
+    COpenHashMap& operator=(COpenHashMap other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~COpenHashMap()
+    {
+        clear();
+    }
+
+    iterator begin()
+    {
+        iterator it(this, 0);
+        it.SkipEmpty();
+        return it;
+    }
+
+    const_iterator begin() const
+    {
+        const_iterator it(this, 0);
+        it.SkipEmpty();
+        return it;
+    }
+
+    iterator end() { return iterator(this, vSlots.size()); }
+    const_iterator end() const { return const_iterator(this, vSlots.size()); }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const K& key) { return iterator(this, FindSlot(key, (uint32_t)hasher(key))); }
+    const_iterator find(const K& key) const { return const_iterator(this, FindSlot(key, (uint32_t)hasher(key))); }
+    size_t count(const K& key) const { return find(key) == end() ? 0 : 1; }
+
+    template <typename P>
+    std::pair<iterator, bool> insert(P&& v)
+    {
+        uint32_t nHash = (uint32_t)hasher(v.first);
+        size_t i = FindSlot(v.first, nHash);
+        if (i != vSlots.size())
+            return std::make_pair(iterator(this, i), false);
+
+        i = InsertSlot(nHash);
+        uint32_t n = AllocEntry();
+        try {
+            new (&EntryAt(n).value) value_type(std::forward<P>(v));
+        } catch (...) {
+            EntryAt(n).nNextFree = nFreeHead;
+            nFreeHead = n + 1;
+            throw;
+        }
+        if (vSlots[i].nEntry == SLOT_EMPTY)
+            nUsed++;
+        vSlots[i].nHash = nHash;
+        vSlots[i].nEntry = n + 1;
+        nSize++;
+        return std::make_pair(iterator(this, i), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            it = insert(value_type(key, T())).first;
+        return it->second;
+    }
+
+    iterator erase(iterator it)
+    {
+        Slot& slot = vSlots[it.nSlot];
+        FreeEntry(slot.nEntry - 1);
+        slot.nEntry = SLOT_ERASED;
+        nSize--;
+        return ++it;
+    }
+
+    size_t erase(const K& key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    //! Destroy all entries and free all memory
+    void clear()
+    {
+        for (const Slot& slot : vSlots)
+            if (IsEntry(slot))
+                ValueAt(slot.nEntry - 1).~value_type();
+        for (Entry* pool : vPools)
+            ::operator delete(pool);
+        std::vector<Slot>().swap(vSlots);
+        std::vector<Entry*>().swap(vPools);
+        nSize = nUsed = 0;
+        nAllocated = nCapacity = nFreeHead = 0;
+    }
+
+    void swap(COpenHashMap& other)
+    {
+        vSlots.swap(other.vSlots);
+        vPools.swap(other.vPools);
+        std::swap(hasher, other.hasher);
+        std::swap(nSize, other.nSize);
+        std::swap(nUsed, other.nUsed);
+        std::swap(nAllocated, other.nAllocated);
+        std::swap(nCapacity, other.nCapacity);
+        std::swap(nFreeHead, other.nFreeHead);
+    }
+
+    //! Heap memory of the slots and pools, free entries included
+    size_t DynamicMemoryUsage() const
+    {
+        size_t nUsage = memusage::MallocUsage(vSlots.capacity() * sizeof(Slot)) +
+                        memusage::MallocUsage(vPools.capacity() * sizeof(Entry*));
+        for (size_t p = 0; p < vPools.size(); p++)
+            nUsage += memusage::MallocUsage(sizeof(Entry) << (POOL_BITS + p));
+        return nUsage;
+    }
+};
+
+namespace memusage
+{
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const COpenHashMap<X, Y, Z>& m)
+{
+    return m.DynamicMemoryUsage();
+}
+
+}
+
+#endif // BITCOIN_OPENHASHMAP_H
@@ -0,0 +1,63 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "powhashqueue.h"
+
+#include "primitives/block.h"
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/thread.hpp>
+
+void CPowHashQueue::Loop(bool fMaster)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (nNext == nCount) {
+            if (fMaster) {
+                if (nTodo == 0)
+                    return;
+                condMaster.wait(lock);
+            } else {
+                condWorker.wait(lock);
+            }
+        }
+        // One header per grab: a hash costs milliseconds, the lock doesn't matter
+        const CBlockHeader& header = pheaders[nNext++];
+        lock.unlock();
+        header.GetHash();
+        lock.lock();
+        if (--nTodo == 0 && !fMaster)
+            condMaster.notify_one();
+    }
+}
+
+void CPowHashQueue::Thread()
+{
+    Loop(false);
+}
+
+void CPowHashQueue::Hash(const CBlockHeader* pheadersIn, size_t nCountIn)
+{
+    if (nCountIn == 0)
+        return;
+
+    // Workers write into the caller's headers: never leave before they are done
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lockBatch(mutexBatch);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pheaders = pheadersIn;
+        nCount = nCountIn;
+        nNext = 0;
+        nTodo = nCountIn;
+    }
+    if (nCountIn > 1)
+        condWorker.notify_all();
+
+    Loop(true);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    pheaders = NULL;
+    nCount = nNext = 0;
+}
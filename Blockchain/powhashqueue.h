@@ -0,0 +1,63 @@
+// Copyright (c) 2016-2018 Ulord Foundation Ltd.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_POWHASHQUEUE_H
+#define BITCOIN_POWHASHQUEUE_H
+
+#include <stddef.h>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlockHeader;
+
+/**
+ * Pool computing the CryptoHello hashes of a batch of headers in parallel.
+ *
+ * CBlockHeader::GetHash() memoizes its result, so once a batch went through
+ * Hash() the in-order validation that follows (AcceptBlockHeader) finds every
+ * hash already computed, and only has to apply the index updates.
+ *
+ * As with CCheckQueue, the thread calling Hash() (the master) joins the N-1
+ * worker threads until the whole batch is done. Batches from different
+ * callers are processed one after the other.
+ */
+class CPowHashQueue
+{
+private:
+    //! Serializes masters, so only one batch is in flight
+    boost::mutex mutexBatch;
+
+    //! Mutex to protect the batch state below
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this while workers finish their last headers
+    boost::condition_variable condMaster;
+
+    //! The batch being hashed, NULL when idle
+    const CBlockHeader* pheaders;
+    size_t nCount;
+
+    //! Index of the next header to hand out
+    size_t nNext;
+
+    //! Number of headers handed out or queued that are not hashed yet
+    size_t nTodo;
+
+    void Loop(bool fMaster);
+
+public:
+    CPowHashQueue() : pheaders(NULL), nCount(0), nNext(0), nTodo(0) {}
+
+    //! Worker thread
+    void Thread();
+
+    //! Compute GetHash() of pheadersIn[0, nCountIn) and return once all are memoized
+    void Hash(const CBlockHeader* pheadersIn, size_t nCountIn);
+};
+
+#endif // BITCOIN_POWHASHQUEUE_H
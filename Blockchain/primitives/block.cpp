@@ -12,16 +12,97 @@
 #include "../utilstrencodings.h"
 //#include "crypto/common.h"
 
+const size_t CBlockHeader::HEADER_SIZE;
+
+CBlockHeader::CBlockHeader(const CBlockHeader& other) : fMemoLocked(false)
+{
+	CopyFields(other);
+}
+
+CBlockHeader& CBlockHeader::operator=(const CBlockHeader& other)
+{
+	if (this != &other)
+		CopyFields(other);
+	return *this;
+}
+
+void CBlockHeader::CopyFields(const CBlockHeader& other)
+{
+	nVersion = other.nVersion;
+	hashPrevBlock = other.hashPrevBlock;
+	hashMerkleRoot = other.hashMerkleRoot;
+	hashClaimTrie = other.hashClaimTrie;
+	nTime = other.nTime;
+	nBits = other.nBits;
+	nNonce = other.nNonce;
+
+	other.LockMemo();
+	fHashCached = other.fHashCached;
+	hashHashedHeader = other.hashHashedHeader;
+	hashCached = other.hashCached;
+	other.UnlockMemo();
+}
+
+void CBlockHeader::LockMemo() const
+{
+	while (fMemoLocked.exchange(true, std::memory_order_acquire)) {
+		// held only for a copy of two hashes
+	}
+}
+
+void CBlockHeader::UnlockMemo() const
+{
+	fMemoLocked.store(false, std::memory_order_release);
+}
+
 uint256 CBlockHeader::GetHash() const
 {
-//	return SerializeHash(*this);
+	unsigned char header[HEADER_SIZE];
+	SerializeHeader(header);
+	uint256 hashHeader;
+	CSHA256().Write(header, HEADER_SIZE).Finalize(hashHeader.begin());
+
 	uint256 hash;
+	LockMemo();
+	bool fHit = fHashCached && hashHashedHeader == hashHeader;
+	if (fHit)
+		hash = hashCached;
+	UnlockMemo();
+	if (fHit)
+		return hash;
+
+	CryptoHello::Hash(header, (unsigned char *)&hash);
+	LockMemo();
+	hashHashedHeader = hashHeader;
+	hashCached = hash;
+	fHashCached = true;
+	UnlockMemo();
+	return hash;
+}
 
-	CryptoHello(this, (unsigned char *)&hash);
-//	view_data_u8("PoW 3", (unsigned char *)&hash, OUTPUT_LEN); 
-//	std::cout<<"gethex() ="<<hash.GetHex()<<std::endl;
-//	std::cout<<"tostring ="<<hash.ToString()<<std::endl; 
-	return hash;	
+uint256 CBlockHeader::ComputeHash() const
+{
+	unsigned char header[HEADER_SIZE];
+	SerializeHeader(header);
+
+	uint256 hash;
+	CryptoHello::Hash(header, (unsigned char *)&hash);
+	return hash;
+}
+
+void CBlockHeader::SerializeHeader(unsigned char out[HEADER_SIZE]) const
+{
+	uint32_t n;
+	n = htole32((uint32_t)nVersion);
+	memcpy(out, &n, 4);
+	memcpy(out + 4, hashPrevBlock.begin(), 32);
+	memcpy(out + 36, hashMerkleRoot.begin(), 32);
+	memcpy(out + 68, hashClaimTrie.begin(), 32);
+	n = htole32(nTime);
+	memcpy(out + 100, &n, 4);
+	n = htole32(nBits);
+	memcpy(out + 104, &n, 4);
+	memcpy(out + 108, nNonce.begin(), 32);
 }
 
 std::string CBlockHeader::ToString() const                                                                                                                                                                                                                                   
@@ -10,6 +10,8 @@
 #include "../serialize.h"
 #include "../uint256.h"
 
+#include <atomic>
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -22,6 +24,8 @@ class CBlockHeader
 public:
     // header
     static const int32_t CURRENT_VERSION=1;
+    //! size of the serialized header, which is the CryptoHello input
+    static const size_t HEADER_SIZE=140;
     int32_t nVersion;
     uint256 hashPrevBlock;
     uint256 hashMerkleRoot;
@@ -35,6 +39,10 @@ public:
         SetNull();
     }
 
+    //! Copies carry the memoized hash along
+    CBlockHeader(const CBlockHeader& other);
+    CBlockHeader& operator=(const CBlockHeader& other);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -58,6 +66,8 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce.SetNull();
+        fMemoLocked = false;
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -65,14 +75,39 @@ public:
         return (nBits == 0);
     }
 
+    /** PoW hash of the header. Memoized: CryptoHello only runs again after one of
+     *  the consensus fields has been changed since the last call. */
     uint256 GetHash() const;
 
+    /** Always run CryptoHello, bypassing the memoized hash. For the miner, which
+     *  changes nNonce between every call and never asks twice. */
+    uint256 ComputeHash() const;
+
+    //! Serialize the consensus fields (as the network serializer does) into out
+    void SerializeHeader(unsigned char out[HEADER_SIZE]) const;
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
     }
 
 	std::string ToString() const;
+
+private:
+    /**
+     * (memory only) The memoized hash, and a SHA256 of the header bytes it was
+     * computed from. The same header may be hashed by several threads at once,
+     * so these are only accessed under fMemoLocked, a spin lock held for a copy;
+     * CryptoHello runs outside it.
+     */
+    mutable std::atomic<bool> fMemoLocked;
+    mutable bool fHashCached;
+    mutable uint256 hashHashedHeader;
+    mutable uint256 hashCached;
+
+    void LockMemo() const;
+    void UnlockMemo() const;
+    void CopyFields(const CBlockHeader& other);
 };
 
 
@@ -118,15 +153,8 @@ public:
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-		block.hashClaimTrie   = hashClaimTrie;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        return block;
+        // slice rather than copy field by field, so the memoized hash comes along
+        return *this;
     }
 
     std::string ToString() const;
@@ -164,14 +164,9 @@ static int ecdsa_signature_parse_der_lax(const secp256k1_context* ctx, secp256k1
     return 1;
 }
 
-bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
-    if (!IsValid())
-        return false;
-    secp256k1_pubkey pubkey;
+/** Verify a DER signature against a parsed public key. */
+static bool VerifyParsed(const secp256k1_pubkey& pubkey, const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
-        return false;
-    }
     if (vchSig.size() == 0) {
         return false;
     }
@@ -184,6 +179,39 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
 }
 
+bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    if (!IsValid())
+        return false;
+    secp256k1_pubkey pubkey;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
+        return false;
+    }
+    return VerifyParsed(pubkey, hash, vchSig);
+}
+
+static_assert(sizeof(secp256k1_pubkey) == 64, "CParsedPubKeys::Parsed must hold a secp256k1_pubkey");
+
+bool CParsedPubKeys::Add(const CPubKey& pubkey) {
+    if (!pubkey.IsValid())
+        return false;
+    if (mapParsed.count(pubkey))
+        return true;
+    secp256k1_pubkey parsed;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &parsed, &pubkey[0], pubkey.size()))
+        return false;
+    memcpy(mapParsed[pubkey].data, parsed.data, sizeof(parsed.data));
+    return true;
+}
+
+bool CParsedPubKeys::Verify(const CPubKey& pubkey, const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    std::map<CPubKey, Parsed>::const_iterator it = mapParsed.find(pubkey);
+    if (it == mapParsed.end())
+        return pubkey.Verify(hash, vchSig);
+    secp256k1_pubkey parsed;
+    memcpy(parsed.data, it->second.data, sizeof(parsed.data));
+    return VerifyParsed(parsed, hash, vchSig);
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
@@ -10,6 +10,7 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <map>
 #include <stdexcept>
 #include <vector>
 
@@ -195,6 +196,33 @@ public:
     bool Derive(CPubKey& pubkeyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 };
 
+/**
+ * Public keys parsed once for many signature checks, such as the keys that
+ * several inputs of a block sign with. Parsing a compressed key takes a
+ * square root, a good part of the cost of a check besides the verification.
+ * Filled before the checks start, and only read while they run.
+ */
+class CParsedPubKeys
+{
+private:
+    //! A secp256k1_pubkey, whose type stays in pubkey.cpp
+    struct Parsed
+    {
+        unsigned char data[64];
+    };
+
+    std::map<CPubKey, Parsed> mapParsed;
+
+public:
+    //! Parse pubkey for later checks; false if it isn't a valid key
+    bool Add(const CPubKey& pubkey);
+
+    size_t size() const { return mapParsed.size(); }
+
+    //! CPubKey::Verify, with the key parsed here if it was added
+    bool Verify(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+};
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
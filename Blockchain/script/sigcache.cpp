@@ -5,94 +5,143 @@
 
 #include "sigcache.h"
 
-#include "../memusage.h"
 #include "../pubkey.h"
 #include "../random.h"
 #include "../uint256.h"
 #include "../util.h"
 
-#include <boost/thread.hpp>
-#include <unordered_set>
+#include <algorithm>
 
-namespace {
-
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher
+CSignatureCache::CSignatureCache()
 {
-public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
+    for (Counters& c : counters) {
+        c.nHits = 0;
+        c.nMisses = 0;
+        c.nInserts = 0;
+        c.nEvictions = 0;
+        c.nContended = 0;
     }
-};
-
-/**
- * Valid signature cache, to avoid doing expensive ECDSA signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
- */
-class CSignatureCache
+}
+
+void CSignatureCache::Init(size_t nMaxBytes)
 {
-private:
-     //! Entries are SHA256(nonce || signature hash || public key || signature):
-    uint256 nonce;
-    typedef std::unordered_set<uint256, CSignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
-
-
-public:
-    CSignatureCache()
-    {
-        GetRandBytes(nonce.begin(), 32);
-    }
+    GetRandBytes(nonce.begin(), 32);
+    std::vector<Bucket>(nMaxBytes / sizeof(Bucket)).swap(vBuckets);
+}
 
-    void
-    ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
-    {
-        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
-    }
+void CSignatureCache::ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+{
+    CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
+}
 
-    bool
-    Get(const uint256& entry)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+CSignatureCache::Bucket* CSignatureCache::Find(const uint256& entry, uint64_t& nTag, Counters*& pcounters)
+{
+    if (vBuckets.empty())
+        return NULL;
+    // The bucket from the first 64 bits, the tag from the next
+    size_t nBucket = entry.GetCheapHash() % vBuckets.size();
+    nTag = letoh64(*(const uint64_t*)(entry.begin() + 8));
+    if (nTag == 0)
+        nTag = 1;
+    pcounters = &counters[nBucket % COUNTER_STRIPES];
+    return &vBuckets[nBucket];
+}
+
+bool CSignatureCache::Get(const uint256& entry)
+{
+    uint64_t nTag;
+    Counters* pcounters;
+    Bucket* pbucket = Find(entry, nTag, pcounters);
+    if (pbucket == NULL)
+        return false;
+    for (unsigned int i = 0; i < WAYS; i++) {
+        if (pbucket->anTags[i].load(std::memory_order_relaxed) == nTag) {
+            pcounters->nHits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
     }
+    pcounters->nMisses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
 
-    void Erase(const uint256& entry)
-    {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+void CSignatureCache::Erase(const uint256& entry)
+{
+    uint64_t nTag;
+    Counters* pcounters;
+    Bucket* pbucket = Find(entry, nTag, pcounters);
+    if (pbucket == NULL)
+        return;
+    for (unsigned int i = 0; i < WAYS; i++) {
+        uint64_t nOld = nTag;
+        if (pbucket->anTags[i].compare_exchange_strong(nOld, 0, std::memory_order_relaxed))
+            return;
     }
+}
 
-    void Set(const uint256& entry)
-    {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
+void CSignatureCache::Set(const uint256& entry)
+{
+    uint64_t nTag;
+    Counters* pcounters;
+    Bucket* pbucket = Find(entry, nTag, pcounters);
+    if (pbucket == NULL)
+        return;
+
+    // A free way if there is one, else one picked by the entry's own bits
+    uint64_t anOld[WAYS];
+    unsigned int nWay = WAYS;
+    for (unsigned int i = 0; i < WAYS; i++) {
+        anOld[i] = pbucket->anTags[i].load(std::memory_order_relaxed);
+        if (anOld[i] == nTag)
+            return;
+        if (anOld[i] == 0 && nWay == WAYS)
+            nWay = i;
+    }
+    if (nWay == WAYS)
+        nWay = entry.begin()[16] % WAYS;
+
+    // Another thread changing the way first gets it; try the others once
+    for (unsigned int n = 0; n < WAYS; n++, nWay = (nWay + 1) % WAYS) {
+        if (pbucket->anTags[nWay].compare_exchange_strong(anOld[nWay], nTag, std::memory_order_relaxed)) {
+            pcounters->nInserts.fetch_add(1, std::memory_order_relaxed);
+            if (anOld[nWay] != 0)
+                pcounters->nEvictions.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
+        pcounters->nContended.fetch_add(1, std::memory_order_relaxed);
+        if (anOld[nWay] == nTag)
+            return;
+    }
+}
 
-        setValid.insert(entry);
+CSignatureCacheStats CSignatureCache::GetStats() const
+{
+    CSignatureCacheStats stats = {};
+    stats.nBytes = vBuckets.size() * sizeof(Bucket);
+    for (const Counters& c : counters) {
+        stats.nHits += c.nHits.load(std::memory_order_relaxed);
+        stats.nMisses += c.nMisses.load(std::memory_order_relaxed);
+        stats.nInserts += c.nInserts.load(std::memory_order_relaxed);
+        stats.nEvictions += c.nEvictions.load(std::memory_order_relaxed);
+        stats.nContended += c.nContended.load(std::memory_order_relaxed);
     }
-};
+    return stats;
+}
 
+static CSignatureCache signatureCache;
+
+void InitSignatureCache()
+{
+    int64_t nMaxMiB = std::max<int64_t>(0, std::min(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE));
+    signatureCache.Init((size_t)nMaxMiB << 20);
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+CSignatureCacheStats GetSignatureCacheStats()
 {
-    static CSignatureCache signatureCache;
+    return signatureCache.GetStats();
+}
 
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
@@ -103,8 +152,12 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
         return true;
     }
 
-    if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+    if (pparsedKeys != NULL) {
+        if (!pparsedKeys->Verify(pubkey, sighash, vchSig))
+            return false;
+    } else if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash)) {
         return false;
+    }
 
     if (store) {
         signatureCache.Set(entry);
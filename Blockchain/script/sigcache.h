@@ -8,21 +8,101 @@
 
 #include "interpreter.h"
 
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// DoS prevention: limit cache size to 40MB (over 5 million entries).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Maximum -maxsigcachesize, in MiB
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
+class CParsedPubKeys;
 class CPubKey;
 
+struct CSignatureCacheStats
+{
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    //! Valid entries overwritten to make room
+    uint64_t nEvictions;
+    //! Inserts and erases that lost a race for a way to another thread
+    uint64_t nContended;
+};
+
+/**
+ * Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain)
+ *
+ * A fixed table of buckets of one cache line each, allocated by Init().
+ * An entry is reduced to a 64-bit tag stored in one of the ways of the
+ * bucket its other bits select; lookups only load the bucket, and inserts
+ * and erases swap a single way by compare-and-swap. Entries are salted with
+ * a random nonce, so an outsider cannot aim for a false match, which takes
+ * both the bucket and all 64 tag bits agreeing.
+ */
+class CSignatureCache
+{
+private:
+    static const unsigned int WAYS = 8;
+    static const unsigned int COUNTER_STRIPES = 16;
+
+    struct alignas(64) Bucket
+    {
+        //! Tags of the entries held, 0 for a free way
+        std::atomic<uint64_t> anTags[WAYS];
+    };
+
+    //! Counters, spread over cache lines by bucket so threads don't share one
+    struct alignas(64) Counters
+    {
+        std::atomic<uint64_t> nHits;
+        std::atomic<uint64_t> nMisses;
+        std::atomic<uint64_t> nInserts;
+        std::atomic<uint64_t> nEvictions;
+        std::atomic<uint64_t> nContended;
+    };
+
+    //! Entries are SHA256(nonce || signature hash || public key || signature):
+    uint256 nonce;
+    std::vector<Bucket> vBuckets;
+    Counters counters[COUNTER_STRIPES];
+
+    Bucket* Find(const uint256& entry, uint64_t& nTag, Counters*& pcounters);
+
+public:
+    CSignatureCache();
+
+    //! Size the table to at most nMaxBytes and draw a new nonce, dropping all entries; not thread safe
+    void Init(size_t nMaxBytes);
+
+    void ComputeEntry(uint256& entry, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const;
+
+    bool Get(const uint256& entry);
+    void Erase(const uint256& entry);
+    void Set(const uint256& entry);
+
+    CSignatureCacheStats GetStats() const;
+};
+
+/** Size the signature cache from -maxsigcachesize */
+void InitSignatureCache();
+
+CSignatureCacheStats GetSignatureCacheStats();
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
+    //! Keys already parsed for this check, or NULL
+    const CParsedPubKeys* pparsedKeys;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true, const CParsedPubKeys* pparsedKeysIn=NULL) : TransactionSignatureChecker(txToIn, nInIn), store(storeIn), pparsedKeys(pparsedKeysIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
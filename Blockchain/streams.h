@@ -297,6 +297,12 @@ public:
 		clear();
 	}
 
+	/** Exchange the whole buffer with vchIn, without copying, and read from its start */
+	void swap(vector_type& vchIn) {
+		vch.swap(vchIn);
+		nReadPos = 0;
+	}
+
 	/**
 	 * XOR the contents of this stream with a certain key.
 	 *
@@ -446,6 +452,52 @@ public:
 	}
 };
 
+/** Read-only stream over bytes it does not own, such as a mapped file.
+ *
+ * Objects are deserialized straight from those bytes, which must stay valid
+ * while the stream is used.
+ */
+class CSpanReader
+{
+private:
+	int nType;
+	int nVersion;
+
+	const char* pcur;
+	const char* pend;
+
+public:
+	CSpanReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn)
+		: nType(nTypeIn), nVersion(nVersionIn), pcur(pbeginIn), pend(pendIn)
+	{
+	}
+
+	//
+	// Stream subset
+	//
+	int GetType() { return nType; }
+	int GetVersion() { return nVersion; }
+	size_t size() const { return pend - pcur; }
+	bool empty() const { return pcur == pend; }
+
+	CSpanReader& read(char* pch, size_t nSize)
+	{
+		if (nSize > size())
+			throw std::ios_base::failure("CSpanReader::read: end of data");
+		memcpy(pch, pcur, nSize);
+		pcur += nSize;
+		return (*this);
+	}
+
+	template<typename T>
+	CSpanReader& operator>>(T& obj)
+	{
+		// Unserialize from this stream
+		::Unserialize(*this, obj, nType, nVersion);
+		return (*this);
+	}
+};
+
 /** Non-refcounted RAII wrapper around a FILE* that implements a ring buffer to
  *  deserialize from. It guarantees the ability to rewind a given number of bytes.
  *
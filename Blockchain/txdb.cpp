@@ -10,10 +10,13 @@
 #include "hash.h"
 #include "main.h"
 #include "pow.h"
+#include "random.h"
 #include "uint256.h"
 
 #include <stdint.h>
 
+#include <atomic>
+
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -37,8 +40,11 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+Opt<CCoins> CCoinsViewDB::GetCoins(const uint256 &txid) const {
+    CCoins coins;
+    if (!db.Read(make_pair(DB_COINS, txid), coins))
+        return {};
+    return coins;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
@@ -53,10 +59,16 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool fOk = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return fOk;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(&db.GetObfuscateKey());
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             if (it->second.coins.IsPruned())
                 batch.Erase(make_pair(DB_COINS, it->first));
@@ -65,8 +77,6 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
@@ -75,6 +85,138 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB* dbIn)
+    : CCoinsViewBacked(dbIn), db(dbIn), fWriteFailed(false), fQuit(false)
+{
+    threadWriter = boost::thread(&CCoinsViewBackgroundFlush::ThreadWrite, this);
+}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fQuit = true;
+        condWriter.notify_one();
+    }
+    // The writer finishes the map it was given before it leaves
+    threadWriter.join();
+}
+
+void CCoinsViewBackgroundFlush::ThreadWrite()
+{
+    RenameThread("ulord-coinsflush");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (!fQuit && !pmapWriting)
+            condWriter.wait(lock);
+        if (!pmapWriting)
+            return;
+
+        lock.unlock();
+        bool fOk = false;
+        try {
+            fOk = db->WriteCoins(*pmapWriting, hashWriting);
+            if (fOk && fnAfterWriting)
+                fOk = fnAfterWriting();
+        } catch (const std::runtime_error& e) {
+            LOG_ERROR("Error writing to coin database: {}", e.what());
+        }
+        lock.lock();
+
+        // The database has it all now; free the map without holding up readers
+        std::unique_ptr<const CCoinsMap> pmapWritten = std::move(pmapWriting);
+        std::function<bool()> fnWritten = std::move(fnAfterWriting);
+        fnAfterWriting = nullptr;
+        if (!fOk)
+            fWriteFailed = true;
+        condWritten.notify_all();
+        lock.unlock();
+        pmapWritten.reset();
+        fnWritten = nullptr;
+        lock.lock();
+    }
+}
+
+bool CCoinsViewBackgroundFlush::WaitIdle(boost::unique_lock<boost::mutex>& lock) const
+{
+    while (pmapWriting)
+        condWritten.wait(lock);
+    return !fWriteFailed;
+}
+
+Opt<CCoins> CCoinsViewBackgroundFlush::GetCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (pmapWriting) {
+            CCoinsMap::const_iterator it = pmapWriting->find(txid);
+            if (it != pmapWriting->end()) {
+                // A pruned entry is erased from the database
+                if (it->second.coins.IsPruned())
+                    return {};
+                return it->second.coins;
+            }
+        }
+    }
+    return base->GetCoins(txid);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (pmapWriting) {
+            CCoinsMap::const_iterator it = pmapWriting->find(txid);
+            if (it != pmapWriting->end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (pmapWriting && !hashWriting.IsNull())
+            return hashWriting;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    // Swapping keeps both the copy and the deallocation of the map off the caller's thread
+    std::unique_ptr<CCoinsMap> pmap(new CCoinsMap());
+    pmap->swap(mapCoins);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!WaitIdle(lock))
+        return false;
+    pmapWriting = std::move(pmap);
+    hashWriting = hashBlock;
+    fnAfterWriting = std::move(fnAfterNext);
+    fnAfterNext = nullptr;
+    condWriter.notify_one();
+    return true;
+}
+
+bool CCoinsViewBackgroundFlush::GetStats(CCoinsStats &stats) const {
+    // The statistics are computed from the database alone
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!WaitIdle(lock))
+            return false;
+    }
+    return base->GetStats(stats);
+}
+
+bool CCoinsViewBackgroundFlush::Sync() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return WaitIdle(lock);
+}
+
+void CCoinsViewBackgroundFlush::WriteAfterNext(std::function<bool()> fnWrite) {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fnAfterNext = std::move(fnWrite);
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -308,12 +450,42 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+/** Recompute the CryptoHello hash of the sampled records on all cores. */
+static bool VerifyBlockIndexPowSample(const std::vector<CDiskBlockIndex>& vSample)
+{
+    if (vSample.empty())
+        return true;
+
+    const int nThreads = std::max(1, std::min<int>(GetNumCores(), vSample.size()));
+    std::atomic<size_t> nNext(0);
+    std::atomic<bool> fFailed(false);
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads; i++) {
+        workers.create_thread([&]() {
+            size_t n;
+            while (!fFailed && (n = nNext++) < vSample.size()) {
+                const CDiskBlockIndex& diskindex = vSample[n];
+                if (diskindex.ComputeBlockHash() != diskindex.hash) {
+                    LOG_ERROR("LoadBlockIndex(): stored PoW hash mismatch: {}", diskindex.ToString());
+                    fFailed = true;
+                }
+            }
+        });
+    }
+    workers.join_all();
+    return !fFailed;
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(int nCheckPowSample)
 {
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
 
+    // Records whose PoW is re-derived after the scan (reservoir sample, or all when nCheckPowSample < 0)
+    std::vector<CDiskBlockIndex> vSample;
+    uint64_t nRecords = 0;
+
     // Load mapBlockIndex
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
@@ -334,13 +506,28 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nTime          = diskindex.nTime;
                 pindexNew->nBits          = diskindex.nBits;
                 pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
+                pindexNew->nStatus        = diskindex.nStatus & ~BLOCK_OPT_POWCHECKSUM;
                 pindexNew->nTx            = diskindex.nTx;
 
-#if 0
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-#endif
+                // The stored hash is what the block was validated with; checking it against
+                // its target and the record checksum is cheap, unlike recomputing CryptoHello.
+                if (!CheckProofOfWork(diskindex.hash, diskindex.nBits, Params().GetConsensus())) {
+                    LOG_ERROR("LoadBlockIndex(): CheckProofOfWork failed: {}", diskindex.ToString());
+                    return false;
+                }
+                if ((diskindex.nStatus & BLOCK_OPT_POWCHECKSUM) && !diskindex.HasValidPowChecksum()) {
+                    LOG_ERROR("LoadBlockIndex(): PoW checksum mismatch: {}", diskindex.ToString());
+                    return false;
+                }
+
+                nRecords++;
+                if (nCheckPowSample < 0 || vSample.size() < (uint64_t)nCheckPowSample) {
+                    vSample.push_back(diskindex);
+                } else if (nCheckPowSample > 0) {
+                    uint64_t n = GetRand(nRecords);
+                    if (n < vSample.size())
+                        vSample[n] = diskindex;
+                }
                 pcursor->Next();
             } else {
 				LOG_ERROR("LoadBlockIndex() : failed to read value");
@@ -351,5 +538,6 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         }
     }
 
-    return true;
+    LOG_INFO("LoadBlockIndex(): re-verifying PoW of {} out of {} block index records", vSample.size(), nRecords);
+    return VerifyBlockIndexPowSample(vSample);
 }
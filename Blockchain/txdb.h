@@ -9,11 +9,17 @@
 #include "coins.h"
 #include "dbwrapper.h"
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 class CBlockFileInfo;
 class CBlockIndex;
 struct CDiskTxPos;
@@ -34,6 +40,8 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -checkblockindexpow default (block index records whose PoW is recomputed at startup)
+static const int DEFAULT_CHECKBLOCKINDEXPOW = 64;
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -43,11 +51,82 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    Opt<CCoins> GetCoins(const uint256 &txid) const override;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetStats(CCoinsStats &stats) const;
+
+    //! Write the dirty entries of mapCoins and hashBlock in one atomic batch, leaving mapCoins untouched
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+};
+
+/**
+ * Writes the coin database from a background thread.
+ *
+ * BatchWrite() takes the flushed cache map by swapping it out, hands it to
+ * the writer thread and returns, so the flushing cache starts over empty
+ * while the write goes on. Until the write is done, reads are answered from
+ * that map before the database. One map is written at a time: a flush
+ * arriving while the previous one is still being written waits for it.
+ *
+ * Each map is written in a single database batch with its best block, so
+ * after a crash the coin database is at the best block of the last complete
+ * write, and the blocks after it are connected again at startup.
+ *
+ * The memory of a map being written is not counted by the flushing cache,
+ * so coins may briefly take up to twice -dbcache.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB* db;
+
+    mutable boost::mutex mutex;
+
+    //! The writer blocks on this while there is nothing to write
+    boost::condition_variable condWriter;
+
+    //! Flushes and Sync() block on this while a write is in progress
+    mutable boost::condition_variable condWritten;
+
+    //! The map being written with its best block, NULL when idle
+    std::unique_ptr<const CCoinsMap> pmapWriting;
+    uint256 hashWriting;
+
+    //! Run after the next map handed to BatchWrite, and after the map being written
+    std::function<bool()> fnAfterNext;
+    std::function<bool()> fnAfterWriting;
+
+    bool fWriteFailed;
+    bool fQuit;
+
+    boost::thread threadWriter;
+
+    void ThreadWrite();
+
+    //! Wait for the write in progress, if any; false if a write failed
+    bool WaitIdle(boost::unique_lock<boost::mutex>& lock) const;
+
+public:
+    explicit CCoinsViewBackgroundFlush(CCoinsViewDB* dbIn);
+    ~CCoinsViewBackgroundFlush();
+
+    Opt<CCoins> GetCoins(const uint256 &txid) const override;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Wait until everything handed to BatchWrite is on disk; false if any of it failed
+    bool Sync();
+
+    /**
+     * Have the writer call fnWrite once the next map handed to BatchWrite is
+     * committed, for state that must not reach the disk ahead of the coins.
+     * Its failure is reported like that of the map.
+     */
+    void WriteAfterNext(std::function<bool()> fnWrite);
 };
 
 /** Access to the block database (blocks/index/) */
@@ -80,7 +159,7 @@ public:
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts();
+    bool LoadBlockIndexGuts(int nCheckPowSample = DEFAULT_CHECKBLOCKINDEXPOW);
 };
 
 #endif // BITCOIN_TXDB_H